@@ -0,0 +1,198 @@
+// Websocket Server implementation
+// Belongs to the public domain
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "server_fwd.hpp"
+
+namespace websocket
+{
+    // An event as Server::poll() hands it out, one cache line. Payloads up to InlineSize bytes
+    // are stored in the record, longer ones in a shared buffer with a reference count, so a copy
+    // of the record never copies the payload.
+    class EventRecord
+    {
+    public:
+        static const std::size_t InlineSize = 40;
+
+        EventRecord() {}
+
+        EventRecord(Event event, ConnectionId connId, std::string message = {}, bool isBinary = false,
+            std::chrono::steady_clock::time_point receivedAt = std::chrono::steady_clock::now(), std::uint8_t route = 0)
+            : m_receivedAt{receivedAt.time_since_epoch().count()}
+            , m_connId{connId}
+            , m_size{static_cast<std::uint32_t>(message.size())}
+            , m_event{static_cast<std::uint8_t>(event)}
+            , m_isBinary{isBinary}
+            , m_route{route}
+        {
+            if (isLarge())
+                m_large = new LargePayload{std::move(message)};
+            else
+                std::memcpy(m_inline, message.data(), message.size());
+        }
+
+        // a message turned into an object by ServerTraits::Decoder, the text itself isn't kept
+        static EventRecord fromDecoded(ConnectionId connId, std::shared_ptr<const void> object, bool isBinary,
+            std::chrono::steady_clock::time_point receivedAt = std::chrono::steady_clock::now(), std::uint8_t route = 0)
+        {
+            EventRecord record{Event::Message, connId, {}, isBinary, receivedAt, route};
+            record.m_isDecoded = true;
+            record.m_large = new LargePayload{{}, std::move(object)};
+            return record;
+        }
+
+        EventRecord(const EventRecord& other)
+        {
+            copyFrom(other);
+        }
+
+        EventRecord(EventRecord&& other)
+        {
+            moveFrom(other);
+        }
+
+        EventRecord& operator=(const EventRecord& other)
+        {
+            if (this != &other)
+            {
+                release();
+                copyFrom(other);
+            }
+            return *this;
+        }
+
+        EventRecord& operator=(EventRecord&& other)
+        {
+            if (this != &other)
+            {
+                release();
+                moveFrom(other);
+            }
+            return *this;
+        }
+
+        ~EventRecord()
+        {
+            release();
+        }
+
+        Event event() const { return static_cast<Event>(m_event); }
+        ConnectionId connId() const { return m_connId; }
+
+        // Event::Message only, the client sent a binary message
+        bool isBinary() const { return m_isBinary; }
+
+        // Event::Message only, 1 + the index of the ServerOptions::routeValues entry that the
+        // routeKey member of the message matches, 0 - none
+        std::uint8_t route() const { return m_route; }
+
+        // the object made by ServerTraits::Decoder, T is its Type; nullptr - not decoded
+        bool isDecoded() const { return m_isDecoded; }
+
+        template<typename T>
+        const T* decoded() const
+        {
+            return m_isDecoded ? static_cast<const T*>(m_large->decoded.get()) : nullptr;
+        }
+
+        // when the I/O thread got the message
+        std::chrono::steady_clock::time_point receivedAt() const
+        {
+            return std::chrono::steady_clock::time_point{std::chrono::steady_clock::duration{m_receivedAt}};
+        }
+
+        const char* data() const { return isLarge() ? m_large->data.data() : m_inline; }
+        std::size_t size() const { return m_size; }
+        std::string message() const { return{data(), size()}; }
+
+        // the payload as a string, moved out if no other record shares it; the record is left empty
+        std::string takeMessage()
+        {
+            std::string message;
+            if (isLarge() && m_large->refs.load(std::memory_order_acquire) == 1)
+                message = std::move(m_large->data);
+            else
+                message = this->message();
+
+            release();
+            return message;
+        }
+
+    private:
+        struct LargePayload
+        {
+            explicit LargePayload(std::string data, std::shared_ptr<const void> decoded = nullptr)
+                : data(std::move(data))
+                , decoded(std::move(decoded))
+            {}
+
+            std::atomic<std::size_t> refs{1};
+            std::string data;
+            std::shared_ptr<const void> decoded;
+        };
+
+        bool isLarge() const { return m_size > InlineSize || m_isDecoded; }
+
+        void copyFields(const EventRecord& other)
+        {
+            m_receivedAt = other.m_receivedAt;
+            m_connId = other.m_connId;
+            m_size = other.m_size;
+            m_event = other.m_event;
+            m_isBinary = other.m_isBinary;
+            m_isDecoded = other.m_isDecoded;
+            m_route = other.m_route;
+
+            if (isLarge())
+                m_large = other.m_large;
+            else
+                std::memcpy(m_inline, other.m_inline, m_size);
+        }
+
+        void copyFrom(const EventRecord& other)
+        {
+            copyFields(other);
+            if (isLarge())
+                m_large->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void moveFrom(EventRecord& other)
+        {
+            copyFields(other);
+            other.m_size = 0;
+            other.m_isDecoded = false;
+        }
+
+        void release()
+        {
+            if (isLarge() && m_large->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                delete m_large;
+
+            m_size = 0;
+            m_isDecoded = false;
+        }
+
+        std::chrono::steady_clock::rep m_receivedAt{0};
+        ConnectionId m_connId{0};
+        std::uint32_t m_size{0};
+        std::uint8_t m_event{0};
+        bool m_isBinary{false};
+        bool m_isDecoded{false};
+        std::uint8_t m_route{0};
+        union
+        {
+            char m_inline[InlineSize];
+            LargePayload* m_large;
+        };
+    };
+
+    static_assert(sizeof(EventRecord) == 64, "an event record is one cache line");
+}
@@ -0,0 +1,229 @@
+// Websocket Server implementation
+// Belongs to the public domain
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "server_fwd.hpp"
+#include "EventRecord.hpp"
+#include "details/RingQueue.hpp"
+
+namespace websocket
+{
+    // Runs the application handler of the events on a pool of threads. The events of one
+    // connection are handled one at a time and in order, different connections in parallel.
+    // Each connection has a serial queue; a queue with events is ready and sits in the deque
+    // of one thread, an idle thread steals ready queues from the others.
+    // dispatch() is called from one thread, the one that polls the server. Handlers must not
+    // throw; they may call Server::sendText/sendBinary/drop directly, those go to the I/O thread
+    // of the connection (to its worker process in the pre-fork mode).
+    class HandlerPool
+    {
+    public:
+        using handler_t = std::function<void(EventRecord&)>;
+
+        HandlerPool(unsigned threadCount, handler_t handler)
+            : m_handler(std::move(handler))
+            , m_workers(threadCount ? threadCount : 1)
+        {
+            for (std::size_t i = 0; i != m_workers.size(); ++i)
+                m_workers[i].thread = std::thread{[this, i] { run(i); }};
+        }
+
+        // the events already dispatched are handled first
+        ~HandlerPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock{m_idleMutex};
+                m_isStopping = true;
+            }
+            m_wakeup.notify_all();
+
+            for (auto&& worker : m_workers)
+                worker.thread.join();
+        }
+
+        void dispatch(EventRecord record)
+        {
+            auto connId = record.connId();
+            auto isLast = record.event() == Event::Disconnect;
+
+            auto&& strand = m_strands[connId];
+            if (!strand)
+                strand = std::make_shared<Strand>();
+
+            ++m_pendingEvents;
+            bool isReady;
+            {
+                std::lock_guard<std::mutex> lock{strand->mutex};
+                strand->events.push_back(std::move(record));
+                isReady = !strand->isScheduled;
+                strand->isScheduled = true;
+            }
+
+            // the queue lives on in the deques until its events are handled
+            auto ready = isReady ? strand : nullptr;
+            if (isLast)
+                m_strands.erase(connId);
+
+            // a connection starts on the same thread every time, while nothing is stolen
+            if (ready)
+                schedule(std::move(ready), static_cast<std::size_t>(connId % m_workers.size()));
+        }
+
+        // dispatches everything the server has for now, returns the number of events
+        template<typename Server>
+        std::size_t dispatchFrom(Server& server)
+        {
+            std::size_t n = 0;
+            EventRecord record;
+            while (server.poll(record))
+            {
+                dispatch(std::move(record));
+                ++n;
+            }
+
+            return n;
+        }
+
+        // blocks until every dispatched event is handled
+        void waitIdle()
+        {
+            std::unique_lock<std::mutex> lock{m_idleMutex};
+            m_idle.wait(lock, [this] { return m_pendingEvents == 0; });
+        }
+
+    private:
+        struct Strand
+        {
+            std::mutex mutex;
+            details::RingQueue<EventRecord> events;
+            bool isScheduled{false}; // in a deque or running
+        };
+
+        using strand_ptr = std::shared_ptr<Strand>;
+
+        struct Worker
+        {
+            std::mutex mutex;
+            std::deque<strand_ptr> ready;
+            std::thread thread;
+        };
+
+        void schedule(strand_ptr strand, std::size_t workerIndex)
+        {
+            auto&& worker = m_workers[workerIndex];
+            {
+                std::lock_guard<std::mutex> lock{worker.mutex};
+                worker.ready.push_back(std::move(strand));
+            }
+
+            {
+                std::lock_guard<std::mutex> lock{m_idleMutex};
+                ++m_readyCount;
+            }
+            m_wakeup.notify_one();
+        }
+
+        // the front of our own deque, else the back of another one
+        strand_ptr take(std::size_t workerIndex)
+        {
+            for (std::size_t i = 0; i != m_workers.size(); ++i)
+            {
+                auto&& worker = m_workers[(workerIndex + i) % m_workers.size()];
+                std::lock_guard<std::mutex> lock{worker.mutex};
+                if (worker.ready.empty())
+                    continue;
+
+                strand_ptr strand;
+                if (i == 0)
+                {
+                    strand = std::move(worker.ready.front());
+                    worker.ready.pop_front();
+                }
+                else
+                {
+                    strand = std::move(worker.ready.back());
+                    worker.ready.pop_back();
+                }
+
+                return strand;
+            }
+
+            return nullptr;
+        }
+
+        void run(std::size_t workerIndex)
+        {
+            for (;;)
+            {
+                {
+                    std::unique_lock<std::mutex> lock{m_idleMutex};
+                    m_wakeup.wait(lock, [this] { return m_readyCount != 0 || m_isStopping; });
+                    if (m_readyCount == 0)
+                        return; // stopping
+
+                    --m_readyCount;
+                }
+
+                // a ready count is a queue in some deque, only we can take it now
+                strand_ptr strand;
+                while (!(strand = take(workerIndex)))
+                    std::this_thread::yield();
+
+                handleOne(std::move(strand), workerIndex);
+            }
+        }
+
+        // one event per turn, then the queue goes to the back of our deque: a busy connection
+        // doesn't hold up the others
+        void handleOne(strand_ptr strand, std::size_t workerIndex)
+        {
+            EventRecord record;
+            {
+                std::lock_guard<std::mutex> lock{strand->mutex};
+                record = std::move(strand->events.front());
+                strand->events.pop_front();
+            }
+
+            m_handler(record);
+
+            bool isReady;
+            {
+                std::lock_guard<std::mutex> lock{strand->mutex};
+                isReady = !strand->events.empty();
+                strand->isScheduled = isReady;
+            }
+
+            if (isReady)
+                schedule(std::move(strand), workerIndex);
+
+            if (--m_pendingEvents == 0)
+            {
+                std::lock_guard<std::mutex> lock{m_idleMutex};
+                m_idle.notify_all();
+            }
+        }
+
+        handler_t m_handler;
+        std::unordered_map<ConnectionId, strand_ptr> m_strands; // the dispatching thread only
+        std::vector<Worker> m_workers;
+
+        std::mutex m_idleMutex;
+        std::condition_variable m_wakeup; // a queue is ready or the pool stops
+        std::condition_variable m_idle;   // all events are handled
+        std::size_t m_readyCount{0};      // the queues in the deques, guarded by m_idleMutex
+        bool m_isStopping{false};
+        std::atomic<std::size_t> m_pendingEvents{0};
+    };
+}
@@ -3,23 +3,35 @@
 
 #pragma once
 
-#include <list>
 #include <memory>
 #include <mutex>
 #include <string>
-#include <tuple>
 
 #include "server_fwd.hpp"
+#include "EventRecord.hpp"
+#include "ServerOptions.hpp"
+#include "ServerTraits.hpp"
 
 namespace websocket
 {
-    class Server
+    // see ServerTraits.hpp, Server is the default configuration
+    template<typename Traits>
+    class BasicServer
     {
     public:
-        Server();
-        ~Server();
+        BasicServer();
+        ~BasicServer();
 
-        void start(const std::string& ip, unsigned short port, std::ostream& log);
+        void start(const std::string& ip, unsigned short port, std::ostream& log, const ServerOptions& options = {});
+
+        // Pre-fork mode (POSIX only), call instead of start() before any threads are created.
+        // Forks `workerCount` workers, each accepts on its own SO_REUSEPORT socket and runs its
+        // own I/O loop. Returns the worker number in a worker, with the server started there.
+        // In the calling process it restarts the workers that crash and returns -1 once every
+        // worker has exited with 0 or was terminated by SIGTERM/SIGINT.
+        // Connection ids carry the worker number, send and drop for a connection of another
+        // worker are passed to it over a local socket.
+        int startWorkers(const std::string& ip, unsigned short port, std::ostream& log, unsigned workerCount, const ServerOptions& options = {});
         void stop();
 
         void sendText(ConnectionId connId, std::string message);
@@ -27,14 +39,51 @@ namespace websocket
         
         bool poll(Event& event, ConnectionId& connId, std::string& message);
 
+        // the same with the text/binary flag and the receive time
+        bool poll(EventRecord& record);
+
         void drop(ConnectionId connId);
 
+        // Flow control: after pauseReading() the read already waiting for the next frame still
+        // delivers it, then the connection is not read and TCP holds the client back.
+        // The pause is not kept across a handoff.
+        void pauseReading(ConnectionId connId);
+        void resumeReading(ConnectionId connId);
+
+        // Outbound shaping: the connection is sent to at ServerOptions::sendRates[sendClass].
+        // Frames wait in the send queue for the tokens, so the send queue limits still apply.
+        void setSendClass(ConnectionId connId, unsigned sendClass);
+
+        // Broadcasts go to the subscribed connections of this server (of this worker in the
+        // pre-fork mode). With ServerOptions::journalPath they are also appended to the journal,
+        // messages are numbered from 0, and a subscriber first gets the journal from `fromOffset`.
+        static const std::uint64_t NoReplay = ~std::uint64_t(0);
+        void broadcastText(std::string message);
+        void broadcastBinary(std::string message);
+        void subscribe(ConnectionId connId, std::uint64_t fromOffset = NoReplay);
+
+        // Zero-downtime restart (POSIX only). The old process calls handoff(), which waits
+        // for the new process on a unix socket at `socketPath` and passes it the listening
+        // socket and, with `withConnections`, the established connections with their
+        // unread and unsent bytes; the old server is stopped then. Without connections
+        // the old server only stops accepting and keeps serving its connections.
+        // The new process calls resume() instead of start(), the resumed connections keep
+        // their ids and are reported as Event::NewConnection.
+        void handoff(const std::string& socketPath, bool withConnections = true);
+        void resume(const std::string& socketPath, std::ostream& log, const ServerOptions& options = {});
+
     private:
+        void pushEvent(EventRecord record);
+
         class Impl;
         std::unique_ptr<Impl> m_impl;
 
-        using tuple_t = std::tuple<Event, ConnectionId, std::string>;
-        std::list<tuple_t> m_queue;
+        typename Traits::template EventQueue<EventRecord, typename Traits::template Allocator<EventRecord>> m_queue;
         std::mutex m_mutex;
     };
+
+    using Server = BasicServer<DefaultServerTraits>;
+
+    // instantiated in websocket-cpp.cpp
+    extern template class BasicServer<DefaultServerTraits>;
 }
\ No newline at end of file
@@ -0,0 +1,137 @@
+// Websocket Server implementation
+// Belongs to the public domain
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace websocket
+{
+    struct RateLimit
+    {
+        double rate{0};  // tokens per second, 0 - unlimited
+        double burst{0}; // bucket size, 0 - one second worth of tokens
+    };
+
+    // how the acceptor turns away connections over the limits
+    enum class RejectAction
+    {
+        ServiceUnavailable, // "503 Service Unavailable" reply, the request is not read
+        Reset,              // TCP reset, nothing is sent
+    };
+
+    // what happens to a connection over the inbound rate limits
+    enum class RateLimitAction
+    {
+        Throttle, // the connection isn't read until the tokens refill
+        Close,    // close with 1008 Policy Violation
+    };
+
+    struct ServerOptions
+    {
+        // expect a PROXY protocol v1/v2 header in front of each handshake request,
+        // connections without it are rejected
+        bool proxyProtocol{false};
+
+        // HTTP/2 clients with prior knowledge (h2c) are accepted next to HTTP/1.1, every
+        // extended CONNECT stream (RFC 8441) is a WebSocket connection of its own
+        bool http2{false};
+
+        // plain GET requests for these paths are answered before the handshake and the connection
+        // is closed: `healthPath` with "200 OK", `metricsPath` with the server counters in the
+        // Prometheus text format; empty - none. They skip the admission limits and the overload
+        // shedding, so with either path set the request line is read before those checks.
+        std::string healthPath;
+        std::string metricsPath;
+
+        // admission control, all limits are checked before the handshake; 0 - unlimited
+        std::size_t maxConnections{0};
+        RateLimit acceptRate;
+        std::size_t maxConnectionsPerIp{0};
+        RateLimit acceptRatePerIp;
+        RejectAction rejectAction{RejectAction::ServiceUnavailable};
+
+        // per-IP state is kept in a fixed size table, idle addresses are forgotten after the timeout;
+        // a new address is rejected while its neighbourhood in the table is all live addresses
+        std::size_t ipTableSize{4096};
+        std::chrono::seconds ipIdleTimeout{60};
+
+        // overload shedding, new connections get "503 Service Unavailable" with Retry-After
+        // while the bytes queued for sending or the I/O loop lag are over the limit; 0 - unlimited
+        std::size_t maxQueuedBytes{0};
+        std::chrono::milliseconds maxLoopLag{0};
+        std::chrono::seconds retryAfter{5};
+
+        // keepalive, the server pings every connection and drops the ones that miss
+        // `maxMissedPongs` pongs in a row; 0 - no pings
+        std::chrono::milliseconds pingInterval{0};
+        unsigned maxMissedPongs{2};
+
+        // producer backpressure: once the send queue of a connection reaches `sendHighWaterMark`
+        // bytes, Event::Drained is reported when it is down to `sendLowWaterMark`; 0 - no events
+        std::size_t sendHighWaterMark{0};
+        std::size_t sendLowWaterMark{0};
+
+        // inbound rate limits of every connection, token buckets checked for each client frame;
+        // unlimited by default
+        RateLimit messageRate;
+        RateLimit byteRate;
+        RateLimitAction rateLimitAction{RateLimitAction::Throttle};
+
+        // outbound shaping: the send rate of each connection class, a connection is in class 0
+        // until Server::setSendClass(); a class without an entry is unlimited
+        std::vector<RateLimit> sendRates;
+
+        // a connection parses at most `frameBudget` buffered frames at a time, then the other
+        // connections of the I/O thread go first; 0 - unlimited
+        std::size_t frameBudget{16};
+
+        // how long a closing connection waits for the client Close and FIN
+        std::chrono::milliseconds closeTimeout{2000};
+
+        // session resumption: every connection gets a token, the last `sessionReplaySize` messages
+        // sent to it are kept, and a client that reconnects within `sessionTimeout` with its token
+        // gets the messages it missed and keeps its connection id; 0 - no sessions
+        std::size_t sessionReplaySize{0};
+        std::chrono::seconds sessionTimeout{30};
+
+        // journal of the broadcasts, kept in memory-mapped segment files `<journalPath>.NNNNNN.log`
+        // of `journalSegmentSize` bytes; subscribers can replay it from any message; empty - none.
+        // In the pre-fork mode every worker keeps its own journal, `<journalPath>-<worker>.NNNNNN.log`.
+        // There is no retention: the segments stay on disk and mapped while the server runs
+        std::string journalPath;
+        std::size_t journalSegmentSize{64 << 20};
+
+        // shared memory channel for an application in another process (see SharedMemoryClient):
+        // events go to a ring in the POSIX shared memory object `sharedMemory` ("/name") instead
+        // of poll(), send and drop commands come from the other ring, polled every interval
+        // while it is empty; each ring has `sharedMemoryRingSize` bytes, a power of two.
+        // In the pre-fork mode every worker creates its own object, "/name-0", "/name-1"...
+        // While the application is behind, the events wait in memory up to `sharedMemoryMaxOverflow`
+        // bytes, after that the connections whose messages don't fit are closed. A message larger
+        // than the ring is rejected with 1009 when it arrives.
+        std::string sharedMemory;
+        std::size_t sharedMemoryRingSize{1 << 22};
+        std::size_t sharedMemoryMaxOverflow{16 << 20};
+        std::chrono::microseconds sharedMemoryPollInterval{100};
+
+        // routing of JSON text messages: the string value of the top-level `routeKey` member is
+        // looked up in `routeValues` and EventRecord::route() is 1 + its index, 0 - no match;
+        // the rest of the document isn't parsed. Up to 255 values; empty key - no routing
+        std::string routeKey;
+        std::vector<std::string> routeValues;
+
+        // send, drop, broadcast, subscribe and the other commands of this process go from the calling
+        // thread to the I/O thread through a lock-free ring of this many slots; 0 - a posted
+        // handler for each command
+        std::size_t submitRingSize{1024};
+
+        // Linux only: SO_TIMESTAMPING software receive timestamps, EventRecord::receivedAt()
+        // of a message is the time the data read with its last byte arrived instead of the time
+        // it was parsed
+        bool receiveTimestamps{false};
+    };
+}
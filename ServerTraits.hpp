@@ -0,0 +1,57 @@
+// Websocket Server implementation
+// Belongs to the public domain
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#include "details/RingQueue.hpp"
+
+namespace websocket
+{
+    // the messages go to poll() as they are
+    struct NoDecoder
+    {
+        using Type = void;
+    };
+
+    // Compile-time configuration of BasicServer. A deployment derives from DefaultServerTraits,
+    // overrides what it needs and instantiates `template class BasicServer<MyTraits>;` in one
+    // translation unit that includes server_src.hpp. The features that are off cost nothing
+    // on the receive path, all the checks are on constants.
+    struct DefaultServerTraits
+    {
+        // longest client frame payload; up to 125 takes the 7-bit length only, longer ones
+        // enable the 16-bit and 64-bit extended lengths
+        static const std::size_t MaxPayloadLen = 125;
+
+        // the receive buffer inside each connection, holds a complete client frame
+        static const std::size_t BufferSize = 1 + 1 + 4 + MaxPayloadLen;
+
+        // close with 1007 on a text message that isn't valid UTF-8
+        static const bool ValidateUtf8 = false;
+
+        // accept fragmented client messages, up to MaxMessageLen bytes
+        static const bool Fragmentation = false;
+        static const std::size_t MaxMessageLen = MaxPayloadLen;
+
+        // Allocator of the server containers: the connections with their table and send queues,
+        // and the poll() queue. It is default constructed where it is needed, so it has to be
+        // stateless; one that picks an arena of the calling thread keeps the memory of the
+        // connections with the I/O thread. Message strings use the global heap.
+        template<typename T>
+        using Allocator = std::allocator<T>;
+
+        // the queue of events waiting for poll(): push_back, front, pop_front, empty
+        template<typename T, typename Alloc>
+        using EventQueue = details::RingQueue<T, Alloc>;
+
+        // Decode stage of the client messages, it runs on the I/O thread and the event carries
+        // the object instead of the text (EventRecord::decoded<Type>()). A decoder has a `Type`
+        // and `static bool decode(std::string& message, bool isBinary, Type& object)`, false
+        // closes the connection with 1007; it may move from `message`.
+        using Decoder = NoDecoder;
+    };
+}
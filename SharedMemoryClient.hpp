@@ -0,0 +1,67 @@
+// Websocket Server implementation
+// Belongs to the public domain
+
+#pragma once
+
+#include <string>
+
+#include "server_fwd.hpp"
+#include "details/shm_ring.hpp"
+
+namespace websocket
+{
+    // The application side of ServerOptions::sharedMemory, for an application in another process.
+    // Opens the segment created by the server, so the server has to be started first.
+    // Not thread safe: one thread polls the events and one (maybe the same) sends the commands.
+    class SharedMemoryClient
+    {
+    public:
+        explicit SharedMemoryClient(const std::string& name)
+            : m_segment{name, false}
+            , m_events{m_segment.eventRing()}
+            , m_commands{m_segment.commandRing()}
+        {}
+
+        // `data` points into the shared ring and stays valid until the next poll()
+        bool poll(Event& event, ConnectionId& connId, const char*& data, std::size_t& size)
+        {
+            if (m_hasEvent)
+            {
+                m_events.pop(m_event);
+                m_hasEvent = false;
+            }
+
+            if (!m_events.front(m_event, data))
+                return false;
+
+            m_hasEvent = true;
+            event = details::recordEvent(m_event.type);
+            connId = static_cast<ConnectionId>(m_event.connId);
+            size = m_event.size;
+            return true;
+        }
+
+        // false if the command ring is full, the server hasn't caught up yet
+        bool sendText(ConnectionId connId, const std::string& message)
+        {
+            return m_commands.push(details::RecordType::SendText, connId, message.data(), message.size());
+        }
+
+        bool sendBinary(ConnectionId connId, const std::string& message)
+        {
+            return m_commands.push(details::RecordType::SendBinary, connId, message.data(), message.size());
+        }
+
+        bool drop(ConnectionId connId)
+        {
+            return m_commands.push(details::RecordType::Drop, connId, "", 0);
+        }
+
+    private:
+        details::SharedSegment m_segment;
+        details::SharedRing m_events;
+        details::SharedRing m_commands;
+        details::RecordHeader m_event;
+        bool m_hasEvent{false};
+    };
+}
@@ -12,13 +12,46 @@ namespace websocket { namespace details
     class Acceptor
     {
     public:
-        Acceptor(boost::asio::io_service& ioService, boost::asio::ip::tcp::endpoint endpoint, Callback& callback)
-            : m_acceptor{ioService, endpoint}
+        // with `reusePort` every worker process binds its own socket to the same port
+        Acceptor(boost::asio::io_service& ioService, boost::asio::ip::tcp::endpoint endpoint, Callback& callback, bool reusePort = false)
+            : m_acceptor{ioService}
             , m_callback{callback}
         {
+            m_acceptor.open(endpoint.protocol());
+            m_acceptor.set_option(boost::asio::socket_base::reuse_address(true));
+#if defined SO_REUSEPORT
+            if (reusePort)
+                m_acceptor.set_option(boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true));
+#else
+            if (reusePort)
+                throw std::runtime_error("SO_REUSEPORT is not supported");
+#endif
+            m_acceptor.bind(endpoint);
+            m_acceptor.listen();
+
             boost::asio::spawn(ioService, [this](boost::asio::yield_context yield) { acceptLoop(yield); });
         }
 
+        // listening socket handed over by the previous process
+        Acceptor(boost::asio::io_service& ioService, boost::asio::ip::tcp::endpoint endpoint, int nativeHandle, Callback& callback)
+            : m_acceptor{ioService, endpoint.protocol(), nativeHandle}
+            , m_callback{callback}
+        {
+            boost::asio::spawn(ioService, [this](boost::asio::yield_context yield) { acceptLoop(yield); });
+        }
+
+        // stops accepting but keeps the socket open, the accept loop exits after the handshake in progress
+        void pause()
+        {
+            m_isStopped = true;
+            boost::system::error_code ingnoreError;
+            m_acceptor.cancel(ingnoreError);
+        }
+
+        bool isRunning() const { return m_isRunning; }
+        int nativeHandle() { return m_acceptor.native_handle(); }
+        boost::asio::ip::tcp::endpoint localEndpoint() const { return m_acceptor.local_endpoint(); }
+
         void stop()
         {
             m_isStopped = true;
@@ -29,6 +62,7 @@ namespace websocket { namespace details
     private:
         void acceptLoop(boost::asio::yield_context& yield)
         {
+            m_isRunning = true;
             for (;;)
             {
                 boost::asio::ip::tcp::socket clientSocket{m_acceptor.get_io_service()};
@@ -36,7 +70,10 @@ namespace websocket { namespace details
                 m_acceptor.async_accept(clientSocket, yield[ec]);
 
                 if (m_isStopped)
+                {
+                    m_isRunning = false;
                     return;
+                }
 
                 if (!ec)
                 {
@@ -50,6 +87,7 @@ namespace websocket { namespace details
         }
 
         bool m_isStopped{false};
+        bool m_isRunning{false};
         boost::asio::ip::tcp::acceptor m_acceptor;
         Callback& m_callback;
     };
@@ -0,0 +1,177 @@
+// Websocket Server implementation
+// Belongs to the public domain
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <boost/asio/ip/address.hpp>
+
+#include "ServerOptions.hpp"
+#include "TokenBucket.hpp"
+
+namespace websocket { namespace details
+{
+    // Decides whether a new connection may proceed to the handshake.
+    // Per-IP state lives in an open-addressed table with a short probe sequence;
+    // idle entries are reused in place, so the table never rehashes and never allocates.
+    class AdmissionControl
+    {
+    public:
+        using clock_t = TokenBucket::clock_t;
+
+        explicit AdmissionControl(const ServerOptions& options)
+            : m_options(options)
+            , m_table(roundUpPow2(options.ipTableSize))
+            , m_mask(m_table.size() - 1)
+        {
+            m_acceptBucket.reset(m_options.acceptRate, clock_t::now());
+        }
+
+        // global limits, checked before anything is read from the socket
+        bool admitGlobal(std::size_t activeConnections, clock_t::time_point now)
+        {
+            if (m_options.maxConnections && activeConnections >= m_options.maxConnections)
+                return false;
+
+            return m_acceptBucket.tryTake(m_options.acceptRate, now);
+        }
+
+        // per-IP limits, an admitted address has to be released when its connection ends
+        bool admit(const boost::asio::ip::address& address, clock_t::time_point now)
+        {
+            if (!isPerIpEnabled())
+                return true;
+
+            // the neighbourhood is full of live addresses: failing open would let rotating source
+            // addresses switch the per-IP limits off for everyone
+            auto entry = lookup(makeKey(address), now);
+            if (!entry)
+                return false;
+
+            if (m_options.maxConnectionsPerIp && entry->active >= m_options.maxConnectionsPerIp)
+                return false;
+
+            if (!entry->bucket.tryTake(m_options.acceptRatePerIp, now))
+                return false;
+
+            ++entry->active;
+            return true;
+        }
+
+        void release(const boost::asio::ip::address& address)
+        {
+            if (!isPerIpEnabled())
+                return;
+
+            auto key = makeKey(address);
+            auto index = hash(key);
+            for (std::size_t i = 0; i != MaxProbes; ++i)
+            {
+                auto& entry = m_table[(index + i) & m_mask];
+                if (entry.used && entry.key == key)
+                {
+                    if (entry.active > 0)
+                        --entry.active;
+
+                    return;
+                }
+            }
+        }
+
+    private:
+        static const std::size_t MaxProbes = 8;
+
+        struct Key
+        {
+            std::uint64_t hi;
+            std::uint64_t lo;
+
+            bool operator==(const Key& other) const { return hi == other.hi && lo == other.lo; }
+        };
+
+        struct Entry
+        {
+            Key key;
+            TokenBucket bucket; // its last refill time tells when the address was seen
+            std::uint32_t active;
+            bool used;
+        };
+
+        static std::size_t roundUpPow2(std::size_t n)
+        {
+            std::size_t size = MaxProbes;
+            while (size < n)
+                size <<= 1;
+
+            return size;
+        }
+
+        static Key makeKey(const boost::asio::ip::address& address)
+        {
+            // IPv4 goes as IPv4-mapped IPv6
+            auto bytes = address.is_v4()
+                ? boost::asio::ip::address_v6::v4_mapped(address.to_v4()).to_bytes()
+                : address.to_v6().to_bytes();
+
+            Key key;
+            std::memcpy(&key.hi, bytes.data(), 8);
+            std::memcpy(&key.lo, bytes.data() + 8, 8);
+            return key;
+        }
+
+        std::size_t hash(const Key& key) const
+        {
+            auto h = (key.hi ^ (key.lo * 0x9E3779B97F4A7C15ull)) * 0xBF58476D1CE4E5B9ull;
+            return static_cast<std::size_t>(h ^ (h >> 31));
+        }
+
+        bool isPerIpEnabled() const
+        {
+            return m_options.maxConnectionsPerIp || m_options.acceptRatePerIp.rate > 0;
+        }
+
+        bool isIdle(const Entry& entry, clock_t::time_point now) const
+        {
+            return !entry.used || (entry.active == 0 && now - entry.bucket.lastRefill() > m_options.ipIdleTimeout);
+        }
+
+        Entry* lookup(const Key& key, clock_t::time_point now)
+        {
+            auto index = hash(key);
+            Entry* vacant = nullptr;
+            Entry* oldest = nullptr;
+
+            for (std::size_t i = 0; i != MaxProbes; ++i)
+            {
+                auto& entry = m_table[(index + i) & m_mask];
+                if (entry.used && entry.key == key)
+                    return &entry;
+
+                if (!vacant && isIdle(entry, now))
+                    vacant = &entry;
+
+                if (entry.active == 0 && (!oldest || entry.bucket.lastRefill() < oldest->bucket.lastRefill()))
+                    oldest = &entry;
+            }
+
+            // under churn evict the least recently seen address without connections
+            auto entry = vacant ? vacant : oldest;
+            if (entry)
+            {
+                entry->key = key;
+                entry->active = 0;
+                entry->used = true;
+                entry->bucket.reset(m_options.acceptRatePerIp, now);
+            }
+
+            return entry;
+        }
+
+        const ServerOptions& m_options;
+        TokenBucket m_acceptBucket;
+        std::vector<Entry> m_table;
+        std::size_t m_mask;
+    };
+}}
@@ -3,6 +3,10 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
 #include <deque>
 #include <memory>
 #include <string>
@@ -11,26 +15,49 @@
 
 #include "server_fwd.hpp"
 #include "frames.hpp"
+#include "handoff.hpp"
+#include "rx_timestamps.hpp"
+#include "TokenBucket.hpp"
+#include "utf8.hpp"
 
 namespace websocket { namespace details
 {
-    template<typename Callback>
+    template<typename Callback, typename Traits>
     class Connection
     {
     public:
-        Connection(ConnectionId id, boost::asio::ip::tcp::socket socket, Callback& callback)
+        Connection(ConnectionId id, boost::asio::ip::tcp::socket socket, const boost::asio::ip::tcp::endpoint& remoteEndpoint, Callback& callback)
             : m_id{id}
+            , m_remoteEndpoint{remoteEndpoint}
             , m_socket{std::move(socket)}
             , m_callback(callback)
         {
+            initRxTimestamps();
+            beginRecvFrame();
+        }
+
+        // connection handed over by the previous process
+        Connection(boost::asio::ip::tcp::socket socket, const HandoffConnection& state, Callback& callback)
+            : m_id{state.id}
+            , m_remoteEndpoint{state.remoteEndpoint}
+            , m_socket{std::move(socket)}
+            , m_callback(callback)
+        {
+            m_receiver.restore(state.received);
+            if (!state.pending.empty())
+                enqueue(ServerFrame::raw(state.pending));
+
+            initRxTimestamps();
             beginRecvFrame();
         }
 
         ~Connection()
         {
             assert(m_isClosed);
+            m_callback.onDequeued(m_queuedBytes);
         }
 
+        // abortive close, the socket is closed right away
         void close()
         {
             if (m_isClosed)
@@ -43,44 +70,244 @@ namespace websocket { namespace details
             m_socket.close(ignoreError);
         }
 
-        void sendFrame(Opcode opcode, std::string data)
+        // close handshake started by the server, the socket is closed after the client replies
+        // or the linger timer expires
+        void startClose(std::uint16_t code, const std::string& reason = {})
         {
-            m_sendQueue.emplace_back(opcode, std::move(data));
-            if (m_sendQueue.size() == 1)
+            if (isOpen())
+                enterClosing(makeClosePayload(code, reason));
+        }
+
+        void startClose(CloseCode code, const std::string& reason = {})
+        {
+            startClose(static_cast<std::uint16_t>(code), reason);
+        }
+
+        bool isOpen() const { return !m_isClosed && m_closeState == CloseState::Open; }
+
+        // application flow control: no new reads after the current frame, so the socket buffers
+        // fill up and TCP pushes back on the client
+        void pauseReading() { m_isReadPaused = true; }
+
+        void resumeReading()
+        {
+            m_isReadPaused = false;
+            if (m_isReadSuspended && !m_isReadThrottled && !m_isClosed && !m_isParked)
+            {
+                m_isReadSuspended = false;
+                beginRecvFrame();
+            }
+        }
+
+        // inbound rate limit: the tokens for the waiting frame should be there now
+        void endReadThrottle()
+        {
+            m_isReadThrottled = false;
+            if (!m_isReadPaused)
+                resumeReading();
+        }
+
+        // outbound shaping: the tokens for the front frame should be there now
+        void endSendThrottle()
+        {
+            if (m_isSendThrottled && !m_isSending && !m_sendQueue.empty() && !m_isParked)
                 sendNext();
         }
 
+        // handoff: stop reading and writing, the handlers of the cancelled operations
+        // record how far they got
+        void park()
+        {
+            m_isParked = true;
+            boost::system::error_code ignoreError;
+            m_socket.cancel(ignoreError);
+        }
+
+        bool isParked() const { return m_isParked && !m_isReading && !m_isSending; }
+
+        HandoffConnection exportState()
+        {
+            HandoffConnection state;
+            state.id = m_id;
+            state.fd = m_socket.native_handle();
+            state.remoteEndpoint = m_remoteEndpoint;
+            state.received = m_receiver.bufferedBytes();
+
+            for (auto&& frame : m_sendQueue)
+            {
+                state.pending.append(reinterpret_cast<const char*>(frame.m_header), frame.m_headerLen);
+                state.pending.append(frame.data(), frame.dataSize());
+            }
+
+            state.pending.erase(0, m_frontBytesSent);
+            return state;
+        }
+
+        // the socket now belongs to another process, close our descriptor without a shutdown
+        void detach()
+        {
+            m_isClosed = true;
+            boost::system::error_code ignoreError;
+            m_socket.close(ignoreError);
+        }
+
+        // no frames are sent after Close
+        void sendFrame(Opcode opcode, std::string data)
+        {
+            if (isOpen())
+                enqueue(ServerFrame{opcode, std::move(data)});
+        }
+
+        // an already framed message, written without a copy
+        void sendShared(std::shared_ptr<const void> owner, const char* bytes, std::size_t size)
+        {
+            if (isOpen())
+                enqueue(ServerFrame::shared(std::move(owner), bytes, size));
+        }
+
     private:
+        enum class CloseState
+        {
+            Open,
+            CloseSent,  // our Close is queued, waiting for it to be written and for the client Close
+            Lingering,  // both Close frames are done and our side is shut down, waiting for the client FIN
+        };
+
+        void enqueue(ServerFrame frame)
+        {
+            m_sendQueue.push_back(std::move(frame));
+
+            auto frameSize = m_sendQueue.back().size();
+            m_queuedBytes += frameSize;
+            m_callback.onQueued(frameSize);
+            if (m_callback.isOverHighWater(m_queuedBytes))
+                m_isOverHighWater = true;
+
+            if (m_sendQueue.size() == 1 && !m_isParked)
+                sendNext();
+        }
+
+        void enterClosing(std::string closePayload)
+        {
+            m_closeState = CloseState::CloseSent;
+            releaseSendQueue();
+            enqueue(ServerFrame{Opcode::Close, std::move(closePayload)});
+            m_callback.onClosing(*this);
+            m_isReadThrottled = false;
+            resumeReading(); // for the client Close
+        }
+
+        // a closing connection keeps only the frame being written, so lingering costs next to nothing
+        void releaseSendQueue()
+        {
+            std::size_t keep = m_isSending ? 1 : 0;
+            while (m_sendQueue.size() > keep)
+            {
+                auto frameSize = m_sendQueue.back().size();
+                m_queuedBytes -= frameSize;
+                m_callback.onDequeued(frameSize);
+                m_sendQueue.pop_back();
+            }
+
+            if (m_sendQueue.empty())
+                decltype(m_sendQueue){}.swap(m_sendQueue);
+        }
+
+        void onCloseFrame(const std::string& payload)
+        {
+            m_isCloseReceived = true;
+
+            if (m_closeState == CloseState::Open)
+            {
+                // echo the status code, the reason is not repeated
+                std::uint16_t code;
+                if (parseClosePayload(payload, code))
+                    enterClosing(makeClosePayload(code));
+                else
+                    enterClosing(makeClosePayload(CloseCode::ProtocolError));
+            }
+            else if (m_isCloseFlushed)
+            {
+                shutdownSend();
+            }
+        }
+
+        void onCloseFlushed()
+        {
+            m_isCloseFlushed = true;
+            if (m_isCloseReceived)
+                shutdownSend();
+        }
+
+        // half-close: the client gets FIN after our Close, and we still read until its FIN,
+        // so neither side sees a reset with unread data
+        void shutdownSend()
+        {
+            m_closeState = CloseState::Lingering;
+            boost::system::error_code ignoreError;
+            m_socket.shutdown(boost::asio::socket_base::shutdown_send, ignoreError);
+        }
+
         void sendNext()
         {
-            m_isSending = true;
-            
             auto&& frame = m_sendQueue.front();
+
+            // the Close frame of a closing connection isn't held back
+            m_isSendThrottled = isOpen() && !m_callback.admitSend(*this, frame.size());
+            if (m_isSendThrottled)
+                return;
+
+            m_isSending = true;
             std::array<boost::asio::const_buffer, 2> buffers
             {
                 boost::asio::buffer(frame.m_header, frame.m_headerLen),
-                boost::asio::buffer(frame.m_data)
+                boost::asio::buffer(frame.data(), frame.dataSize())
             };
 
             boost::asio::async_write(m_socket, buffers,
-                [this](const boost::system::error_code& ec, std::size_t)
+                [this](const boost::system::error_code& ec, std::size_t bytesTransferred)
                 {
-                    onSendComplete(ec);
+                    onSendComplete(ec, bytesTransferred);
                 });
         }
 
-        void onSendComplete(const boost::system::error_code& ec)
+        void onSendComplete(const boost::system::error_code& ec, std::size_t bytesTransferred)
         {
             m_isSending = false;
+            if (m_isParked && ec == boost::asio::error::operation_aborted)
+            {
+                m_frontBytesSent = bytesTransferred;
+                return;
+            }
+
             if (ec)
             {
                 m_callback.log("#", m_id, ": send error: ", ec);
             }
             else if (!m_isClosed)
             {
+                auto&& frame = m_sendQueue.front();
+                auto isClose = frame.opcode() == Opcode::Close;
+                m_queuedBytes -= frame.size();
+                m_callback.onDequeued(frame.size());
+
                 m_sendQueue.pop_front();
-                if (!m_sendQueue.empty())
+                if (m_isOverHighWater && m_callback.isDrained(m_queuedBytes))
+                {
+                    m_isOverHighWater = false;
+                    if (isOpen())
+                        m_callback.onDrained(*this);
+                }
+
+                if (isClose)
+                {
+                    releaseSendQueue();
+                    onCloseFlushed();
+                }
+                else if (!m_sendQueue.empty() && !m_isParked)
+                {
                     sendNext();
+                }
 
                 return;
             }
@@ -88,91 +315,350 @@ namespace websocket { namespace details
             m_callback.drop(*this);
         }
 
+        void initRxTimestamps()
+        {
+#if defined __linux__
+            if (m_callback.hasRxTimestamps())
+            {
+                m_hasRxTimestamps = enableRxTimestamps(m_socket.native_handle());
+                if (!m_hasRxTimestamps)
+                    m_callback.log("#", m_id, ": SO_TIMESTAMPING: ", std::strerror(errno));
+            }
+#endif
+        }
+
         void beginRecvFrame()
         {
+            m_isReading = true;
+#if defined __linux__
+            if (m_hasRxTimestamps)
+                return m_receiver.needReceiveMore(0) == 0 ? yield() : waitReadable();
+#endif
+            // reads as much as fits, at least one complete frame
             auto&& isComplete = [this](const boost::system::error_code& ec, std::size_t bytesTransferred)
             {
-                return ec ? 0 : m_receiver.needReceiveMore(bytesTransferred);
+                return ec || m_receiver.needReceiveMore(bytesTransferred) == 0 ? 0 : m_receiver.getBufferTailSize() - bytesTransferred;
             };
 
             auto&& buffer = boost::asio::buffer(m_receiver.getBufferTail(), m_receiver.getBufferTailSize());
 
-            m_isReading = true;
             boost::asio::async_read(m_socket, buffer, isComplete, [this](const boost::system::error_code& ec, std::size_t bytesTransferred)
             {
                 onRecvComplete(ec, bytesTransferred);
             });
         }
 
-        void onRecvComplete(const boost::system::error_code& ec, std::size_t bytesTransferred)
+        // the rest of the buffered frames are parsed after the handlers that are already queued
+        void yield()
+        {
+            m_socket.get_io_service().post([this] { onRecvComplete({}, 0); });
+        }
+
+#if defined __linux__
+        void waitReadable()
+        {
+            m_socket.async_read_some(boost::asio::null_buffers(), [this](const boost::system::error_code& ec, std::size_t)
+            {
+                onRecvComplete(ec, 0);
+            });
+        }
+
+        // with the receive timestamps the frames are read here with recvmsg, as much as the buffer
+        // takes like the async read; the frames of one read share the timestamp of its newest data.
+        // false and no error - nothing to read
+        bool recvTimestamped(boost::system::error_code& ec)
+        {
+            for (;;)
+            {
+                auto n = details::recvTimestamped(m_socket.native_handle(), m_receiver.getBufferTail(), m_receiver.getBufferTailSize(), m_receivedAt);
+                if (n > 0)
+                {
+                    m_receiver.addBytes(n);
+                    return true;
+                }
+
+                if (n == 0)
+                    ec = boost::asio::error::eof;
+                else if (errno == EINTR)
+                    continue;
+                else if (errno != EAGAIN && errno != EWOULDBLOCK)
+                    ec.assign(errno, boost::system::system_category());
+
+                return false;
+            }
+        }
+#endif
+
+        std::chrono::steady_clock::time_point receivedAt() const
+        {
+            return m_hasRxTimestamps ? m_receivedAt : std::chrono::steady_clock::now();
+        }
+
+        // a fragmented message is collected here, control frames may come in between
+        void onDataFrame(Opcode opcode, bool isFinal, std::string data)
+        {
+            auto isContinuation = opcode == Opcode::Continuation;
+            if (isContinuation != m_isFragmented)
+            {
+                startClose(CloseCode::ProtocolError);
+                return;
+            }
+
+            if (!m_isFragmented && isFinal)
+            {
+                onMessage(opcode, std::move(data));
+                return;
+            }
+
+            if (m_fragments.size() + data.size() > m_callback.maxMessageSize())
+            {
+                startClose(CloseCode::MessageTooBig);
+                return;
+            }
+
+            if (!m_isFragmented)
+            {
+                m_isFragmented = true;
+                m_fragmentedOpcode = opcode;
+            }
+
+            m_fragments += data;
+            if (isFinal)
+            {
+                m_isFragmented = false;
+                std::string message;
+                message.swap(m_fragments);
+                onMessage(m_fragmentedOpcode, std::move(message));
+            }
+        }
+
+        void onMessage(Opcode opcode, std::string message)
+        {
+            if (message.size() > m_callback.maxMessageSize())
+            {
+                startClose(CloseCode::MessageTooBig);
+                return;
+            }
+
+            if (Traits::ValidateUtf8 && opcode == Opcode::Text && !isValidUtf8(message.data(), message.size()))
+            {
+                startClose(CloseCode::InvalidPayload);
+                return;
+            }
+
+            if (!m_callback.processFrame(m_id, opcode, std::move(message), receivedAt()))
+                startClose(CloseCode::InvalidPayload);
+        }
+
+        void onRecvComplete(boost::system::error_code ec, std::size_t bytesTransferred)
         {
             m_isReading = false;
 
-            if (ec)
+            if (m_isParked && (!ec || ec == boost::asio::error::operation_aborted))
             {
-                if (ec.value() != boost::asio::error::eof)
-                    m_callback.log("#", m_id, ": recv error: ", ec);
+                // even a complete frame is left for the next process
+                m_receiver.addBytes(bytesTransferred);
+                return;
             }
-            else if (!m_isClosed)
+
+            if (!ec && !m_isClosed)
             {
                 m_receiver.addBytes(bytesTransferred);
-                if (m_receiver.isValidFrame())
+                if (processFrames(ec))
+                    return;
+            }
+
+            // a closing client may just go away
+            if (ec && ec.value() != boost::asio::error::eof && isOpen())
+                m_callback.log("#", m_id, ": recv error: ", ec);
+
+            m_callback.drop(*this);
+        }
+
+        // parses the buffered frames; after the budget the connection yields to the others
+        // on this thread, so a busy client can't hold the loop; false - drop the connection
+        bool processFrames(boost::system::error_code& ec)
+        {
+            for (std::size_t frames = 0;;)
+            {
+                if (!m_receiver.isValidFrame())
+                {
+                    m_callback.log("#", m_id, ": invalid frame");
+                    return false;
+                }
+
+                if (m_receiver.needReceiveMore(0) != 0)
                 {
-                    if (m_receiver.opcode() == Opcode::Close)
+#if defined __linux__
+                    if (m_hasRxTimestamps)
                     {
-                        sendFrame(Opcode::Close, {});
+                        if (recvTimestamped(ec))
+                            continue;
+
+                        if (ec)
+                            return false;
+
+                        m_isReading = true;
+                        waitReadable();
+                        return true;
                     }
-                    else
+#endif
+                    beginRecvFrame();
+                    return true;
+                }
+
+                auto budget = m_callback.frameBudget();
+                if (budget && frames++ == budget)
+                {
+                    m_isReading = true;
+                    yield();
+                    return true;
+                }
+
+                // over the rate limits the frame either waits for the tokens or the connection
+                // is closing and the frame is dropped
+                if (isOpen() && !m_callback.admitFrame(*this, m_receiver.frameLen()))
+                {
+                    if (isOpen())
                     {
-                        m_receiver.unmask();
-                        m_callback.processFrame(m_id, m_receiver.opcode(), m_receiver.message());
-                        m_receiver.shiftBuffer();
-                        beginRecvFrame();
-                        return;
+                        m_isReadThrottled = true;
+                        m_isReadSuspended = true;
+                        return true;
                     }
+
+                    m_receiver.shiftBuffer();
+                    continue;
                 }
-                else
+
+                processFrame();
+                m_receiver.shiftBuffer();
+
+                if (m_isClosed)
+                    return false;
+
+                if (m_isReadPaused && isOpen())
                 {
-                    m_callback.log("#", m_id, ": invalid frame");
+                    m_isReadSuspended = true;
+                    return true;
                 }
             }
+        }
 
-            m_callback.drop(*this);
+        void processFrame()
+        {
+            auto opcode = m_receiver.opcode();
+            m_receiver.unmask();
+
+            if (opcode == Opcode::Close)
+            {
+                if (!m_isCloseReceived)
+                    onCloseFrame(m_receiver.message());
+            }
+            else if (isOpen()) // after Close the client frames are discarded
+            {
+                // control frames are answered here and never reach the application
+                if (opcode == Opcode::Ping)
+                    sendFrame(Opcode::Pong, m_receiver.message());
+                else if (opcode == Opcode::Pong)
+                    m_callback.onPong(*this, m_receiver.message());
+                else if (Traits::Fragmentation)
+                    onDataFrame(opcode, m_receiver.isFinalFragment(), m_receiver.message());
+                else
+                    onMessage(opcode, m_receiver.message());
+            }
         }
 
     public:
         ConnectionId m_id;
+        boost::asio::ip::tcp::endpoint m_remoteEndpoint; // the client, also behind a PROXY protocol balancer
         bool m_isSending{false};
         bool m_isReading{false};
         bool m_isClosed{false};
-        
+        std::uint32_t m_generation{0}; // of the session, timers of the previous connection are ignored
+        bool m_isSubscribed{false};    // gets broadcasts
+
+        // keepalive
+        std::uint64_t m_pingTimestamp{0}; // payload of the ping waiting for a pong, 0 - none
+        unsigned m_missedPongs{0};
+
+        // inbound rate limits
+        TokenBucket m_messageBucket;
+        TokenBucket m_byteBucket;
+
+        // outbound shaping
+        unsigned m_sendClass{0};
+        TokenBucket m_sendBucket;
+
     private:
+        CloseState m_closeState{CloseState::Open};
+        bool m_isCloseReceived{false};
+        bool m_isCloseFlushed{false};
+
+        bool m_isParked{false};
+        std::size_t m_frontBytesSent{0}; // of a write cancelled by park()
+
+        bool m_isReadPaused{false};
+        bool m_isReadSuspended{false}; // no read is pending because of the pause or the rate limits
+        bool m_isReadThrottled{false};
+        bool m_isSendThrottled{false}; // the front frame waits for the send tokens
+
         boost::asio::ip::tcp::socket m_socket;
-        std::deque<ServerFrame> m_sendQueue;
-        FrameReceiver m_receiver;
+        std::deque<ServerFrame, typename Traits::template Allocator<ServerFrame>> m_sendQueue;
+        std::size_t m_queuedBytes{0};
+        bool m_isOverHighWater{false}; // Event::Drained is due when the queue is down to the low-water mark
+        BasicFrameReceiver<Traits> m_receiver;
+        bool m_isFragmented{false};
+        Opcode m_fragmentedOpcode{Opcode::Continuation};
+        std::string m_fragments;
+        bool m_hasRxTimestamps{false};
+        std::chrono::steady_clock::time_point m_receivedAt; // kernel timestamp of the last received data
         Callback& m_callback;
     };
 
-    template<typename Callback>
+    template<typename Callback, typename Traits>
     class ConnectionTable
     {
     public:
-        using conn_t = Connection<Callback>;
+        using conn_t = Connection<Callback, Traits>;
+
+        // `connId` - of a resumed session, 0 - a new one
+        conn_t& add(boost::asio::ip::tcp::socket&& socket, const boost::asio::ip::tcp::endpoint& remoteEndpoint, Callback& callback, ConnectionId connId = 0)
+        {
+            if (!connId)
+                connId = ++m_lastConnId;
 
-        conn_t& add(boost::asio::ip::tcp::socket&& socket, Callback& callback)
+            auto&& pair = m_connections.emplace(connId, make(connId, std::move(socket), remoteEndpoint, callback));
+            return *pair.first->second;
+        }
+
+        conn_t& resume(boost::asio::ip::tcp::socket&& socket, const HandoffConnection& state, Callback& callback)
         {
-            ++m_lastConnId;
-            auto&& pair = m_connections.emplace(m_lastConnId,
-                std::make_unique<conn_t>(m_lastConnId, std::move(socket), callback));
+            m_lastConnId = std::max(m_lastConnId, state.id);
+            auto&& pair = m_connections.emplace(state.id, make(std::move(socket), state, callback));
             return *pair.first->second;
         }
 
+        ConnectionId lastConnId() const { return m_lastConnId; }
+
+        // the id of a connection that is not in the table, an HTTP/2 stream
+        ConnectionId nextConnId() { return ++m_lastConnId; }
+        void setLastConnId(ConnectionId connId) { m_lastConnId = std::max(m_lastConnId, connId); }
+
+        template<typename F>
+        void forEach(F&& f)
+        {
+            for (auto&& conn : m_connections)
+                f(*conn.second);
+        }
+
         conn_t* find(ConnectionId connId)
         {
             auto iter = m_connections.find(connId);
             return iter == m_connections.end() ? nullptr : iter->second.get();
         }
 
+        std::size_t size() const { return m_connections.size(); }
+
         void erase(conn_t& conn)
         {
             m_connections.erase(conn.m_id);
@@ -185,7 +671,44 @@ namespace websocket { namespace details
         }
 
     private:
+        // the connections and the table nodes come from the traits allocator too
+        using alloc_t = typename Traits::template Allocator<conn_t>;
+        using alloc_traits_t = std::allocator_traits<alloc_t>;
+
+        struct Deleter
+        {
+            void operator()(conn_t* conn) const
+            {
+                alloc_t alloc;
+                alloc_traits_t::destroy(alloc, conn);
+                alloc_traits_t::deallocate(alloc, conn, 1);
+            }
+        };
+
+        using conn_ptr_t = std::unique_ptr<conn_t, Deleter>;
+
+        template<typename... Args>
+        static conn_ptr_t make(Args&&... args)
+        {
+            alloc_t alloc;
+            auto conn = alloc_traits_t::allocate(alloc, 1);
+            try
+            {
+                alloc_traits_t::construct(alloc, conn, std::forward<Args>(args)...);
+            }
+            catch (...)
+            {
+                alloc_traits_t::deallocate(alloc, conn, 1);
+                throw;
+            }
+
+            return conn_ptr_t{conn};
+        }
+
+        using value_t = std::pair<const ConnectionId, conn_ptr_t>;
+
         ConnectionId m_lastConnId{0};
-        std::unordered_map<ConnectionId, std::unique_ptr<conn_t>> m_connections;
+        std::unordered_map<ConnectionId, conn_ptr_t, std::hash<ConnectionId>, std::equal_to<ConnectionId>,
+            typename Traits::template Allocator<value_t>> m_connections;
     };
 }}
\ No newline at end of file
@@ -0,0 +1,57 @@
+// Websocket Server implementation
+// Belongs to the public domain
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace websocket { namespace details
+{
+    // Power of two buckets: bucket 0 counts values below 2, bucket i counts [2^i, 2^(i+1)),
+    // the last one takes everything above. For microseconds it spans up to ~16 s.
+    class Histogram
+    {
+    public:
+        static const std::size_t BucketCount = 24;
+
+        static std::uint64_t upperBound(std::size_t bucket)
+        {
+            return std::uint64_t(2) << bucket;
+        }
+
+        void record(std::uint64_t value)
+        {
+            m_sum += value;
+
+            std::size_t bucket = 0;
+            while (value > 1 && bucket + 1 < BucketCount)
+            {
+                value >>= 1;
+                ++bucket;
+            }
+
+            ++m_buckets[bucket];
+            ++m_count;
+        }
+
+        void merge(const Histogram& other)
+        {
+            for (std::size_t i = 0; i != BucketCount; ++i)
+                m_buckets[i] += other.m_buckets[i];
+
+            m_count += other.m_count;
+            m_sum += other.m_sum;
+        }
+
+        std::uint64_t bucket(std::size_t i) const { return m_buckets[i]; }
+        std::uint64_t count() const { return m_count; }
+        std::uint64_t sum() const { return m_sum; }
+
+    private:
+        std::array<std::uint32_t, BucketCount> m_buckets{};
+        std::uint64_t m_count{0};
+        std::uint64_t m_sum{0};
+    };
+}}
@@ -0,0 +1,824 @@
+// Websocket Server implementation
+// Belongs to the public domain
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+
+#include "server_fwd.hpp"
+#include "frames.hpp"
+#include "hpack.hpp"
+#include "http2.hpp"
+#include "utf8.hpp"
+
+namespace websocket { namespace details
+{
+    // HTTP/2 connection of a client with prior knowledge (h2c). Every stream opened with
+    // an extended CONNECT (RFC 8441) is a WebSocket connection with its own ConnectionId,
+    // the DATA frames of the stream carry the usual WebSocket frames.
+    template<typename Callback, typename Traits>
+    class Http2Connection
+    {
+    public:
+        // `id` - of the TCP connection, the streams get connection ids of their own;
+        // `received` - the bytes after the preface that came with the handshake reads
+        Http2Connection(std::uint64_t id, boost::asio::ip::tcp::socket socket, const boost::asio::ip::tcp::endpoint& remoteEndpoint, std::string received, Callback& callback)
+            : m_id{id}
+            , m_remoteEndpoint{remoteEndpoint}
+            , m_socket{std::move(socket)}
+            , m_input{std::move(received)}
+            , m_callback(callback)
+        {
+        }
+
+        // the server preface, then the frames already received
+        void start()
+        {
+            std::string settings;
+            http2::appendSetting(settings, http2::Setting::MaxConcurrentStreams, http2::MaxConcurrentStreams);
+            http2::appendSetting(settings, http2::Setting::EnableConnectProtocol, 1);
+            http2::appendFrame(m_output, http2::FrameType::Settings, 0, 0, settings);
+
+            onRecvComplete({}, 0);
+        }
+
+        // abortive close, the open streams are reported as disconnected
+        void close()
+        {
+            if (m_isClosed)
+                return;
+
+            m_isClosed = true;
+            boost::system::error_code ignoreError;
+            m_socket.cancel(ignoreError);
+            m_socket.shutdown(boost::asio::socket_base::shutdown_both, ignoreError);
+            m_socket.close(ignoreError);
+
+            closeStreams();
+            m_callback.onDequeued(m_queuedBytes);
+            m_queuedBytes = 0;
+        }
+
+        void sendFrame(ConnectionId connId, Opcode opcode, std::string data)
+        {
+            auto stream = findStream(connId);
+            if (!stream || !stream->isOpen || m_isClosed)
+                return;
+
+            appendMessage(*stream, ServerFrame{opcode, std::move(data)});
+            flush(*stream);
+            write();
+        }
+
+        // the server starts the close handshake of a stream
+        void startClose(ConnectionId connId, CloseCode code)
+        {
+            auto stream = findStream(connId);
+            if (!stream || m_isClosed)
+                return;
+
+            startClose(*stream, makeClosePayload(code));
+            flush(*stream);
+            write();
+        }
+
+    private:
+        struct Stream
+        {
+            std::uint32_t id{0};
+            ConnectionId connId{0};
+            std::int64_t sendWindow{0};
+            std::string pending; // WebSocket frames waiting for the send window
+            BasicFrameReceiver<Traits> receiver;
+
+            bool isOpen{true};        // the application knows it
+            bool isCloseReceived{false};
+            bool isRemoteEnded{false}; // END_STREAM from the client
+            bool isEndQueued{false};   // END_STREAM after `pending`
+            bool isEndSent{false};
+
+            bool isFragmented{false};
+            Opcode fragmentedOpcode{Opcode::Continuation};
+            std::string fragments;
+
+            bool isOverHighWater{false}; // Event::Drained is due when `pending` is down to the low-water mark
+        };
+
+        // at most this much is moved from the streams to the socket ahead of the write in progress,
+        // the rest waits in `pending` of its stream
+        static const std::size_t MaxOutputSize = 64 * 1024;
+
+        Stream* findStream(ConnectionId connId)
+        {
+            auto iter = std::find_if(m_streams.begin(), m_streams.end(), [=](const std::pair<const std::uint32_t, Stream>& pair)
+            {
+                return pair.second.connId == connId;
+            });
+
+            return iter == m_streams.end() ? nullptr : &iter->second;
+        }
+
+        void beginRecv()
+        {
+            m_isReading = true;
+            m_socket.async_read_some(boost::asio::buffer(m_readBuffer), [this](const boost::system::error_code& ec, std::size_t bytesTransferred)
+            {
+                onRecvComplete(ec, bytesTransferred);
+            });
+        }
+
+        void onRecvComplete(const boost::system::error_code& ec, std::size_t bytesTransferred)
+        {
+            m_isReading = false;
+
+            // after the GOAWAY the client data is discarded until its FIN
+            if (m_isLingering && !ec && !m_isClosed)
+            {
+                beginRecv();
+                return;
+            }
+
+            if (!ec && !m_isClosed)
+            {
+                m_input.append(m_readBuffer.data(), bytesTransferred);
+                auto isOk = processFrames();
+                eraseFinishedStreams();
+                write();
+
+                if (isOk)
+                {
+                    beginRecv();
+                    return;
+                }
+
+                // the GOAWAY is written before our side is shut down
+                m_isGoingAway = true;
+                if (!m_isSending)
+                    startLinger();
+
+                return;
+            }
+            else if (ec && ec != boost::asio::error::eof && !m_isClosed)
+            {
+                m_callback.log("HTTP/2 ", m_remoteEndpoint, ": recv error: ", ec);
+            }
+
+            m_callback.dropHttp2(*this);
+        }
+
+        void write()
+        {
+            if (!m_isSending && !m_output.empty() && !m_isClosed)
+            {
+                m_isSending = true;
+                m_writing.swap(m_output);
+                m_output.clear();
+                boost::asio::async_write(m_socket, boost::asio::buffer(m_writing), [this](const boost::system::error_code& ec, std::size_t)
+                {
+                    onSendComplete(ec);
+                });
+            }
+
+            updateQueuedBytes();
+        }
+
+        // the data waiting in the streams and the frames not written yet are the send queue
+        // of the connection
+        void updateQueuedBytes()
+        {
+            if (m_isClosed)
+                return;
+
+            auto queuedBytes = m_pendingBytes + m_output.size() + m_writing.size();
+            if (queuedBytes > m_queuedBytes)
+                m_callback.onQueued(queuedBytes - m_queuedBytes);
+            else
+                m_callback.onDequeued(m_queuedBytes - queuedBytes);
+
+            m_queuedBytes = queuedBytes;
+        }
+
+        void onSendComplete(const boost::system::error_code& ec)
+        {
+            m_isSending = false;
+
+            if (ec && !m_isClosed)
+                m_callback.log("HTTP/2 ", m_remoteEndpoint, ": send error: ", ec);
+
+            if (!ec && !m_isClosed)
+            {
+                m_writing.clear();
+                if (!m_isGoingAway)
+                    flushAll();
+
+                write();
+                if (m_isGoingAway && !m_isSending)
+                    startLinger();
+
+                return;
+            }
+
+            m_callback.dropHttp2(*this);
+        }
+
+        // half-close like a closing WebSocket connection: the client gets FIN after the GOAWAY,
+        // and we read until its FIN or `closeTimeout`
+        void startLinger()
+        {
+            if (m_isLingering)
+                return;
+
+            m_isLingering = true;
+            boost::system::error_code ignoreError;
+            m_socket.shutdown(boost::asio::socket_base::shutdown_send, ignoreError);
+
+            closeStreams();
+            updateQueuedBytes();
+            m_callback.onHttp2Closing(*this);
+
+            if (!m_isReading)
+                beginRecv();
+        }
+
+        // the open streams are reported as disconnected
+        void closeStreams()
+        {
+            for (auto&& pair : m_streams)
+            {
+                if (pair.second.isOpen)
+                    m_callback.onStreamClosed(pair.second.connId);
+            }
+
+            m_streams.clear();
+            m_pendingBytes = 0;
+        }
+
+        // false - a connection error, the connection is closed after the GOAWAY is written
+        bool processFrames()
+        {
+            std::size_t pos = 0;
+            while (m_input.size() - pos >= http2::FrameHeaderSize)
+            {
+                auto data = reinterpret_cast<const std::uint8_t*>(m_input.data()) + pos;
+                auto header = http2::parseFrameHeader(data);
+                if (header.length > http2::DefaultMaxFrameSize)
+                    return goAway(http2::ErrorCode::FrameSizeError);
+
+                if (m_input.size() - pos < http2::FrameHeaderSize + header.length)
+                    break;
+
+                if (!processFrame(header, data + http2::FrameHeaderSize))
+                    return false;
+
+                pos += http2::FrameHeaderSize + header.length;
+            }
+
+            m_input.erase(0, pos);
+            return true;
+        }
+
+        bool processFrame(const http2::FrameHeader& header, const std::uint8_t* payload)
+        {
+            // the client SETTINGS come first, a header block is not interrupted
+            if (!m_isSettingsReceived && header.type != http2::FrameType::Settings)
+                return goAway(http2::ErrorCode::ProtocolError);
+
+            if (m_headerStreamId && (header.type != http2::FrameType::Continuation || header.streamId != m_headerStreamId))
+                return goAway(http2::ErrorCode::ProtocolError);
+
+            switch (header.type)
+            {
+            case http2::FrameType::Data:
+                return onData(header, payload);
+
+            case http2::FrameType::Headers:
+                return onHeaders(header, payload);
+
+            case http2::FrameType::Continuation:
+                if (!m_headerStreamId)
+                    return goAway(http2::ErrorCode::ProtocolError);
+
+                return onHeaderFragment(header, payload, header.length);
+
+            case http2::FrameType::RstStream:
+                if (header.streamId == 0 || header.length != 4)
+                    return goAway(http2::ErrorCode::ProtocolError);
+
+                onStreamReset(header.streamId);
+                return true;
+
+            case http2::FrameType::Settings:
+                return onSettings(header, payload);
+
+            case http2::FrameType::Ping:
+                if (header.streamId != 0 || header.length != 8)
+                    return goAway(http2::ErrorCode::ProtocolError);
+
+                if (!(header.flags & http2::Ack))
+                    http2::appendFrame(m_output, http2::FrameType::Ping, http2::Ack, 0, reinterpret_cast<const char*>(payload), 8);
+
+                return true;
+
+            case http2::FrameType::GoAway:
+                return false; // the client leaves
+
+            case http2::FrameType::WindowUpdate:
+                return onWindowUpdate(header, payload);
+
+            case http2::FrameType::PushPromise:
+                return goAway(http2::ErrorCode::ProtocolError);
+
+            default: // PRIORITY and the unknown types are ignored
+                return true;
+            }
+        }
+
+        bool goAway(http2::ErrorCode code)
+        {
+            std::string payload;
+            http2::appendUint32(payload, m_lastStreamId);
+            http2::appendUint32(payload, static_cast<std::uint32_t>(code));
+            http2::appendFrame(m_output, http2::FrameType::GoAway, 0, 0, payload);
+
+            m_callback.log("HTTP/2 ", m_remoteEndpoint, ": connection error ", static_cast<std::uint32_t>(code));
+            return false;
+        }
+
+        bool onSettings(const http2::FrameHeader& header, const std::uint8_t* payload)
+        {
+            if (header.streamId != 0)
+                return goAway(http2::ErrorCode::ProtocolError);
+
+            if (header.flags & http2::Ack)
+                return header.length == 0 || goAway(http2::ErrorCode::FrameSizeError);
+
+            if (header.length % 6 != 0)
+                return goAway(http2::ErrorCode::FrameSizeError);
+
+            m_isSettingsReceived = true;
+            for (std::size_t i = 0; i != header.length; i += 6)
+            {
+                auto setting = static_cast<http2::Setting>((payload[i] << 8) | payload[i + 1]);
+                auto value = http2::readUint32(payload + i + 2);
+
+                if (setting == http2::Setting::InitialWindowSize)
+                {
+                    if (value > http2::MaxWindowSize)
+                        return goAway(http2::ErrorCode::FlowControlError);
+
+                    // applies to the open streams too
+                    auto delta = static_cast<std::int64_t>(value) - m_initialWindow;
+                    m_initialWindow = value;
+                    for (auto&& pair : m_streams)
+                        pair.second.sendWindow += delta;
+                }
+                else if (setting == http2::Setting::MaxFrameSize)
+                {
+                    if (value < http2::DefaultMaxFrameSize || value > 0xFFFFFF)
+                        return goAway(http2::ErrorCode::ProtocolError);
+
+                    m_maxFrameSize = value;
+                }
+                else if (setting == http2::Setting::EnablePush && value > 1)
+                {
+                    return goAway(http2::ErrorCode::ProtocolError);
+                }
+            }
+
+            http2::appendFrame(m_output, http2::FrameType::Settings, http2::Ack, 0);
+            flushAll();
+            return true;
+        }
+
+        bool onWindowUpdate(const http2::FrameHeader& header, const std::uint8_t* payload)
+        {
+            if (header.length != 4)
+                return goAway(http2::ErrorCode::FrameSizeError);
+
+            auto increment = http2::readUint32(payload) & 0x7FFFFFFF;
+            if (header.streamId == 0)
+            {
+                if (increment == 0 || m_sendWindow + increment > http2::MaxWindowSize)
+                    return goAway(http2::ErrorCode::FlowControlError);
+
+                m_sendWindow += increment;
+                flushAll();
+                return true;
+            }
+
+            auto iter = m_streams.find(header.streamId);
+            if (iter == m_streams.end())
+                return true;
+
+            auto&& stream = iter->second;
+            if (increment == 0 || stream.sendWindow + increment > http2::MaxWindowSize)
+            {
+                resetStream(stream, http2::ErrorCode::FlowControlError);
+                return true;
+            }
+
+            stream.sendWindow += increment;
+            flush(stream);
+            return true;
+        }
+
+        bool onHeaders(const http2::FrameHeader& header, const std::uint8_t* payload)
+        {
+            if (header.streamId == 0 || header.streamId % 2 == 0)
+                return goAway(http2::ErrorCode::ProtocolError);
+
+            std::size_t size;
+            if (!http2::framePayload(header, payload, size))
+                return goAway(http2::ErrorCode::ProtocolError);
+
+            m_headerStreamId = header.streamId;
+            m_isHeaderEndStream = (header.flags & http2::EndStream) != 0;
+            m_headerBlock.clear();
+            return onHeaderFragment(header, payload, size);
+        }
+
+        bool onHeaderFragment(const http2::FrameHeader& header, const std::uint8_t* fragment, std::size_t size)
+        {
+            if (m_headerBlock.size() + size > http2::MaxHeaderBlockSize)
+                return goAway(http2::ErrorCode::ProtocolError);
+
+            m_headerBlock.append(reinterpret_cast<const char*>(fragment), size);
+            return (header.flags & http2::EndHeaders) ? onHeaderBlock() : true;
+        }
+
+        // the header block is decoded even for a stream that is refused, it updates the HPACK table
+        bool onHeaderBlock()
+        {
+            auto streamId = m_headerStreamId;
+            m_headerStreamId = 0;
+
+            std::vector<HeaderField> headers;
+            if (!m_decoder.decode(reinterpret_cast<const std::uint8_t*>(m_headerBlock.data()), m_headerBlock.size(), headers))
+                return goAway(http2::ErrorCode::CompressionError);
+
+            // trailers of an open stream
+            auto iter = m_streams.find(streamId);
+            if (iter != m_streams.end())
+            {
+                if (m_isHeaderEndStream)
+                    onRemoteEnd(iter->second);
+
+                return true;
+            }
+
+            if (streamId <= m_lastStreamId)
+                return goAway(http2::ErrorCode::StreamClosed);
+
+            m_lastStreamId = streamId;
+            if (m_streams.size() >= http2::MaxConcurrentStreams)
+            {
+                appendReset(streamId, http2::ErrorCode::RefusedStream);
+                return true;
+            }
+
+            // a WebSocket stream stays open after the request
+            auto status = m_isHeaderEndStream ? http::Status::BadRequest : http2::validateConnect(headers);
+            if (status != http::Status::OK)
+            {
+                m_callback.log("HTTP/2 ", m_remoteEndpoint, ": handshake error ", static_cast<int>(status));
+                http2::appendFrame(m_output, http2::FrameType::Headers, http2::EndHeaders | http2::EndStream, streamId, encodeStatus(static_cast<int>(status)));
+                return true;
+            }
+
+            http2::appendFrame(m_output, http2::FrameType::Headers, http2::EndHeaders, streamId, encodeStatus(200));
+
+            auto&& stream = m_streams[streamId];
+            stream.id = streamId;
+            stream.sendWindow = m_initialWindow;
+            stream.connId = m_callback.nextConnId();
+            m_callback.onStreamOpen(*this, stream.connId);
+            return true;
+        }
+
+        bool onData(const http2::FrameHeader& header, const std::uint8_t* payload)
+        {
+            if (header.streamId == 0 || header.streamId > m_lastStreamId)
+                return goAway(http2::ErrorCode::ProtocolError);
+
+            std::size_t size;
+            if (!http2::framePayload(header, payload, size))
+                return goAway(http2::ErrorCode::ProtocolError);
+
+            // the data is consumed right away, so the windows are given back right away
+            if (header.length)
+                appendWindowUpdate(0, header.length);
+
+            auto iter = m_streams.find(header.streamId);
+            if (iter == m_streams.end() || iter->second.isRemoteEnded)
+                return true; // a closed stream
+
+            auto&& stream = iter->second;
+            auto isEnd = (header.flags & http2::EndStream) != 0;
+            if (header.length && !isEnd)
+                appendWindowUpdate(stream.id, header.length);
+
+            if (!receive(stream, payload, size))
+            {
+                m_callback.log("#", stream.connId, ": invalid frame");
+                resetStream(stream, http2::ErrorCode::ProtocolError);
+                return true;
+            }
+
+            if (isEnd)
+                onRemoteEnd(stream);
+
+            return true;
+        }
+
+        void appendWindowUpdate(std::uint32_t streamId, std::uint32_t increment)
+        {
+            std::string payload;
+            http2::appendUint32(payload, increment);
+            http2::appendFrame(m_output, http2::FrameType::WindowUpdate, 0, streamId, payload);
+        }
+
+        void appendReset(std::uint32_t streamId, http2::ErrorCode code)
+        {
+            std::string payload;
+            http2::appendUint32(payload, static_cast<std::uint32_t>(code));
+            http2::appendFrame(m_output, http2::FrameType::RstStream, 0, streamId, payload);
+        }
+
+        // the WebSocket frames in a DATA payload, they may span DATA frames
+        bool receive(Stream& stream, const std::uint8_t* data, std::size_t size)
+        {
+            auto&& receiver = stream.receiver;
+            while (size)
+            {
+                auto n = std::min(size, receiver.getBufferTailSize());
+                if (n == 0)
+                    return false;
+
+                std::memcpy(receiver.getBufferTail(), data, n);
+                receiver.addBytes(n);
+                data += n;
+                size -= n;
+
+                for (;;)
+                {
+                    if (!receiver.isValidFrame())
+                        return false;
+
+                    if (receiver.needReceiveMore(0) != 0)
+                        break;
+
+                    processFrame(stream);
+                    receiver.shiftBuffer();
+                }
+            }
+
+            return true;
+        }
+
+        void processFrame(Stream& stream)
+        {
+            auto&& receiver = stream.receiver;
+            auto opcode = receiver.opcode();
+            receiver.unmask();
+
+            if (opcode == Opcode::Close)
+            {
+                if (!stream.isCloseReceived)
+                    onCloseFrame(stream, receiver.message());
+            }
+            else if (stream.isOpen) // after Close the client frames are discarded
+            {
+                if (opcode == Opcode::Ping)
+                    appendMessage(stream, ServerFrame{Opcode::Pong, receiver.message()});
+                else if (opcode == Opcode::Pong)
+                    return;
+                else if (Traits::Fragmentation)
+                    onDataFrame(stream, opcode, receiver.isFinalFragment(), receiver.message());
+                else
+                    onMessage(stream, opcode, receiver.message());
+            }
+
+            flush(stream);
+        }
+
+        void onDataFrame(Stream& stream, Opcode opcode, bool isFinal, std::string data)
+        {
+            auto isContinuation = opcode == Opcode::Continuation;
+            if (isContinuation != stream.isFragmented)
+                return startClose(stream, makeClosePayload(CloseCode::ProtocolError));
+
+            if (!stream.isFragmented && isFinal)
+                return onMessage(stream, opcode, std::move(data));
+
+            if (stream.fragments.size() + data.size() > m_callback.maxMessageSize())
+                return startClose(stream, makeClosePayload(CloseCode::MessageTooBig));
+
+            if (!stream.isFragmented)
+            {
+                stream.isFragmented = true;
+                stream.fragmentedOpcode = opcode;
+            }
+
+            stream.fragments += data;
+            if (isFinal)
+            {
+                stream.isFragmented = false;
+                std::string message;
+                message.swap(stream.fragments);
+                onMessage(stream, stream.fragmentedOpcode, std::move(message));
+            }
+        }
+
+        void onMessage(Stream& stream, Opcode opcode, std::string message)
+        {
+            if (message.size() > m_callback.maxMessageSize())
+                return startClose(stream, makeClosePayload(CloseCode::MessageTooBig));
+
+            if (Traits::ValidateUtf8 && opcode == Opcode::Text && !isValidUtf8(message.data(), message.size()))
+                return startClose(stream, makeClosePayload(CloseCode::InvalidPayload));
+
+            if (!m_callback.processFrame(stream.connId, opcode, std::move(message), std::chrono::steady_clock::now()))
+                startClose(stream, makeClosePayload(CloseCode::InvalidPayload));
+        }
+
+        void onCloseFrame(Stream& stream, const std::string& payload)
+        {
+            stream.isCloseReceived = true;
+
+            if (stream.isOpen)
+            {
+                // echo the status code, the reason is not repeated
+                std::uint16_t code;
+                startClose(stream, parseClosePayload(payload, code) ? makeClosePayload(code) : makeClosePayload(CloseCode::ProtocolError));
+            }
+            else
+            {
+                stream.isEndQueued = true;
+            }
+        }
+
+        // the END_STREAM of a stream is its FIN: after both Close frames, or instead of them
+        void startClose(Stream& stream, std::string closePayload)
+        {
+            if (!stream.isOpen)
+                return;
+
+            stream.isOpen = false;
+            m_callback.onStreamClosed(stream.connId);
+
+            appendMessage(stream, ServerFrame{Opcode::Close, std::move(closePayload)});
+            if (stream.isCloseReceived)
+                stream.isEndQueued = true;
+        }
+
+        void onRemoteEnd(Stream& stream)
+        {
+            stream.isRemoteEnded = true;
+            if (stream.isOpen)
+            {
+                stream.isOpen = false;
+                m_callback.onStreamClosed(stream.connId);
+                clearPending(stream);
+            }
+
+            stream.isEndQueued = true;
+            flush(stream);
+        }
+
+        void onStreamReset(std::uint32_t streamId)
+        {
+            auto iter = m_streams.find(streamId);
+            if (iter == m_streams.end())
+                return;
+
+            if (iter->second.isOpen)
+                m_callback.onStreamClosed(iter->second.connId);
+
+            clearPending(iter->second);
+            m_streams.erase(iter);
+        }
+
+        void resetStream(Stream& stream, http2::ErrorCode code)
+        {
+            appendReset(stream.id, code);
+            if (stream.isOpen)
+            {
+                stream.isOpen = false;
+                m_callback.onStreamClosed(stream.connId);
+            }
+
+            // erased with the finished streams
+            clearPending(stream);
+            stream.isRemoteEnded = true;
+            stream.isEndSent = true;
+        }
+
+        void appendMessage(Stream& stream, const ServerFrame& frame)
+        {
+            stream.pending.append(reinterpret_cast<const char*>(frame.m_header), frame.m_headerLen);
+            stream.pending.append(frame.data(), frame.dataSize());
+
+            m_pendingBytes += frame.size();
+            if (m_callback.isOverHighWater(stream.pending.size()))
+                stream.isOverHighWater = true;
+        }
+
+        void clearPending(Stream& stream)
+        {
+            m_pendingBytes -= stream.pending.size();
+            std::string{}.swap(stream.pending);
+        }
+
+        // DATA frames as far as the send windows and the output limit allow
+        void flush(Stream& stream)
+        {
+            while (!stream.pending.empty() && m_output.size() < MaxOutputSize)
+            {
+                auto window = std::min(stream.sendWindow, m_sendWindow);
+                if (window <= 0)
+                    break;
+
+                auto size = std::min<std::size_t>({stream.pending.size(), m_maxFrameSize, static_cast<std::size_t>(window)});
+                auto isEnd = size == stream.pending.size() && stream.isEndQueued;
+                http2::appendFrame(m_output, http2::FrameType::Data, isEnd ? http2::EndStream : 0, stream.id, stream.pending.data(), size);
+
+                stream.pending.erase(0, size);
+                m_pendingBytes -= size;
+                stream.sendWindow -= size;
+                m_sendWindow -= size;
+                stream.isEndSent = stream.isEndSent || isEnd;
+            }
+
+            if (stream.pending.empty() && stream.isEndQueued && !stream.isEndSent)
+            {
+                http2::appendFrame(m_output, http2::FrameType::Data, http2::EndStream, stream.id);
+                stream.isEndSent = true;
+            }
+
+            if (stream.isOverHighWater && m_callback.isDrained(stream.pending.size()))
+            {
+                stream.isOverHighWater = false;
+                if (stream.isOpen)
+                    m_callback.onDrained(stream.connId);
+            }
+        }
+
+        void flushAll()
+        {
+            for (auto&& pair : m_streams)
+                flush(pair.second);
+        }
+
+        void eraseFinishedStreams()
+        {
+            for (auto iter = m_streams.begin(); iter != m_streams.end();)
+            {
+                if (iter->second.isEndSent && iter->second.isRemoteEnded)
+                    iter = m_streams.erase(iter);
+                else
+                    ++iter;
+            }
+        }
+
+    public:
+        std::uint64_t m_id;
+        boost::asio::ip::tcp::endpoint m_remoteEndpoint;
+        bool m_isReading{false};
+        bool m_isSending{false};
+        bool m_isClosed{false};
+
+    private:
+        boost::asio::ip::tcp::socket m_socket;
+        std::array<char, http2::DefaultMaxFrameSize> m_readBuffer;
+        std::string m_input;   // frames not parsed yet
+        std::string m_output;  // frames waiting for the write in progress
+        std::string m_writing;
+        bool m_isGoingAway{false};
+        bool m_isLingering{false}; // the GOAWAY is written and our side is shut down
+
+        std::size_t m_pendingBytes{0}; // of all streams
+        std::size_t m_queuedBytes{0};  // as reported to the callback
+
+        bool m_isSettingsReceived{false};
+        std::int64_t m_sendWindow{http2::DefaultWindowSize};
+        std::int64_t m_initialWindow{http2::DefaultWindowSize}; // of the streams, from the client SETTINGS
+        std::size_t m_maxFrameSize{http2::DefaultMaxFrameSize};
+
+        HpackDecoder m_decoder;
+        std::string m_headerBlock;
+        std::uint32_t m_headerStreamId{0}; // of the header block in progress, 0 - none
+        bool m_isHeaderEndStream{false};
+
+        std::uint32_t m_lastStreamId{0};
+        std::map<std::uint32_t, Stream> m_streams;
+        Callback& m_callback;
+    };
+}}
@@ -0,0 +1,253 @@
+// Websocket Server implementation
+// Belongs to the public domain
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#if defined __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "frames.hpp"
+
+namespace websocket { namespace details
+{
+    // Append-only journal of broadcast messages. The frames are stored exactly as they are
+    // sent, back to back, in memory-mapped segment files `<path>.000000.log`, `<path>.000001.log`...
+    // of a fixed size; the unused tail of a segment is zero, and no server frame starts
+    // with a zero byte. Messages are numbered from 0 across the segments (the offset).
+    // A sparse in-memory index maps an offset to its position every IndexInterval bytes,
+    // on start the existing segments are scanned to rebuild it.
+    class Journal
+    {
+    public:
+        static const std::size_t IndexInterval = 4096;
+
+        class Segment
+        {
+        public:
+            Segment(const std::string& fileName, std::size_t capacity, std::uint64_t baseOffset, bool create)
+                : m_baseOffset{baseOffset}
+            {
+                if (create)
+                    createFile(fileName, capacity);
+
+                m_file = boost::interprocess::file_mapping{fileName.c_str(), boost::interprocess::read_write};
+                m_region = boost::interprocess::mapped_region{m_file, boost::interprocess::read_write};
+                m_capacity = m_region.get_size();
+
+                if (!create)
+                    recover();
+            }
+
+            std::uint64_t baseOffset() const { return m_baseOffset; }
+            std::uint64_t endOffset() const { return m_baseOffset + m_count; }
+            const char* data() const { return static_cast<const char*>(m_region.get_address()); }
+            std::size_t size() const { return m_size; }
+            bool fits(std::size_t frameSize) const { return m_capacity - m_size >= frameSize; }
+
+            // returns the position of the frame
+            std::size_t append(const ServerFrame& frame)
+            {
+                auto position = m_size;
+                auto p = static_cast<char*>(m_region.get_address()) + position;
+                std::memcpy(p, frame.m_header, frame.m_headerLen);
+                std::memcpy(p + frame.m_headerLen, frame.data(), frame.dataSize());
+
+                add(frame.size());
+                return position;
+            }
+
+            // position of the message `offset`, which must be in this segment
+            std::size_t find(std::uint64_t offset) const
+            {
+                auto iter = std::upper_bound(begin(m_index), end(m_index), offset,
+                    [](std::uint64_t offset, const IndexEntry& entry) { return offset < entry.offset; });
+
+                auto current = m_baseOffset;
+                std::size_t position = 0;
+                if (iter != begin(m_index))
+                {
+                    --iter;
+                    current = iter->offset;
+                    position = iter->position;
+                }
+
+                for (; current != offset; ++current)
+                    position += frameLength(data() + position, m_size - position);
+
+                return position;
+            }
+
+        private:
+            struct IndexEntry
+            {
+                std::uint64_t offset;
+                std::size_t position;
+            };
+
+            // The blocks are reserved up front: a full disk is an exception here, not SIGBUS on
+            // a write to the mapping of a sparse file.
+            static void createFile(const std::string& fileName, std::size_t capacity)
+            {
+#if defined __linux__
+                int fd = ::open(fileName.c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0644);
+                if (fd < 0)
+                    throw std::runtime_error("journal: can't create " + fileName + ": " + std::strerror(errno));
+
+                int error;
+                do error = ::posix_fallocate(fd, 0, static_cast<off_t>(capacity)); while (error == EINTR);
+                ::close(fd);
+                if (error != 0)
+                {
+                    ::unlink(fileName.c_str());
+                    throw std::runtime_error("journal: can't allocate " + fileName + ": " + std::strerror(error));
+                }
+#else
+                // no fallocate, the zeros are written out
+                std::ofstream file{fileName, std::ios::binary | std::ios::trunc};
+                const std::vector<char> zeros(64 * 1024);
+                for (std::size_t written = 0; written < capacity && file; written += zeros.size())
+                    file.write(zeros.data(), static_cast<std::streamsize>(std::min(zeros.size(), capacity - written)));
+
+                file.close();
+                if (!file)
+                {
+                    std::remove(fileName.c_str());
+                    throw std::runtime_error("journal: can't create " + fileName);
+                }
+#endif
+            }
+
+            void add(std::size_t frameSize)
+            {
+                if (m_index.empty() || m_size - m_index.back().position >= IndexInterval)
+                    m_index.push_back({m_baseOffset + m_count, m_size});
+
+                m_size += frameSize;
+                ++m_count;
+            }
+
+            void recover()
+            {
+                for (;;)
+                {
+                    auto length = frameLength(data() + m_size, m_capacity - m_size);
+                    if (length == 0)
+                        return;
+
+                    add(length);
+                }
+            }
+
+            boost::interprocess::file_mapping m_file;
+            boost::interprocess::mapped_region m_region;
+            std::size_t m_capacity{0};
+            std::size_t m_size{0};
+            std::uint64_t m_baseOffset;
+            std::uint64_t m_count{0};
+            std::vector<IndexEntry> m_index;
+        };
+
+        // length of the server frame at `p`, 0 - no complete frame
+        static std::size_t frameLength(const char* p, std::size_t available)
+        {
+            if (available < 2 || p[0] == 0)
+                return 0;
+
+            auto len = static_cast<std::uint8_t>(p[1]) & 0x7F;
+            std::size_t headerLen = len == 126 ? 4 : len == 127 ? 10 : 2;
+            if (available < headerLen)
+                return 0;
+
+            std::uint64_t payloadLen = len;
+            if (len >= 126)
+            {
+                payloadLen = 0;
+                for (std::size_t i = 2; i != headerLen; ++i)
+                    payloadLen = (payloadLen << 8) | static_cast<std::uint8_t>(p[i]);
+            }
+
+            return available - headerLen < payloadLen ? 0 : headerLen + static_cast<std::size_t>(payloadLen);
+        }
+
+        Journal(std::string path, std::size_t segmentSize)
+            : m_path{std::move(path)}
+            , m_segmentSize{segmentSize}
+        {
+            std::uint64_t offset = 0;
+            for (;;)
+            {
+                auto fileName = segmentFileName(m_segments.size());
+                if (!std::ifstream{fileName})
+                    break;
+
+                m_segments.push_back(std::make_shared<Segment>(fileName, 0, offset, false));
+                offset = m_segments.back()->endOffset();
+            }
+        }
+
+        std::uint64_t endOffset() const { return m_segments.empty() ? 0 : m_segments.back()->endOffset(); }
+
+        struct Appended
+        {
+            std::shared_ptr<const Segment> segment;
+            const char* bytes;
+        };
+
+        Appended append(const ServerFrame& frame)
+        {
+            if (frame.size() > m_segmentSize)
+                throw std::length_error("journal: message is longer than a segment");
+
+            if (m_segments.empty() || !m_segments.back()->fits(frame.size()))
+            {
+                auto fileName = segmentFileName(m_segments.size());
+                m_segments.push_back(std::make_shared<Segment>(fileName, m_segmentSize, endOffset(), true));
+            }
+
+            auto&& segment = m_segments.back();
+            auto position = segment->append(frame);
+            return{segment, segment->data() + position};
+        }
+
+        // calls `f(segment, bytes, size)` with the frames from `offset` to the end, a call for each segment
+        template<typename F>
+        void read(std::uint64_t offset, F&& f) const
+        {
+            for (auto&& segment : m_segments)
+            {
+                if (offset >= segment->endOffset())
+                    continue;
+
+                auto position = offset > segment->baseOffset() ? segment->find(offset) : 0;
+                f(std::shared_ptr<const Segment>{segment}, segment->data() + position, segment->size() - position);
+            }
+        }
+
+    private:
+        std::string segmentFileName(std::size_t index) const
+        {
+            char suffix[32];
+            std::snprintf(suffix, sizeof(suffix), ".%06u.log", static_cast<unsigned>(index));
+            return m_path + suffix;
+        }
+
+        std::string m_path;
+        std::size_t m_segmentSize;
+        std::vector<std::shared_ptr<Segment>> m_segments;
+    };
+}}
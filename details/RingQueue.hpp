@@ -0,0 +1,61 @@
+// Websocket Server implementation
+// Belongs to the public domain
+
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace websocket { namespace details
+{
+    // FIFO in one contiguous array that doubles when full. The slots are default constructed,
+    // a popped slot is reset to T{}.
+    template<typename T, typename Alloc = std::allocator<T>>
+    class RingQueue
+    {
+    public:
+        bool empty() const { return m_size == 0; }
+        std::size_t size() const { return m_size; }
+
+        T& front()
+        {
+            assert(!empty());
+            return m_items[m_head];
+        }
+
+        void push_back(T value)
+        {
+            if (m_size == m_items.size())
+                grow();
+
+            m_items[(m_head + m_size) & (m_items.size() - 1)] = std::move(value);
+            ++m_size;
+        }
+
+        void pop_front()
+        {
+            assert(!empty());
+            m_items[m_head] = T{};
+            m_head = (m_head + 1) & (m_items.size() - 1);
+            --m_size;
+        }
+
+    private:
+        void grow()
+        {
+            std::vector<T, Alloc> items(m_items.empty() ? 16 : 2 * m_items.size());
+            for (std::size_t i = 0; i != m_size; ++i)
+                items[i] = std::move(m_items[(m_head + i) & (m_items.size() - 1)]);
+
+            m_items.swap(items);
+            m_head = 0;
+        }
+
+        std::vector<T, Alloc> m_items; // the size is a power of two
+        std::size_t m_head{0};
+        std::size_t m_size{0};
+    };
+}}
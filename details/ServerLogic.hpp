@@ -3,50 +3,209 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstring>
 #include <functional>
+#include <limits>
+#include <memory>
 #include <ostream>
 #include <string>
+#include <type_traits>
+#include <unordered_map>
 #include <boost/asio.hpp>
 
+#include "AdmissionControl.hpp"
 #include "Connection.hpp"
+#include "EventRecord.hpp"
+#include "Histogram.hpp"
 #include "handshake.hpp"
+#include "Http2Connection.hpp"
+#include "Journal.hpp"
+#include "json_route.hpp"
+#include "metrics.hpp"
+#include "proxy_protocol.hpp"
 #include "server_fwd.hpp"
+#include "ServerOptions.hpp"
+#include "Session.hpp"
+#include "shm_ring.hpp"
+#include "TimerWheel.hpp"
+#include "TokenBucket.hpp"
 
 namespace websocket { namespace details
 {
+    template<typename Traits>
     class ServerLogic
     {
     public:
         template<typename Callback>
-        ServerLogic(std::ostream& log, Callback&& callback)
+        ServerLogic(std::ostream& log, const ServerOptions& options, Callback&& callback)
             : m_log{log}
+            , m_options(options)
+            , m_admission{m_options}
             , m_callback(callback)
-        {}
+            , m_overloadReply{
+                "HTTP/1.1 503 Service Unavailable\r\n"
+                "Retry-After: " + std::to_string(options.retryAfter.count()) + "\r\n"
+                "Connection: close\r\n"
+                "Content-Length: 0\r\n"
+                "\r\n"}
+            , m_healthReply{makePlainReply("text/plain", "OK\n")}
+        {
+            if (!options.journalPath.empty())
+                m_journal = std::make_unique<Journal>(options.journalPath, options.journalSegmentSize);
+        }
 
-        using conn_t = Connection<ServerLogic>;
+        using conn_t = Connection<ServerLogic, Traits>;
+        using h2conn_t = Http2Connection<ServerLogic, Traits>;
 
-        void processFrame(ConnectionId id, Opcode opcode, std::string message)
+        void onPong(conn_t& conn, const std::string& payload)
         {
-            if (opcode == Opcode::Text || opcode == Opcode::Binary)
+            conn.m_missedPongs = 0;
+
+            if (conn.m_pingTimestamp && payload == encodeTimestamp(conn.m_pingTimestamp))
+            {
+                auto rtt = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::nanoseconds(timestampNow() - conn.m_pingTimestamp));
+                m_rtt.record(rtt.count());
+            }
+
+            conn.m_pingTimestamp = 0;
+        }
+
+        bool hasRxTimestamps() const { return m_options.receiveTimestamps; }
+        std::size_t frameBudget() const { return m_options.frameBudget; }
+
+        // a message through the shared memory has to fit into one record of the ring
+        std::size_t maxMessageSize() const
+        {
+            std::size_t maxSize = Traits::MaxMessageLen;
+            if (!m_options.sharedMemory.empty() && m_options.sharedMemoryRingSize - sizeof(RecordHeader) < maxSize)
+                maxSize = m_options.sharedMemoryRingSize - sizeof(RecordHeader);
+
+            return maxSize;
+        }
+
+        // inbound rate limits, checked for every client frame; false - the connection waits
+        // for the tokens or is closing with 1008
+        bool admitFrame(conn_t& conn, std::size_t frameLen)
+        {
+            if (m_options.messageRate.rate <= 0 && m_options.byteRate.rate <= 0)
+                return true;
+
+            auto now = TokenBucket::clock_t::now();
+            auto wait = std::max(conn.m_messageBucket.waitTime(m_options.messageRate, now),
+                conn.m_byteBucket.waitTime(m_options.byteRate, now, static_cast<double>(frameLen)));
+
+            if (wait == TokenBucket::clock_t::duration::zero())
             {
-                m_callback(Event::Message, id, message);
+                conn.m_messageBucket.take(m_options.messageRate);
+                conn.m_byteBucket.take(m_options.byteRate, static_cast<double>(frameLen));
+                return true;
+            }
+
+            if (m_options.rateLimitAction == RateLimitAction::Close)
+            {
+                log("#", conn.m_id, ": rate limit exceeded");
+                conn.startClose(CloseCode::PolicyViolation);
             }
             else
             {
-                log("#", id, ": WARNING: unknown opcode ", (int)opcode);
+                scheduleTimer(conn, TimerKind::ReadThrottle, wait);
             }
+
+            return false;
+        }
+
+        // outbound shaping, checked for every frame before it is written; false - the frame
+        // waits for the tokens
+        bool admitSend(conn_t& conn, std::size_t frameSize)
+        {
+            if (conn.m_sendClass >= m_options.sendRates.size())
+                return true;
+
+            auto&& limit = m_options.sendRates[conn.m_sendClass];
+            auto wait = conn.m_sendBucket.waitTime(limit, TokenBucket::clock_t::now(), static_cast<double>(frameSize));
+            if (wait == TokenBucket::clock_t::duration::zero())
+            {
+                conn.m_sendBucket.take(limit, static_cast<double>(frameSize));
+                return true;
+            }
+
+            scheduleTimer(conn, TimerKind::SendThrottle, wait);
+            return false;
+        }
+
+        // false - the decoder rejected the message
+        bool processFrame(ConnectionId id, Opcode opcode, std::string message, std::chrono::steady_clock::time_point receivedAt)
+        {
+            if (opcode == Opcode::Text || opcode == Opcode::Binary)
+            {
+                using decoder_t = typename Traits::Decoder;
+                auto route = opcode == Opcode::Text ? findRoute(message) : 0;
+                return pushMessage(id, std::move(message), opcode == Opcode::Binary, receivedAt, route,
+                    std::integral_constant<bool, !std::is_void<typename decoder_t::Type>::value>{});
+            }
+
+            log("#", id, ": WARNING: unknown opcode ", (int)opcode);
+            return true;
+        }
+
+        // the close handshake has started, for the application the connection is gone
+        void onClosing(conn_t& conn)
+        {
+            m_sessions.erase(conn.m_id);
+            m_callback(EventRecord{Event::Disconnect, conn.m_id});
+            scheduleTimer(conn, TimerKind::Linger, m_options.closeTimeout);
         }
 
         void drop(conn_t& conn)
         {
             if (!conn.m_isClosed)
             {
+                // a closing connection is already reported
+                auto wasOpen = conn.isOpen();
                 conn.close();
-                m_callback(Event::Disconnect, conn.m_id, "");
+                if (wasOpen && !detachSession(conn.m_id))
+                    m_callback(EventRecord{Event::Disconnect, conn.m_id});
             }
 
             if (!conn.m_isReading && !conn.m_isSending)
+            {
+                m_admission.release(conn.m_remoteEndpoint.address());
                 m_connTable.erase(conn);
+            }
+        }
+
+        ConnectionId nextConnId() { return m_connTable.nextConnId(); }
+
+        void onStreamOpen(h2conn_t& conn, ConnectionId connId)
+        {
+            m_http2Streams[connId] = &conn;
+            m_callback(EventRecord{Event::NewConnection, connId});
+        }
+
+        // the close handshake of the stream has started or the stream is reset
+        void onStreamClosed(ConnectionId connId)
+        {
+            m_http2Streams.erase(connId);
+            m_callback(EventRecord{Event::Disconnect, connId});
+        }
+
+        void dropHttp2(h2conn_t& conn)
+        {
+            conn.close();
+            if (!conn.m_isReading && !conn.m_isSending)
+            {
+                m_admission.release(conn.m_remoteEndpoint.address());
+                m_http2Connections.erase(conn.m_id);
+            }
+        }
+
+        // the GOAWAY is written and our side is shut down, the client has `closeTimeout` for its FIN
+        void onHttp2Closing(h2conn_t& conn)
+        {
+            scheduleTimer(conn.m_id, 0, TimerKind::Http2Linger, m_options.closeTimeout);
         }
 
         template<typename... Ts>
@@ -57,45 +216,617 @@ namespace websocket { namespace details
             m_log << std::endl;
         }
 
+        static std::chrono::milliseconds TickInterval() { return std::chrono::milliseconds(100); }
+
+        // called by the I/O loop every tick, `lag` is how late the tick fired
+        void onTick(std::chrono::steady_clock::duration lag)
+        {
+            m_loopLag = lag;
+
+            // parked connections must not be touched, their sockets are going to another process
+            if (m_isHandingOff)
+                return;
+
+            m_timers.advance([this](const Timer& timer)
+            {
+                if (timer.kind == TimerKind::SessionExpiry)
+                    return onSessionExpiry(timer);
+
+                if (timer.kind == TimerKind::Http2Linger)
+                    return onHttp2Linger(timer);
+
+                auto conn = m_connTable.find(timer.connId);
+                if (!conn || conn->m_isClosed || conn->m_generation != timer.generation)
+                    return;
+
+                switch (timer.kind)
+                {
+                case TimerKind::Keepalive: onKeepalive(*conn); break;
+                case TimerKind::Linger: drop(*conn); break;
+                case TimerKind::ReadThrottle: conn->endReadThrottle(); break;
+                case TimerKind::SendThrottle: conn->endSendThrottle(); break;
+                default: break;
+                }
+            });
+        }
+
+        void onQueued(std::size_t bytes) { m_queuedBytes += bytes; }
+        void onDequeued(std::size_t bytes) { m_queuedBytes -= bytes; }
+
+        // producer backpressure, the send queue of a connection went over the high-water mark
+        // and is now down to the low-water mark
+        bool isOverHighWater(std::size_t queuedBytes) const
+        {
+            return m_options.sendHighWaterMark && queuedBytes >= m_options.sendHighWaterMark;
+        }
+
+        bool isDrained(std::size_t queuedBytes) const { return queuedBytes <= m_options.sendLowWaterMark; }
+        void onDrained(conn_t& conn) { onDrained(conn.m_id); }
+        void onDrained(ConnectionId connId) { m_callback(EventRecord{Event::Drained, connId}); }
+
         void onAccept(boost::asio::ip::tcp::socket& clientSocket, boost::asio::yield_context& yield)
         {
-            if (performHandshake(clientSocket, yield))
+            // without probe paths the limits come first, a shed connection costs no reads
+            auto hasProbes = !m_options.healthPath.empty() || !m_options.metricsPath.empty();
+            if (!hasProbes && !admitGlobal(clientSocket, yield))
+                return;
+
+            boost::system::error_code ec;
+            auto remoteEndpoint = clientSocket.remote_endpoint(ec);
+            if (ec)
             {
-                auto& conn = m_connTable.add(std::move(clientSocket), *this);
-                m_callback(Event::NewConnection, conn.m_id, "");
+                log("accept error: ", ec);
+                return;
+            }
+
+            boost::asio::streambuf buf;
+            if (m_options.proxyProtocol && !readProxyHeader(clientSocket, buf, remoteEndpoint, yield))
+                return;
+
+            // health checks and scrapes skip the limits and the shedding: a load balancer probes
+            // from a few addresses and must not see a busy node as dead
+            if (hasProbes)
+            {
+                bool isProbe;
+                if (!readProbe(clientSocket, buf, isProbe, yield))
+                    return;
+
+                if (isProbe)
+                {
+                    SessionOffer offer;
+                    performHandshake(clientSocket, buf, offer, yield);
+                    return;
+                }
+
+                if (!admitGlobal(clientSocket, yield))
+                    return;
+            }
+
+            auto clientAddress = remoteEndpoint.address();
+            if (!m_admission.admit(clientAddress, AdmissionControl::clock_t::now()))
+            {
+                reject(clientSocket, m_options.rejectAction, yield);
+                return;
+            }
+
+            if (m_options.http2)
+            {
+                bool isHttp2;
+                if (!readPreface(clientSocket, buf, isHttp2, yield))
+                {
+                    m_admission.release(clientAddress);
+                    return;
+                }
+
+                if (isHttp2)
+                    return startHttp2(std::move(clientSocket), remoteEndpoint, buf);
+            }
+
+            SessionOffer offer;
+            if (performHandshake(clientSocket, buf, offer, yield))
+            {
+                // the server stopped during the handshake
+                if (m_isStopped)
+                    return;
+
+                if (offer.resumed)
+                    return resumeSession(std::move(clientSocket), remoteEndpoint, *offer.resumed, offer.lastSeq);
+
+                auto& conn = m_connTable.add(std::move(clientSocket), remoteEndpoint, *this);
+                if (!offer.token.empty())
+                    m_sessions.create(conn.m_id, std::move(offer.token), m_options.sessionReplaySize);
+
+                m_callback(EventRecord{Event::NewConnection, conn.m_id});
+
+                if (m_options.pingInterval.count())
+                    scheduleTimer(conn, TimerKind::Keepalive, m_options.pingInterval);
+            }
+            else
+            {
+                if (offer.resumed)
+                    detachSession(offer.resumed->connId);
+
+                m_admission.release(clientAddress);
             }
         }
 
         conn_t* find(ConnectionId id) { return m_connTable.find(id); }
 
+        ServerStats stats() const
+        {
+            ServerStats stats;
+            stats.connections = m_connTable.size() + m_http2Streams.size();
+            stats.http2Connections = m_http2Connections.size();
+            stats.queuedBytes = m_queuedBytes;
+            stats.loopLagSeconds = std::chrono::duration<double>(m_loopLag).count();
+            stats.rejected = m_rejectedCount;
+            stats.handshakeErrors = m_handshakeErrorCount;
+            stats.rtt = m_rtt;
+            return stats;
+        }
+
+        // the application sends a message, a session keeps it for replay
+        void send(ConnectionId connId, Opcode opcode, std::string message)
+        {
+            if (auto session = m_sessions.find(connId))
+            {
+                if (!session->isAttached)
+                {
+                    session->ring.push(opcode, std::move(message));
+                    return;
+                }
+
+                session->ring.push(opcode, message);
+            }
+
+            if (auto conn = m_connTable.find(connId))
+                conn->sendFrame(opcode, std::move(message));
+            else if (auto h2conn = findStream(connId))
+                h2conn->sendFrame(connId, opcode, std::move(message));
+        }
+
+        // the frame is built once and written to every subscriber from the same memory,
+        // the journal segment when there is one
+        void broadcast(Opcode opcode, std::string message)
+        {
+            ServerFrame frame{opcode, std::move(message)};
+
+            std::shared_ptr<const void> owner;
+            const char* bytes = nullptr;
+            if (m_journal)
+            {
+                // a message the journal can't take (too long, no disk space) is still sent
+                try
+                {
+                    auto appended = m_journal->append(frame);
+                    owner = std::move(appended.segment);
+                    bytes = appended.bytes;
+                }
+                catch (std::exception& e)
+                {
+                    log("journal: ", e.what(), ", the message is sent without it");
+                }
+            }
+
+            if (!bytes)
+            {
+                auto framed = std::make_shared<std::string>(reinterpret_cast<const char*>(frame.m_header), frame.m_headerLen);
+                *framed += frame.m_data;
+                bytes = framed->data();
+                owner = std::move(framed);
+            }
+
+            m_connTable.forEach([&](conn_t& conn)
+            {
+                if (conn.m_isSubscribed)
+                    conn.sendShared(owner, bytes, frame.size());
+            });
+        }
+
+        // the journal from `fromOffset` goes first, then the new broadcasts
+        void subscribe(ConnectionId connId, std::uint64_t fromOffset)
+        {
+            auto conn = m_connTable.find(connId);
+            if (!conn || !conn->isOpen() || conn->m_isSubscribed)
+                return;
+
+            if (m_journal)
+            {
+                // a shaped connection gets the replay in pieces, each waits for its tokens
+                auto maxPiece = replayPieceSize(*conn);
+                m_journal->read(fromOffset, [&](std::shared_ptr<const Journal::Segment> segment, const char* bytes, std::size_t size)
+                {
+                    for (std::size_t pos = 0; pos < size; pos += maxPiece)
+                        conn->sendShared(segment, bytes + pos, std::min(maxPiece, size - pos));
+                });
+            }
+
+            conn->m_isSubscribed = true;
+        }
+
+        // the application drops a connection, a session waiting for the client ends right away
+        void close(ConnectionId connId)
+        {
+            if (auto conn = m_connTable.find(connId))
+            {
+                conn->startClose(CloseCode::Normal);
+                return;
+            }
+
+            if (auto h2conn = findStream(connId))
+            {
+                h2conn->startClose(connId, CloseCode::Normal);
+                return;
+            }
+
+            auto session = m_sessions.find(connId);
+            if (session && !session->isAttached)
+            {
+                m_sessions.erase(connId);
+                m_callback(EventRecord{Event::Disconnect, connId});
+            }
+        }
+
+        void pauseReading(ConnectionId connId)
+        {
+            if (auto conn = m_connTable.find(connId))
+                conn->pauseReading();
+        }
+
+        void resumeReading(ConnectionId connId)
+        {
+            if (auto conn = m_connTable.find(connId))
+                conn->resumeReading();
+        }
+
+        void setSendClass(ConnectionId connId, unsigned sendClass)
+        {
+            if (auto conn = m_connTable.find(connId))
+                conn->m_sendClass = sendClass;
+        }
+
         void stop()
         {
+            m_isStopped = true;
             m_connTable.closeAll();
+            for (auto&& pair : m_http2Connections)
+                pair.second->close();
+        }
+
+        // handoff to a new process: freeze all open connections
+        void parkAll()
+        {
+            m_isHandingOff = true;
+            m_connTable.forEach([](conn_t& conn)
+            {
+                if (conn.isOpen())
+                    conn.park();
+            });
+        }
+
+        bool isParked()
+        {
+            auto parked = true;
+            m_connTable.forEach([&](conn_t& conn)
+            {
+                if (conn.isOpen() && !conn.isParked())
+                    parked = false;
+            });
+            return parked;
+        }
+
+        // the exported connections are detached, their sockets stay open in the new process
+        void exportState(HandoffState& state)
+        {
+            state.lastConnId = m_connTable.lastConnId();
+            m_connTable.forEach([&](conn_t& conn)
+            {
+                if (!conn.isOpen())
+                    return;
+
+                state.connections.push_back(conn.exportState());
+            });
         }
 
+        void detachExported()
+        {
+            m_connTable.forEach([](conn_t& conn)
+            {
+                if (conn.isOpen())
+                    conn.detach();
+            });
+        }
+
+        void resume(boost::asio::ip::tcp::socket&& socket, const HandoffConnection& state)
+        {
+            auto& conn = m_connTable.resume(std::move(socket), state, *this);
+            m_callback(EventRecord{Event::NewConnection, conn.m_id});
+
+            if (m_options.pingInterval.count())
+                scheduleTimer(conn, TimerKind::Keepalive, m_options.pingInterval);
+        }
+
+        void setLastConnId(ConnectionId connId) { m_connTable.setLastConnId(connId); }
+
     private:
         void operator=(const ServerLogic&) = delete;
 
-        bool performHandshake(boost::asio::ip::tcp::socket& socket, boost::asio::yield_context& yield)
+        enum class TimerKind : std::uint8_t { Keepalive, Linger, SessionExpiry, ReadThrottle, SendThrottle, Http2Linger };
+
+        struct Timer
         {
+            ConnectionId connId; // or the id of an HTTP/2 connection
+            std::uint32_t generation; // of the connection or the session, stale timers are ignored
+            TimerKind kind;
+        };
+
+        void scheduleTimer(conn_t& conn, TimerKind kind, std::chrono::steady_clock::duration delay)
+        {
+            scheduleTimer(conn.m_id, conn.m_generation, kind, delay);
+        }
+
+        void scheduleTimer(ConnectionId connId, std::uint32_t generation, TimerKind kind, std::chrono::steady_clock::duration delay)
+        {
+            auto ticks = delay / TickInterval();
+            m_timers.schedule(static_cast<std::size_t>(ticks), Timer{connId, generation, kind});
+        }
+
+        // the bucket size of the send class, but not so small that the send queue gets a piece
+        // for every few bytes
+        std::size_t replayPieceSize(const conn_t& conn) const
+        {
+            const std::size_t minPiece = 16 * 1024;
+
+            if (conn.m_sendClass >= m_options.sendRates.size() || m_options.sendRates[conn.m_sendClass].rate <= 0)
+                return std::numeric_limits<std::size_t>::max();
+
+            return std::max(minPiece, static_cast<std::size_t>(TokenBucket::capacity(m_options.sendRates[conn.m_sendClass])));
+        }
+
+        // the handshake decides about the session before the reply is written
+        struct SessionOffer
+        {
+            std::string token;          // of a new session
+            Session* resumed{nullptr};  // claimed, no one else can resume or expire it
+            std::uint64_t lastSeq{0};
+        };
+
+        // `X-WebSocket-Session` carries the token both ways, a reconnecting client adds
+        // `X-WebSocket-Last-Seq`, the number of messages it has got; a client that gets
+        // another token back has a new session
+        std::string offerSession(const http::Request& rq, SessionOffer& offer)
+        {
+            if (!m_options.sessionReplaySize)
+                return{};
+
+            auto session = rq.sessionToken.empty() ? nullptr : m_sessions.findByToken(rq.sessionToken);
+            if (session && !session->isAttached && session->ring.canReplayFrom(rq.lastSeq) && !m_connTable.find(session->connId))
+            {
+                session->isAttached = true;
+                offer.resumed = session;
+                offer.lastSeq = rq.lastSeq;
+                return "X-WebSocket-Session: " + session->token + "\r\n";
+            }
+
+            offer.token = makeSessionToken();
+            return "X-WebSocket-Session: " + offer.token + "\r\n";
+        }
+
+        void resumeSession(boost::asio::ip::tcp::socket&& socket, const boost::asio::ip::tcp::endpoint& remoteEndpoint,
+            Session& session, std::uint64_t lastSeq)
+        {
+            ++session.generation;
+            auto& conn = m_connTable.add(std::move(socket), remoteEndpoint, *this, session.connId);
+            conn.m_generation = session.generation;
+
+            log("#", conn.m_id, ": session resumed, replaying ", session.ring.lastSeq() - lastSeq, " messages");
+            session.ring.replay(lastSeq, [&](Opcode opcode, const std::string& data) { conn.sendFrame(opcode, data); });
+
+            if (m_options.pingInterval.count())
+                scheduleTimer(conn, TimerKind::Keepalive, m_options.pingInterval);
+        }
+
+        // the connection is lost, the session waits `sessionTimeout` for the client
+        bool detachSession(ConnectionId connId)
+        {
+            auto session = m_sessions.find(connId);
+            if (!session)
+                return false;
+
+            session->isAttached = false;
+            scheduleTimer(connId, session->generation, TimerKind::SessionExpiry, m_options.sessionTimeout);
+            return true;
+        }
+
+        void onSessionExpiry(const Timer& timer)
+        {
+            auto session = m_sessions.find(timer.connId);
+            if (!session || session->isAttached || session->generation != timer.generation)
+                return;
+
+            m_sessions.erase(timer.connId);
+            m_callback(EventRecord{Event::Disconnect, timer.connId});
+        }
+
+        // HTTP/2 connection ids aren't reused, a connection that is gone has no entry
+        void onHttp2Linger(const Timer& timer)
+        {
+            auto iter = m_http2Connections.find(timer.connId);
+            if (iter != m_http2Connections.end())
+                dropHttp2(*iter->second);
+        }
+
+        // ping payload is the send time, so the pong tells the round trip time without any lookups
+        static std::uint64_t timestampNow()
+        {
+            auto now = std::chrono::steady_clock::now().time_since_epoch();
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+        }
+
+        static std::string encodeTimestamp(std::uint64_t timestamp)
+        {
+            std::string payload(8, '\0');
+            for (auto i = 7; i >= 0; --i, timestamp >>= 8)
+                payload[i] = static_cast<char>(timestamp & 0xFF);
+
+            return payload;
+        }
+
+        void onKeepalive(conn_t& conn)
+        {
+            if (!conn.isOpen())
+                return;
+
+            if (conn.m_pingTimestamp && ++conn.m_missedPongs >= m_options.maxMissedPongs)
+            {
+                log("#", conn.m_id, ": keepalive timeout");
+                drop(conn);
+                return;
+            }
+
+            conn.m_pingTimestamp = timestampNow();
+            conn.sendFrame(Opcode::Ping, encodeTimestamp(conn.m_pingTimestamp));
+            scheduleTimer(conn, TimerKind::Keepalive, m_options.pingInterval);
+        }
+
+        // The PROXY header is parsed in place in the receive buffer, the request bytes
+        // that come with it stay in the buffer, so it takes no extra reads.
+        bool readProxyHeader(boost::asio::ip::tcp::socket& socket, boost::asio::streambuf& buf,
+            boost::asio::ip::tcp::endpoint& remoteEndpoint, boost::asio::yield_context& yield)
+        {
+            for (;;)
+            {
+                ProxyHeader header;
+                auto result = parseProxyHeader(boost::asio::buffer_cast<const char*>(buf.data()), buf.size(), header);
+                if (result == ProxyParseResult::Complete)
+                {
+                    if (!header.isLocal)
+                        remoteEndpoint = header.source;
+
+                    buf.consume(header.length);
+                    return true;
+                }
+
+                if (result == ProxyParseResult::Invalid)
+                {
+                    log("Handshake: invalid PROXY header from ", remoteEndpoint);
+                    return false;
+                }
+
+                if (!readSome(socket, buf, yield))
+                    return false;
+            }
+        }
+
+        // a client with prior knowledge starts with the HTTP/2 preface, a request line
+        // differs from it right away
+        bool readPreface(boost::asio::ip::tcp::socket& socket, boost::asio::streambuf& buf, bool& isHttp2, boost::asio::yield_context& yield)
+        {
+            for (;;)
+            {
+                auto data = boost::asio::buffer_cast<const char*>(buf.data());
+                auto size = std::min(buf.size(), http2::PrefaceSize);
+                if (std::memcmp(data, http2::Preface, size) != 0)
+                {
+                    isHttp2 = false;
+                    return true;
+                }
+
+                if (size == http2::PrefaceSize)
+                {
+                    isHttp2 = true;
+                    return true;
+                }
+
+                if (!readSome(socket, buf, yield))
+                    return false;
+            }
+        }
+
+        void startHttp2(boost::asio::ip::tcp::socket&& socket, const boost::asio::ip::tcp::endpoint& remoteEndpoint, boost::asio::streambuf& buf)
+        {
+            if (m_isStopped)
+                return;
+
+            buf.consume(http2::PrefaceSize);
+            std::string received{boost::asio::buffer_cast<const char*>(buf.data()), buf.size()};
+
+            std::unique_ptr<h2conn_t> conn{new h2conn_t{++m_lastHttp2Id, std::move(socket), remoteEndpoint, std::move(received), *this}};
+            auto&& h2conn = *conn;
+            m_http2Connections.emplace(h2conn.m_id, std::move(conn));
+            h2conn.start();
+        }
+
+        h2conn_t* findStream(ConnectionId connId)
+        {
+            auto iter = m_http2Streams.find(connId);
+            return iter == m_http2Streams.end() ? nullptr : iter->second;
+        }
+
+        bool readRequest(boost::asio::ip::tcp::socket& socket, boost::asio::streambuf& buf, boost::asio::yield_context& yield)
+        {
+            const char EndOfHeaders[] = "\r\n\r\n";
+            std::size_t searchStart = 0;
+
+            for (;;)
+            {
+                auto data = boost::asio::buffer_cast<const char*>(buf.data());
+                auto end = data + buf.size();
+                if (std::search(data + searchStart, end, EndOfHeaders, EndOfHeaders + 4) != end)
+                    return true;
+
+                searchStart = buf.size() < 3 ? 0 : buf.size() - 3;
+
+                if (!readSome(socket, buf, yield))
+                    return false;
+            }
+        }
+
+        bool readSome(boost::asio::ip::tcp::socket& socket, boost::asio::streambuf& buf, boost::asio::yield_context& yield)
+        {
+            const std::size_t ReadChunkSize = 512;
+
             boost::system::error_code ec;
-            boost::asio::streambuf buf;
-            boost::asio::async_read_until(socket, buf, "\r\n\r\n", yield[ec]);
+            auto n = socket.async_read_some(buf.prepare(ReadChunkSize), yield[ec]);
             if (ec)
             {
                 log("Handshake: read error: ", ec);
                 return false;
             }
 
+            buf.commit(n);
+            return true;
+        }
+
+        bool performHandshake(boost::asio::ip::tcp::socket& socket, boost::asio::streambuf& buf, SessionOffer& offer, boost::asio::yield_context& yield)
+        {
+            if (!readRequest(socket, buf, yield))
+                return false;
+
             std::istream requestStream(&buf);
+            http::Request rq;
+            auto status = processHandshakeRequest(requestStream, rq);
+
+            // health checks and scrapes are plain GETs, they are not handshake errors
+            if (status != http::Status::OK && rq.method == http::Method::GET && rq.upgrade.empty())
+            {
+                if (!m_options.healthPath.empty() && rq.requestPath == m_options.healthPath)
+                    return replyPlain(socket, m_healthReply, yield);
+
+                if (!m_options.metricsPath.empty() && rq.requestPath == m_options.metricsPath)
+                    return replyPlain(socket, makePlainReply("text/plain; version=0.0.4", renderPrometheus(stats())), yield);
+            }
+
             std::ostringstream replyStream;
-            auto status = handshake(requestStream, replyStream);
+            writeHandshakeReply(replyStream, rq, status, status == http::Status::OK ? offerSession(rq, offer) : std::string{});
 
+            boost::system::error_code ec;
             boost::asio::async_write(socket, boost::asio::buffer(replyStream.str()), yield[ec]);
 
             if (status != http::Status::OK)
             {
                 log("Handshake: error ", (int)status);
+                ++m_handshakeErrorCount;
                 return false;
             }
 
@@ -108,8 +839,179 @@ namespace websocket { namespace details
             return true;
         }
 
+        // false - there is no WebSocket connection after the reply
+        bool replyPlain(boost::asio::ip::tcp::socket& socket, const std::string& reply, boost::asio::yield_context& yield)
+        {
+            boost::system::error_code ignoreError;
+            boost::asio::async_write(socket, boost::asio::buffer(reply), yield[ignoreError]);
+            socket.shutdown(boost::asio::socket_base::shutdown_both, ignoreError);
+            return false;
+        }
+
+        // routing comes before any decoding, only the prefix up to the key is scanned
+        std::uint8_t findRoute(const std::string& message) const
+        {
+            if (m_options.routeKey.empty())
+                return 0;
+
+            const char* value;
+            std::size_t size;
+            if (!json::findStringMember(message.data(), message.size(), m_options.routeKey, value, size))
+                return 0;
+
+            auto&& values = m_options.routeValues;
+            for (std::size_t i = 0; i != values.size() && i != 255; ++i)
+            {
+                if (values[i].size() == size && std::memcmp(values[i].data(), value, size) == 0)
+                    return static_cast<std::uint8_t>(i + 1);
+            }
+
+            return 0;
+        }
+
+        bool pushMessage(ConnectionId id, std::string message, bool isBinary, std::chrono::steady_clock::time_point receivedAt,
+            std::uint8_t route, std::false_type)
+        {
+            m_callback(EventRecord{Event::Message, id, std::move(message), isBinary, receivedAt, route});
+            return true;
+        }
+
+        // the objects can't go through the shared memory, the text goes there
+        bool pushMessage(ConnectionId id, std::string message, bool isBinary, std::chrono::steady_clock::time_point receivedAt,
+            std::uint8_t route, std::true_type)
+        {
+            using decoder_t = typename Traits::Decoder;
+
+            if (!m_options.sharedMemory.empty())
+                return pushMessage(id, std::move(message), isBinary, receivedAt, route, std::false_type{});
+
+            auto object = std::make_shared<typename decoder_t::Type>();
+            if (!decoder_t::decode(message, isBinary, *object))
+            {
+                log("#", id, ": message rejected by the decoder");
+                return false;
+            }
+
+            m_callback(EventRecord::fromDecoded(id, std::move(object), isBinary, receivedAt, route));
+            return true;
+        }
+
+        bool isOverloaded() const
+        {
+            if (m_options.maxQueuedBytes && m_queuedBytes > m_options.maxQueuedBytes)
+                return true;
+
+            if (m_options.maxLoopLag.count() && m_loopLag > m_options.maxLoopLag)
+                return true;
+
+            return false;
+        }
+
+        // overload shedding and the global limits; false - the connection is rejected
+        bool admitGlobal(boost::asio::ip::tcp::socket& clientSocket, boost::asio::yield_context& yield)
+        {
+            if (isOverloaded())
+            {
+                reject(clientSocket, RejectAction::ServiceUnavailable, yield);
+                return false;
+            }
+
+            if (!m_admission.admitGlobal(m_connTable.size() + m_http2Connections.size(), AdmissionControl::clock_t::now()))
+            {
+                reject(clientSocket, m_options.rejectAction, yield);
+                return false;
+            }
+
+            return true;
+        }
+
+        // a probe is a GET of `healthPath` or `metricsPath` without Upgrade, its headers are read
+        // whole; anything else is only read up to the end of the request line
+        bool readProbe(boost::asio::ip::tcp::socket& socket, boost::asio::streambuf& buf, bool& isProbe, boost::asio::yield_context& yield)
+        {
+            const std::size_t MaxRequestLine = 1024;
+
+            isProbe = false;
+            std::string received;
+            for (;;)
+            {
+                received.assign(boost::asio::buffer_cast<const char*>(buf.data()), buf.size());
+                auto lineEnd = received.find("\r\n");
+                if (lineEnd != std::string::npos)
+                {
+                    auto line = received.substr(0, lineEnd);
+                    if (!isProbePath(line, m_options.healthPath) && !isProbePath(line, m_options.metricsPath))
+                        return true;
+
+                    break;
+                }
+
+                if (received.size() >= MaxRequestLine)
+                    return true;
+
+                if (!readSome(socket, buf, yield))
+                    return false;
+            }
+
+            if (!readRequest(socket, buf, yield))
+                return false;
+
+            received.assign(boost::asio::buffer_cast<const char*>(buf.data()), buf.size());
+            std::transform(received.begin(), received.end(), received.begin(), [](char c) { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); });
+            isProbe = received.find("\nupgrade:") == std::string::npos;
+            return true;
+        }
+
+        static bool isProbePath(const std::string& requestLine, const std::string& path)
+        {
+            if (path.empty())
+                return false;
+
+            auto prefix = "GET " + path;
+            return requestLine.size() > prefix.size() && requestLine.compare(0, prefix.size(), prefix) == 0
+                && (requestLine[prefix.size()] == ' ' || requestLine[prefix.size()] == '?');
+        }
+
+        // fast path, no request parsing and no logging: under attack the log would be flooded
+        void reject(boost::asio::ip::tcp::socket& socket, RejectAction action, boost::asio::yield_context& yield)
+        {
+            boost::system::error_code ignoreError;
+            ++m_rejectedCount;
+
+            if (action == RejectAction::Reset)
+            {
+                socket.set_option(boost::asio::socket_base::linger{true, 0}, ignoreError);
+            }
+            else
+            {
+                boost::asio::async_write(socket, boost::asio::buffer(m_overloadReply), yield[ignoreError]);
+                socket.shutdown(boost::asio::socket_base::shutdown_both, ignoreError);
+            }
+
+            socket.close(ignoreError);
+        }
+
         std::ostream& m_log;
-        std::function<void(Event, ConnectionId, std::string)> m_callback;
-        ConnectionTable<ServerLogic> m_connTable;
+        ServerOptions m_options;
+        AdmissionControl m_admission;
+        std::function<void(EventRecord)> m_callback;
+        const std::string m_overloadReply;
+        const std::string m_healthReply;
+        std::size_t m_queuedBytes{0};
+        std::uint64_t m_rejectedCount{0};
+        std::uint64_t m_handshakeErrorCount{0};
+        std::chrono::steady_clock::duration m_loopLag{};
+
+        TimerWheel<Timer> m_timers;
+        bool m_isHandingOff{false};
+        bool m_isStopped{false};
+        Histogram m_rtt; // microseconds, all connections
+
+        ConnectionTable<ServerLogic, Traits> m_connTable;
+        std::unordered_map<std::uint64_t, std::unique_ptr<h2conn_t>> m_http2Connections;
+        std::uint64_t m_lastHttp2Id{0};
+        std::unordered_map<ConnectionId, h2conn_t*> m_http2Streams; // the open streams
+        SessionTable m_sessions;
+        std::unique_ptr<Journal> m_journal;
     };
 }}
\ No newline at end of file
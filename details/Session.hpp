@@ -0,0 +1,140 @@
+// Websocket Server implementation
+// Belongs to the public domain
+
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "server_fwd.hpp"
+#include "frames.hpp"
+
+namespace websocket { namespace details
+{
+    // Messages sent to a session are numbered from 1, the ring keeps the last `capacity` of them.
+    class ReplayRing
+    {
+    public:
+        explicit ReplayRing(std::size_t capacity)
+            : m_messages(capacity)
+        {
+            assert(capacity > 0);
+        }
+
+        std::uint64_t push(Opcode opcode, std::string data)
+        {
+            auto&& message = m_messages[m_lastSeq % m_messages.size()];
+            message.opcode = opcode;
+            message.data = std::move(data);
+            return ++m_lastSeq;
+        }
+
+        std::uint64_t lastSeq() const { return m_lastSeq; }
+
+        // the client has seen everything up to `lastSeen`, is the rest still here
+        bool canReplayFrom(std::uint64_t lastSeen) const
+        {
+            return lastSeen <= m_lastSeq && m_lastSeq - lastSeen <= m_messages.size();
+        }
+
+        // calls `f(opcode, data)` for the messages after `lastSeen`
+        template<typename F>
+        void replay(std::uint64_t lastSeen, F&& f) const
+        {
+            assert(canReplayFrom(lastSeen));
+            for (auto seq = lastSeen; seq != m_lastSeq; ++seq)
+            {
+                auto&& message = m_messages[seq % m_messages.size()];
+                f(message.opcode, message.data);
+            }
+        }
+
+    private:
+        struct Message
+        {
+            Opcode opcode;
+            std::string data;
+        };
+
+        std::vector<Message> m_messages;
+        std::uint64_t m_lastSeq{0};
+    };
+
+    struct Session
+    {
+        Session(ConnectionId connId, std::string token, std::size_t replaySize)
+            : connId{connId}
+            , token{std::move(token)}
+            , ring{replaySize}
+        {}
+
+        ConnectionId connId;
+        std::string token;
+        ReplayRing ring;
+        bool isAttached{true};     // has a connection, or one is being resumed
+        std::uint32_t generation{0}; // incremented on every resumption
+    };
+
+    // 128 random bits, hex
+    inline std::string makeSessionToken()
+    {
+        static const char Hex[] = "0123456789abcdef";
+        std::random_device random;
+
+        std::string token;
+        for (auto i = 0; i != 4; ++i)
+        {
+            auto value = static_cast<std::uint32_t>(random());
+            for (auto j = 0; j != 8; ++j, value >>= 4)
+                token += Hex[value & 0xF];
+        }
+
+        return token;
+    }
+
+    class SessionTable
+    {
+    public:
+        Session& create(ConnectionId connId, std::string token, std::size_t replaySize)
+        {
+            m_tokens[token] = connId;
+            auto&& pair = m_sessions.emplace(std::piecewise_construct,
+                std::forward_as_tuple(connId), std::forward_as_tuple(connId, std::move(token), replaySize));
+            return pair.first->second;
+        }
+
+        Session* find(ConnectionId connId)
+        {
+            auto iter = m_sessions.find(connId);
+            return iter == m_sessions.end() ? nullptr : &iter->second;
+        }
+
+        Session* findByToken(const std::string& token)
+        {
+            auto iter = m_tokens.find(token);
+            return iter == m_tokens.end() ? nullptr : find(iter->second);
+        }
+
+        void erase(ConnectionId connId)
+        {
+            auto iter = m_sessions.find(connId);
+            if (iter == m_sessions.end())
+                return;
+
+            m_tokens.erase(iter->second.token);
+            m_sessions.erase(iter);
+        }
+
+        std::size_t size() const { return m_sessions.size(); }
+
+    private:
+        std::unordered_map<ConnectionId, Session> m_sessions;
+        std::unordered_map<std::string, ConnectionId> m_tokens;
+    };
+}}
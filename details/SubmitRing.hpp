@@ -0,0 +1,111 @@
+// Websocket Server implementation
+// Belongs to the public domain
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+
+namespace websocket { namespace details
+{
+    // Bounded multi-producer, single consumer ring: any application thread pushes, the I/O
+    // thread pops. Each cell has a sequence number that tells whose turn it is, a producer
+    // claims a cell with one CAS on the tail and no lock is shared between the producers.
+    // The size is rounded up to a power of two.
+    template<typename T>
+    class SubmitRing
+    {
+    public:
+        explicit SubmitRing(std::size_t size)
+            : m_mask(roundUpPow2(size) - 1)
+            , m_cells(new Cell[m_mask + 1])
+        {
+            for (std::size_t i = 0; i <= m_mask; ++i)
+                m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        // false - the ring is full
+        bool tryPush(T& value)
+        {
+            auto pos = m_tail.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                auto&& cell = m_cells[pos & m_mask];
+                auto seq = cell.sequence.load(std::memory_order_acquire);
+                auto diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+                if (diff == 0)
+                {
+                    if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        cell.value = std::move(value);
+                        cell.sequence.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (diff < 0)
+                {
+                    return false;
+                }
+                else
+                {
+                    pos = m_tail.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // waits for the consumer while the ring is full; false - `isStopped` is set, the consumer
+        // won't come and the value is dropped
+        bool push(T value, const std::atomic<bool>& isStopped)
+        {
+            while (!tryPush(value))
+            {
+                if (isStopped.load(std::memory_order_acquire))
+                    return false;
+
+                std::this_thread::yield();
+            }
+
+            return true;
+        }
+
+        // the consumer only
+        bool tryPop(T& value)
+        {
+            auto&& cell = m_cells[m_head & m_mask];
+            if (cell.sequence.load(std::memory_order_acquire) != m_head + 1)
+                return false;
+
+            value = std::move(cell.value);
+            cell.value = T{};
+            cell.sequence.store(m_head + m_mask + 1, std::memory_order_release);
+            ++m_head;
+            return true;
+        }
+
+    private:
+        struct Cell
+        {
+            std::atomic<std::size_t> sequence;
+            T value;
+        };
+
+        static std::size_t roundUpPow2(std::size_t n)
+        {
+            std::size_t size = 2;
+            while (size < n)
+                size <<= 1;
+
+            return size;
+        }
+
+        const std::size_t m_mask;
+        std::unique_ptr<Cell[]> m_cells;
+        std::atomic<std::size_t> m_tail{0};
+        char m_padding[64]; // the producers and the consumer don't share a cache line
+        std::size_t m_head{0}; // the consumer's
+    };
+}}
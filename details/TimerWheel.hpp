@@ -0,0 +1,80 @@
+// Websocket Server implementation
+// Belongs to the public domain
+
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+namespace websocket { namespace details
+{
+    // Hashed timing wheel with one slot per tick. Timers can't be cancelled: the owner
+    // checks on expiry whether the timer is still wanted. That keeps scheduling O(1),
+    // and once the slots have grown to their working size nothing is allocated.
+    template<typename T>
+    class TimerWheel
+    {
+    public:
+        explicit TimerWheel(std::size_t slotCount = 512)
+            : m_slots(slotCount)
+        {
+            assert(slotCount > 0);
+        }
+
+        // fires after `ticks` calls of advance(), at least one
+        void schedule(std::size_t ticks, T value)
+        {
+            if (ticks == 0)
+                ticks = 1;
+
+            auto slot = (m_current + ticks) % m_slots.size();
+            m_slots[slot].push_back({(ticks - 1) / m_slots.size(), std::move(value)});
+        }
+
+        // moves one tick forward, calls `f(value)` for every expired timer, `f` may schedule new ones
+        template<typename F>
+        void advance(F&& f)
+        {
+            m_current = (m_current + 1) % m_slots.size();
+
+            auto& slot = m_slots[m_current];
+            m_expiring.swap(slot);
+
+            for (auto&& timer : m_expiring)
+            {
+                if (timer.rounds == 0)
+                {
+                    f(timer.value);
+                }
+                else
+                {
+                    --timer.rounds;
+                    slot.push_back(std::move(timer));
+                }
+            }
+
+            m_expiring.clear();
+        }
+
+        std::size_t size() const
+        {
+            std::size_t n = 0;
+            for (auto&& slot : m_slots)
+                n += slot.size();
+
+            return n;
+        }
+
+    private:
+        struct Timer
+        {
+            std::size_t rounds;
+            T value;
+        };
+
+        std::vector<std::vector<Timer>> m_slots;
+        std::vector<Timer> m_expiring;
+        std::size_t m_current{0};
+    };
+}}
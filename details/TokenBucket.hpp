@@ -0,0 +1,79 @@
+// Websocket Server implementation
+// Belongs to the public domain
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+
+#include "ServerOptions.hpp"
+
+namespace websocket { namespace details
+{
+    class TokenBucket
+    {
+    public:
+        using clock_t = std::chrono::steady_clock;
+
+        static double capacity(const RateLimit& limit)
+        {
+            return limit.burst > 0 ? limit.burst : limit.rate;
+        }
+
+        // starts full
+        void reset(const RateLimit& limit, clock_t::time_point now)
+        {
+            m_tokens = capacity(limit);
+            m_lastRefill = now;
+        }
+
+        bool tryTake(const RateLimit& limit, clock_t::time_point now, double cost = 1)
+        {
+            if (limit.rate <= 0)
+                return true;
+
+            refill(limit, now);
+            if (m_tokens < cost)
+                return false;
+
+            m_tokens -= cost;
+            return true;
+        }
+
+        // how long until `cost` tokens are there, zero - take() them now; a cost over the bucket
+        // size waits for the full bucket
+        clock_t::duration waitTime(const RateLimit& limit, clock_t::time_point now, double cost = 1)
+        {
+            if (limit.rate <= 0)
+                return clock_t::duration::zero();
+
+            refill(limit, now);
+            auto missing = std::min(cost, capacity(limit)) - m_tokens;
+            if (missing <= 0)
+                return clock_t::duration::zero();
+
+            return std::chrono::duration_cast<clock_t::duration>(std::chrono::duration<double>(missing / limit.rate));
+        }
+
+        // the full cost is charged: a cost over the bucket size leaves the bucket in debt,
+        // so the next cost waits until the rate has paid it off
+        void take(const RateLimit& limit, double cost = 1)
+        {
+            if (limit.rate > 0)
+                m_tokens -= cost;
+        }
+
+        clock_t::time_point lastRefill() const { return m_lastRefill; }
+
+    private:
+        void refill(const RateLimit& limit, clock_t::time_point now)
+        {
+            auto elapsed = std::chrono::duration<double>(now - m_lastRefill).count();
+            m_tokens = std::min(capacity(limit), m_tokens + elapsed * limit.rate);
+            m_lastRefill = now;
+        }
+
+        double m_tokens{0};
+        clock_t::time_point m_lastRefill;
+    };
+}}
@@ -5,8 +5,13 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
 #include <string>
 
+#include "ServerTraits.hpp"
+
 namespace websocket { namespace details
 {
     enum class Opcode
@@ -21,6 +26,62 @@ namespace websocket { namespace details
         ReservedB, ReservedC, ReservedD, ReservedE, ReservedF,
     };
 
+    // see RFC 6455 7.4.1 Defined Status Codes
+    enum class CloseCode : std::uint16_t
+    {
+        Normal = 1000,
+        GoingAway = 1001,
+        ProtocolError = 1002,
+        UnsupportedData = 1003,
+        InvalidPayload = 1007,
+        PolicyViolation = 1008,
+        MessageTooBig = 1009,
+        InternalError = 1011,
+    };
+
+    // codes that may appear in a Close frame, 1005, 1006 and 1015 are reserved for reporting
+    inline bool isValidCloseCode(std::uint16_t code)
+    {
+        if (code >= 3000 && code <= 4999)
+            return true;
+
+        return code >= 1000 && code <= 1014 && code != 1004 && code != 1005 && code != 1006;
+    }
+
+    // empty payload (no status code) or a valid status code followed by the reason
+    inline bool parseClosePayload(const std::string& payload, std::uint16_t& code)
+    {
+        if (payload.empty())
+        {
+            code = 0;
+            return true;
+        }
+
+        if (payload.size() < 2)
+            return false;
+
+        code = static_cast<std::uint16_t>((std::uint8_t(payload[0]) << 8) | std::uint8_t(payload[1]));
+        return isValidCloseCode(code);
+    }
+
+    inline std::string makeClosePayload(std::uint16_t code, const std::string& reason = {})
+    {
+        if (code == 0)
+            return{};
+
+        std::string payload;
+        payload.reserve(2 + reason.size());
+        payload.push_back(static_cast<char>(code >> 8));
+        payload.push_back(static_cast<char>(code & 0xFF));
+        payload += reason;
+        return payload;
+    }
+
+    inline std::string makeClosePayload(CloseCode code, const std::string& reason = {})
+    {
+        return makeClosePayload(static_cast<std::uint16_t>(code), reason);
+    }
+
     struct ServerFrame
     {
         ServerFrame(Opcode opcode, std::string data)
@@ -30,10 +91,40 @@ namespace websocket { namespace details
             writeLen();
         }
 
+        // bytes that are already framed, e.g. the rest of a frame handed over by another process
+        static ServerFrame raw(std::string bytes)
+        {
+            ServerFrame frame{Opcode::Continuation, std::move(bytes)};
+            frame.m_headerLen = 0;
+            return frame;
+        }
+
+        // framed bytes owned by someone else, a journal segment or a broadcast shared by
+        // all connections, `owner` keeps them alive until they are written
+        static ServerFrame shared(std::shared_ptr<const void> owner, const char* bytes, std::size_t size)
+        {
+            ServerFrame frame{Opcode::Continuation, {}};
+            frame.m_headerLen = 0;
+            frame.m_owner = std::move(owner);
+            frame.m_view = bytes;
+            frame.m_viewSize = size;
+            return frame;
+        }
+
+        const char* data() const { return m_view ? m_view : m_data.data(); }
+        std::size_t dataSize() const { return m_view ? m_viewSize : m_data.size(); }
+
+        std::size_t size() const { return m_headerLen + dataSize(); }
+        Opcode opcode() const { return static_cast<Opcode>(m_header[0] & 0x0F); }
+
         std::uint8_t m_header[1 + 1 + 8];
         std::uint8_t m_headerLen;
         std::string m_data;
 
+        std::shared_ptr<const void> m_owner;
+        const char* m_view{nullptr};
+        std::size_t m_viewSize{0};
+
     private:
         void writeOpcode(Opcode op)
         {
@@ -78,17 +169,21 @@ namespace websocket { namespace details
         }
     };
 
-    class FrameReceiver
+    template<typename Traits>
+    class BasicFrameReceiver
     {
     public:
         static const auto MinHeaderLen = 1 + 1 + 4;
-        static const auto MaxPayloadLen = 125;
-        static const auto BufferSize = MinHeaderLen + MaxPayloadLen;
+        static const std::size_t MaxPayloadLen = Traits::MaxPayloadLen;
+        static const std::size_t MaxHeaderLen = MinHeaderLen + (MaxPayloadLen > 0xFFFF ? 8 : MaxPayloadLen > 125 ? 2 : 0);
+        static const std::size_t BufferSize = Traits::BufferSize;
 
-        FrameReceiver() {}
+        static_assert(BufferSize >= MaxHeaderLen + MaxPayloadLen, "the receive buffer must hold the longest frame");
 
-        void* getBufferTail() { return m_buffer; }
-        std::size_t getBufferTailSize() { return BufferSize; }
+        BasicFrameReceiver() {}
+
+        void* getBufferTail() { return m_buffer + m_dataLen; }
+        std::size_t getBufferTailSize() { return BufferSize - m_dataLen; }
 
         std::size_t needReceiveMore(std::size_t bytesWritten) const
         {
@@ -99,8 +194,12 @@ namespace websocket { namespace details
             if (available < 2)
                 return 1;
 
-            auto needBytes = frameLen() - available;
-            return needBytes > 0 ? std::size_t(needBytes) : 0;
+            std::size_t headerEnd = lengthEnd();
+            if (available < headerEnd)
+                return headerEnd - available;
+
+            auto len = frameLen();
+            return len > available ? len - available : 0;
         }
 
         void addBytes(std::size_t n)
@@ -117,8 +216,9 @@ namespace websocket { namespace details
         {
             if (bytesAvailable == 0)
                 return true;
-            
-            if (!isFinalFragment())
+
+            // control frames are never fragmented
+            if (!isFinalFragment() && (!Traits::Fragmentation || isControl()))
                 return false;
 
             if (bytesAvailable == 1)
@@ -127,6 +227,21 @@ namespace websocket { namespace details
             if (!isMasked())
                 return false;
 
+            // the extended lengths are rejected right away when they can't fit,
+            // a control frame payload is at most 125 bytes
+            auto code = lengthCode();
+            if (code > 125 && isControl())
+                return false;
+
+            if (code == 126 && MaxPayloadLen <= 125)
+                return false;
+
+            if (code == 127 && MaxPayloadLen <= 0xFFFF)
+                return false;
+
+            if (bytesAvailable < static_cast<std::size_t>(lengthEnd()))
+                return true;
+
             if (payloadLen() > MaxPayloadLen)
                 return false;
 
@@ -135,21 +250,48 @@ namespace websocket { namespace details
 
         bool isFinalFragment() const { return (m_buffer[0] & 0x80) != 0; }
         Opcode opcode() const { return static_cast<Opcode>(m_buffer[0] & 0x0F); }
+        bool isControl() const { return (m_buffer[0] & 0x08) != 0; }
         bool isMasked() const { return (m_buffer[1] & 0x80) != 0; }
-        int payloadLen() const { return m_buffer[1] & 0x7f; }
-        int payloadStart() const { return MinHeaderLen; }
-        int frameLen() const { return payloadStart() + payloadLen(); }
+
+        std::size_t payloadLen() const
+        {
+            auto code = lengthCode();
+            if (MaxPayloadLen <= 125 || code < 126)
+                return code;
+
+            std::uint64_t len = 0;
+            for (auto i = 2; i != lengthEnd(); ++i)
+                len = (len << 8) | static_cast<std::uint8_t>(m_buffer[i]);
+
+            return len > MaxPayloadLen ? MaxPayloadLen + 1 : static_cast<std::size_t>(len);
+        }
+
+        int payloadStart() const { return lengthEnd() + 4; }
+        std::size_t frameLen() const { return payloadStart() + payloadLen(); }
         std::string message() const { return{m_buffer + payloadStart(), payloadLen()}; }
 
         void unmask()
         {
             auto data = m_buffer + payloadStart();
             auto key = data - 4;
+            auto len = payloadLen();
 
-            for (auto i = 0; i != payloadLen(); ++i)
+            for (std::size_t i = 0; i != len; ++i)
                 data[i] ^= key[i % 4];
         }
 
+        // received bytes of the frame in progress
+        std::string bufferedBytes() const { return{m_buffer, m_dataLen}; }
+
+        void restore(const std::string& bytes)
+        {
+            if (bytes.size() > BufferSize)
+                throw std::length_error("websocket frame is too long");
+
+            std::memcpy(m_buffer, bytes.data(), bytes.size());
+            m_dataLen = bytes.size();
+        }
+
         void shiftBuffer()
         {
             auto currentFrameLen = frameLen();
@@ -158,7 +300,21 @@ namespace websocket { namespace details
         }
 
     private:
+        int lengthCode() const { return m_buffer[1] & 0x7f; }
+
+        // end of the length field, the masking key follows
+        int lengthEnd() const
+        {
+            auto code = lengthCode();
+            if (MaxPayloadLen <= 125 || code < 126)
+                return 2;
+
+            return code == 126 ? 2 + 2 : 2 + 8;
+        }
+
         char m_buffer[BufferSize];
         std::size_t m_dataLen{0};
     };
+
+    using FrameReceiver = BasicFrameReceiver<DefaultServerTraits>;
 }}
\ No newline at end of file
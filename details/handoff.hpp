@@ -0,0 +1,410 @@
+// Websocket Server implementation
+// Belongs to the public domain
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <boost/asio/ip/tcp.hpp>
+
+#include "server_fwd.hpp"
+
+#if !defined _WIN32
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace websocket { namespace details
+{
+    // State passed from the old process to the new one on restart.
+    // File descriptors travel as SCM_RIGHTS, the rest is serialized next to them.
+
+    struct HandoffConnection
+    {
+        ConnectionId id;
+        int fd;
+        boost::asio::ip::tcp::endpoint remoteEndpoint;
+        std::string received; // bytes in the FrameReceiver buffer, a frame that is not complete yet
+        std::string pending;  // bytes not written yet, the rest of a partially written frame goes first
+    };
+
+    struct HandoffState
+    {
+        int listenerFd{-1};
+        boost::asio::ip::tcp::endpoint listenerEndpoint;
+        ConnectionId lastConnId{0};
+        std::vector<HandoffConnection> connections;
+    };
+
+    namespace handoff
+    {
+        enum class RecordType : std::uint8_t { Listener = 1, Connection = 2, End = 3 };
+
+        class Writer
+        {
+        public:
+            explicit Writer(RecordType type) { put<std::uint8_t>(static_cast<std::uint8_t>(type)); }
+
+            template<typename T>
+            void put(T value)
+            {
+                m_data.append(reinterpret_cast<const char*>(&value), sizeof(value));
+            }
+
+            void putString(const std::string& s)
+            {
+                put<std::uint64_t>(s.size());
+                m_data += s;
+            }
+
+            void putEndpoint(const boost::asio::ip::tcp::endpoint& endpoint)
+            {
+                auto address = endpoint.address();
+                auto bytes = address.is_v4()
+                    ? boost::asio::ip::address_v6::v4_mapped(address.to_v4()).to_bytes()
+                    : address.to_v6().to_bytes();
+
+                put<std::uint8_t>(address.is_v4() ? 4 : 6);
+                m_data.append(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+                put<std::uint16_t>(endpoint.port());
+            }
+
+            const std::string& data() const { return m_data; }
+
+        private:
+            std::string m_data;
+        };
+
+        class Reader
+        {
+        public:
+            explicit Reader(const std::string& data) : m_data(data) {}
+
+            template<typename T>
+            T get()
+            {
+                T value;
+                std::memcpy(&value, take(sizeof(T)), sizeof(T));
+                return value;
+            }
+
+            std::string getString()
+            {
+                auto size = static_cast<std::size_t>(get<std::uint64_t>());
+                return{take(size), size};
+            }
+
+            boost::asio::ip::tcp::endpoint getEndpoint()
+            {
+                auto family = get<std::uint8_t>();
+                boost::asio::ip::address_v6::bytes_type bytes;
+                std::memcpy(bytes.data(), take(bytes.size()), bytes.size());
+                auto port = get<std::uint16_t>();
+
+                boost::asio::ip::address_v6 v6{bytes};
+                if (family == 4)
+                    return{v6.to_v4(), port};
+
+                return{v6, port};
+            }
+
+        private:
+            const char* take(std::size_t n)
+            {
+                if (m_data.size() - m_pos < n)
+                    throw std::runtime_error("handoff: truncated record");
+
+                auto p = m_data.data() + m_pos;
+                m_pos += n;
+                return p;
+            }
+
+            const std::string& m_data;
+            std::size_t m_pos{0};
+        };
+
+#if !defined _WIN32
+        inline void throwErrno(const char* what)
+        {
+            throw std::runtime_error(std::string("handoff: ") + what + ": " + std::strerror(errno));
+        }
+
+        inline sockaddr_un makeAddress(const std::string& path)
+        {
+            sockaddr_un addr{};
+            if (path.size() >= sizeof(addr.sun_path))
+                throw std::runtime_error("handoff: socket path is too long");
+
+            addr.sun_family = AF_UNIX;
+            std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+            return addr;
+        }
+
+        // old process side, waits for the new process to connect
+        inline int acceptPeer(const std::string& path)
+        {
+            auto addr = makeAddress(path);
+            ::unlink(path.c_str());
+
+            int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            if (listener < 0)
+                throwErrno("socket");
+
+            if (::bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(listener, 1) != 0)
+            {
+                ::close(listener);
+                throwErrno("bind");
+            }
+
+            int peer;
+            do peer = ::accept(listener, nullptr, nullptr); while (peer < 0 && errno == EINTR);
+
+            ::close(listener);
+            ::unlink(path.c_str());
+
+            if (peer < 0)
+                throwErrno("accept");
+
+            return peer;
+        }
+
+        // new process side, the old one may not be listening yet
+        inline int connectPeer(const std::string& path, int attempts = 50)
+        {
+            auto addr = makeAddress(path);
+            for (;;)
+            {
+                int peer = ::socket(AF_UNIX, SOCK_STREAM, 0);
+                if (peer < 0)
+                    throwErrno("socket");
+
+                if (::connect(peer, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0)
+                    return peer;
+
+                ::close(peer);
+                if ((errno != ENOENT && errno != ECONNREFUSED) || --attempts == 0)
+                    throwErrno("connect");
+
+                ::usleep(100 * 1000);
+            }
+        }
+
+        // [u32 length][record], the descriptor rides on the first byte, so the receiver
+        // gets it with the length prefix and never reads across two records
+        inline void sendRecord(int peer, const std::string& record, int fd)
+        {
+            auto len = static_cast<std::uint32_t>(record.size());
+            std::string frame(reinterpret_cast<const char*>(&len), sizeof(len));
+            frame += record;
+
+            iovec iov{&frame[0], frame.size()};
+            char control[CMSG_SPACE(sizeof(int))] = {};
+            msghdr msg{};
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+
+            if (fd >= 0)
+            {
+                msg.msg_control = control;
+                msg.msg_controllen = sizeof(control);
+                auto cmsg = CMSG_FIRSTHDR(&msg);
+                cmsg->cmsg_level = SOL_SOCKET;
+                cmsg->cmsg_type = SCM_RIGHTS;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+                std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+            }
+
+            ssize_t n;
+            do n = ::sendmsg(peer, &msg, MSG_NOSIGNAL); while (n < 0 && errno == EINTR);
+            if (n < 0)
+                throwErrno("sendmsg");
+
+            // the descriptor went with the first chunk, write the rest of a large record
+            for (std::size_t sent = n; sent < frame.size(); sent += n)
+            {
+                n = ::send(peer, frame.data() + sent, frame.size() - sent, MSG_NOSIGNAL);
+                if (n < 0 && errno != EINTR)
+                    throwErrno("send");
+
+                if (n < 0)
+                    n = 0;
+            }
+        }
+
+        inline void readExactly(int peer, char* data, std::size_t size)
+        {
+            while (size)
+            {
+                auto n = ::read(peer, data, size);
+                if (n <= 0)
+                {
+                    if (n < 0 && errno == EINTR)
+                        continue;
+
+                    throw std::runtime_error("handoff: connection lost");
+                }
+
+                data += n;
+                size -= n;
+            }
+        }
+
+        inline std::string recvRecord(int peer, int& fd)
+        {
+            std::uint32_t len;
+            iovec iov{&len, sizeof(len)};
+            char control[CMSG_SPACE(sizeof(int))] = {};
+            msghdr msg{};
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+
+            ssize_t n;
+            do n = ::recvmsg(peer, &msg, MSG_CMSG_CLOEXEC); while (n < 0 && errno == EINTR);
+            if (n <= 0)
+                throw std::runtime_error("handoff: connection lost");
+
+            fd = -1;
+            for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+            {
+                if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+                    std::memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+            }
+
+            try
+            {
+                readExactly(peer, reinterpret_cast<char*>(&len) + n, sizeof(len) - n);
+
+                std::string record(len, '\0');
+                readExactly(peer, &record[0], len);
+                return record;
+            }
+            catch (...)
+            {
+                if (fd >= 0)
+                    ::close(fd);
+
+                fd = -1;
+                throw;
+            }
+        }
+
+        // the descriptors received before a failure
+        inline void closeState(HandoffState& state)
+        {
+            if (state.listenerFd >= 0)
+                ::close(state.listenerFd);
+
+            for (auto&& conn : state.connections)
+                ::close(conn.fd);
+
+            state.listenerFd = -1;
+            state.connections.clear();
+        }
+
+        inline void sendState(int peer, const HandoffState& state)
+        {
+            Writer listener{RecordType::Listener};
+            listener.putEndpoint(state.listenerEndpoint);
+            sendRecord(peer, listener.data(), state.listenerFd);
+
+            for (auto&& conn : state.connections)
+            {
+                Writer record{RecordType::Connection};
+                record.put<std::uint64_t>(conn.id);
+                record.putEndpoint(conn.remoteEndpoint);
+                record.putString(conn.received);
+                record.putString(conn.pending);
+                sendRecord(peer, record.data(), conn.fd);
+            }
+
+            Writer end{RecordType::End};
+            end.put<std::uint64_t>(state.lastConnId);
+            sendRecord(peer, end.data(), -1);
+
+            // wait until the new process has all descriptors, it closes its end when done
+            char eof;
+            while (::read(peer, &eof, 1) < 0 && errno == EINTR) {}
+        }
+
+        // false - the End record, `fd` is reset once `state` owns it
+        inline bool parseRecord(const std::string& data, int& fd, HandoffState& state)
+        {
+            Reader record{data};
+            switch (static_cast<RecordType>(record.get<std::uint8_t>()))
+            {
+            case RecordType::Listener:
+            {
+                if (state.listenerFd >= 0)
+                    throw std::runtime_error("handoff: second listening socket");
+
+                auto endpoint = record.getEndpoint();
+                state.listenerFd = fd;
+                state.listenerEndpoint = endpoint;
+                fd = -1;
+                return true;
+            }
+
+            case RecordType::Connection:
+            {
+                if (fd < 0)
+                    throw std::runtime_error("handoff: connection without a socket");
+
+                HandoffConnection conn;
+                conn.fd = fd;
+                conn.id = static_cast<ConnectionId>(record.get<std::uint64_t>());
+                conn.remoteEndpoint = record.getEndpoint();
+                conn.received = record.getString();
+                conn.pending = record.getString();
+                state.connections.push_back(std::move(conn));
+                fd = -1;
+                return true;
+            }
+
+            case RecordType::End:
+                if (fd >= 0)
+                    throw std::runtime_error("handoff: unexpected socket");
+
+                state.lastConnId = static_cast<ConnectionId>(record.get<std::uint64_t>());
+                if (state.listenerFd < 0)
+                    throw std::runtime_error("handoff: no listening socket");
+
+                return false;
+
+            default:
+                throw std::runtime_error("handoff: unknown record");
+            }
+        }
+
+        // a failed handoff closes all descriptors it has received
+        inline HandoffState recvState(int peer)
+        {
+            HandoffState state;
+            int fd = -1; // of the current record, until `state` owns it
+            try
+            {
+                for (;;)
+                {
+                    auto data = recvRecord(peer, fd);
+                    if (!parseRecord(data, fd, state))
+                        return state;
+                }
+            }
+            catch (...)
+            {
+                if (fd >= 0)
+                    ::close(fd);
+
+                closeState(state);
+                throw;
+            }
+        }
+#endif
+    }
+}}
@@ -49,6 +49,7 @@ namespace websocket { namespace details
 
     inline http::Status processHandshakeRequest(std::istream& stream, http::Request& rq)
     {
+        rq.method = http::Method::Unsupported;
         rq.secWebSocketVersion = 0;
 
         if (!http::parser::parseRequestLine(stream, rq))
@@ -64,25 +65,30 @@ namespace websocket { namespace details
         return validateRequest(rq);
     }
 
-    inline http::Status handshake(std::istream& requestStream, std::ostream& replyStream)
+    // `extraHeaders` - complete header lines added to a successful reply
+    inline void writeHandshakeReply(std::ostream& replyStream, const http::Request& rq, http::Status status, const std::string& extraHeaders = {})
     {
-        http::Request rq;
-        auto status = processHandshakeRequest(requestStream, rq);
-
         if (status == http::Status::OK)
         {
             replyStream <<
                 "HTTP/1.1 101 Switching Protocols\r\n"
                 "Upgrade: websocket\r\n"
                 "Connection: Upgrade\r\n"
-                "Sec-WebSocket-Accept: " << calcSecKeyHash(rq.secWebSocketKey) << "\r\n"
+                "Sec-WebSocket-Accept: " << calcSecKeyHash(rq.secWebSocketKey) << "\r\n" <<
+                extraHeaders <<
                 "\r\n";
         }
         else
         {
             replyStream << "HTTP/1.1 " << (int)status << " :(\r\n\r\n";
         }
+    }
 
+    inline http::Status handshake(std::istream& requestStream, std::ostream& replyStream)
+    {
+        http::Request rq;
+        auto status = processHandshakeRequest(requestStream, rq);
+        writeHandshakeReply(replyStream, rq, status);
         return status;
     }
 }}
\ No newline at end of file
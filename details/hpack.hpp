@@ -0,0 +1,324 @@
+// Websocket Server implementation
+// Belongs to the public domain
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace websocket { namespace details
+{
+    struct HeaderField
+    {
+        std::string name;
+        std::string value;
+    };
+
+    // RFC 7541 Appendix A
+    static const char* const HpackStaticTable[61][2] =
+    {
+        {":authority", ""},
+        {":method", "GET"},
+        {":method", "POST"},
+        {":path", "/"},
+        {":path", "/index.html"},
+        {":scheme", "http"},
+        {":scheme", "https"},
+        {":status", "200"},
+        {":status", "204"},
+        {":status", "206"},
+        {":status", "304"},
+        {":status", "400"},
+        {":status", "404"},
+        {":status", "500"},
+        {"accept-charset", ""},
+        {"accept-encoding", "gzip, deflate"},
+        {"accept-language", ""},
+        {"accept-ranges", ""},
+        {"accept", ""},
+        {"access-control-allow-origin", ""},
+        {"age", ""},
+        {"allow", ""},
+        {"authorization", ""},
+        {"cache-control", ""},
+        {"content-disposition", ""},
+        {"content-encoding", ""},
+        {"content-language", ""},
+        {"content-length", ""},
+        {"content-location", ""},
+        {"content-range", ""},
+        {"content-type", ""},
+        {"cookie", ""},
+        {"date", ""},
+        {"etag", ""},
+        {"expect", ""},
+        {"expires", ""},
+        {"from", ""},
+        {"host", ""},
+        {"if-match", ""},
+        {"if-modified-since", ""},
+        {"if-none-match", ""},
+        {"if-range", ""},
+        {"if-unmodified-since", ""},
+        {"last-modified", ""},
+        {"link", ""},
+        {"location", ""},
+        {"max-forwards", ""},
+        {"proxy-authenticate", ""},
+        {"proxy-authorization", ""},
+        {"range", ""},
+        {"referer", ""},
+        {"refresh", ""},
+        {"retry-after", ""},
+        {"server", ""},
+        {"set-cookie", ""},
+        {"strict-transport-security", ""},
+        {"transfer-encoding", ""},
+        {"user-agent", ""},
+        {"vary", ""},
+        {"via", ""},
+        {"www-authenticate", ""},
+    };
+
+    static const std::uint16_t HuffmanCounts[31] = {0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3, 0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 4};
+
+    static const std::uint16_t HuffmanSymbols[257] =
+    {
+        48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37, 45, 46, 47, 51,
+        52, 53, 54, 55, 56, 57, 61, 65, 95, 98, 100, 102, 103, 104, 108, 109,
+        110, 112, 114, 117, 58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76,
+        77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89, 106, 107, 113, 118,
+        119, 120, 121, 122, 38, 42, 44, 59, 88, 90, 33, 34, 40, 41, 63, 39,
+        43, 124, 35, 62, 0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92,
+        195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161, 167, 172, 176, 177,
+        179, 209, 216, 217, 227, 229, 230, 129, 132, 133, 134, 136, 146, 154, 156, 160,
+        163, 164, 169, 170, 173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+        233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150, 151, 152, 155, 157,
+        158, 165, 166, 168, 174, 175, 180, 182, 183, 188, 191, 197, 231, 239, 9, 142,
+        144, 145, 148, 159, 171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+        200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243, 255, 203, 204, 211,
+        212, 214, 221, 222, 223, 241, 244, 245, 246, 247, 248, 250, 251, 252, 253, 254,
+        2, 3, 4, 5, 6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20,
+        21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220, 249, 10, 13, 22,
+        256,
+    };
+
+    // false - an invalid code, EOS or wrong padding
+    inline bool decodeHuffman(const std::uint8_t* data, std::size_t size, std::string& out)
+    {
+        int code = 0, first = 0, index = 0, len = 0;
+        for (std::size_t i = 0; i != size; ++i)
+        {
+            for (auto bit = 7; bit >= 0; --bit)
+            {
+                code |= (data[i] >> bit) & 1;
+                ++len;
+
+                auto count = HuffmanCounts[len];
+                if (code - first < count)
+                {
+                    auto symbol = HuffmanSymbols[index + code - first];
+                    if (symbol == 256)
+                        return false;
+
+                    out += static_cast<char>(symbol);
+                    code = first = index = len = 0;
+                    continue;
+                }
+
+                if (len == 30)
+                    return false;
+
+                index += count;
+                first = (first + count) << 1;
+                code <<= 1;
+            }
+        }
+
+        // the padding is the most significant bits of EOS, all ones and shorter than a byte
+        return len < 8 && (code >> 1) == (1 << len) - 1;
+    }
+
+    // the :status of a response, indexed when the static table has it
+    inline std::string encodeStatus(int status)
+    {
+        auto value = std::to_string(status);
+        for (auto index = 8; index <= 14; ++index)
+        {
+            if (value == HpackStaticTable[index - 1][1])
+                return std::string(1, static_cast<char>(0x80 | index));
+        }
+
+        // literal without indexing, the name is :status
+        return std::string{'\x08', static_cast<char>(value.size())} + value;
+    }
+
+    // HPACK header block decoder of one HTTP/2 connection, the dynamic table lives as long
+    // as the connection
+    class HpackDecoder
+    {
+    public:
+        // SETTINGS_HEADER_TABLE_SIZE, the server keeps the default
+        static const std::size_t MaxTableSize = 4096;
+
+        // false - a compression error, the connection can't go on
+        bool decode(const std::uint8_t* data, std::size_t size, std::vector<HeaderField>& headers)
+        {
+            auto end = data + size;
+            while (data != end)
+            {
+                auto byte = *data;
+                std::uint64_t value;
+                if (byte & 0x80) // indexed
+                {
+                    HeaderField field;
+                    if (!decodeInteger(data, end, 7, value) || !lookup(value, field))
+                        return false;
+
+                    headers.push_back(std::move(field));
+                }
+                else if ((byte & 0xC0) == 0x40) // literal added to the table
+                {
+                    HeaderField field;
+                    if (!decodeLiteral(data, end, 6, field))
+                        return false;
+
+                    add(field);
+                    headers.push_back(std::move(field));
+                }
+                else if ((byte & 0xE0) == 0x20) // table size update
+                {
+                    if (!decodeInteger(data, end, 5, value) || value > MaxTableSize)
+                        return false;
+
+                    m_maxSize = static_cast<std::size_t>(value);
+                    evict(0);
+                }
+                else // literal without indexing or never indexed
+                {
+                    HeaderField field;
+                    if (!decodeLiteral(data, end, 4, field))
+                        return false;
+
+                    headers.push_back(std::move(field));
+                }
+            }
+
+            return true;
+        }
+
+    private:
+        static bool decodeInteger(const std::uint8_t*& data, const std::uint8_t* end, int prefixBits, std::uint64_t& value)
+        {
+            if (data == end)
+                return false;
+
+            std::uint64_t max = (1u << prefixBits) - 1;
+            value = *data++ & max;
+            if (value < max)
+                return true;
+
+            for (auto shift = 0; data != end && shift < 32; shift += 7)
+            {
+                auto byte = *data++;
+                value += std::uint64_t(byte & 0x7F) << shift;
+                if (!(byte & 0x80))
+                    return true;
+            }
+
+            return false;
+        }
+
+        static bool decodeString(const std::uint8_t*& data, const std::uint8_t* end, std::string& s)
+        {
+            if (data == end)
+                return false;
+
+            auto isHuffman = (*data & 0x80) != 0;
+            std::uint64_t len;
+            if (!decodeInteger(data, end, 7, len) || len > std::uint64_t(end - data))
+                return false;
+
+            auto str = data;
+            data += len;
+            if (isHuffman)
+            {
+                s.clear();
+                return decodeHuffman(str, static_cast<std::size_t>(len), s);
+            }
+
+            s.assign(reinterpret_cast<const char*>(str), static_cast<std::size_t>(len));
+            return true;
+        }
+
+        bool decodeLiteral(const std::uint8_t*& data, const std::uint8_t* end, int prefixBits, HeaderField& field)
+        {
+            std::uint64_t index;
+            if (!decodeInteger(data, end, prefixBits, index))
+                return false;
+
+            if (index == 0)
+            {
+                if (!decodeString(data, end, field.name))
+                    return false;
+            }
+            else if (!lookup(index, field))
+            {
+                return false;
+            }
+
+            return decodeString(data, end, field.value);
+        }
+
+        // 1..61 - the static table, then the dynamic one from the newest entry
+        bool lookup(std::uint64_t index, HeaderField& field) const
+        {
+            if (index == 0)
+                return false;
+
+            if (index <= 61)
+            {
+                field.name = HpackStaticTable[index - 1][0];
+                field.value = HpackStaticTable[index - 1][1];
+                return true;
+            }
+
+            index -= 62;
+            if (index >= m_table.size())
+                return false;
+
+            field = m_table[static_cast<std::size_t>(index)];
+            return true;
+        }
+
+        static std::size_t entrySize(const HeaderField& field) { return field.name.size() + field.value.size() + 32; }
+
+        void add(const HeaderField& field)
+        {
+            auto size = entrySize(field);
+            evict(size);
+            if (size > m_maxSize)
+                return;
+
+            m_table.push_front(field);
+            m_size += size;
+        }
+
+        // makes room for `size` bytes
+        void evict(std::size_t size)
+        {
+            while (!m_table.empty() && m_size + size > m_maxSize)
+            {
+                m_size -= entrySize(m_table.back());
+                m_table.pop_back();
+            }
+        }
+
+        std::deque<HeaderField> m_table;
+        std::size_t m_size{0};
+        std::size_t m_maxSize{MaxTableSize};
+    };
+}}
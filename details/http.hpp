@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -126,6 +127,10 @@ namespace http
         int secWebSocketVersion;
         std::string secWebSocketKey;
 
+        // session resumption, see ServerOptions::sessionReplaySize
+        std::string sessionToken;
+        std::uint64_t lastSeq;
+
         std::vector<Product> upgrade;
         std::vector<std::string> connection;
     };
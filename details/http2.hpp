@@ -0,0 +1,197 @@
+// Websocket Server implementation
+// Belongs to the public domain
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "hpack.hpp"
+#include "http.hpp"
+
+namespace websocket { namespace details
+{
+    // HTTP/2 framing (RFC 7540), what the WebSocket streams of RFC 8441 need
+    namespace http2
+    {
+        // a client with prior knowledge starts with it instead of a request line
+        const char Preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+        const std::size_t PrefaceSize = sizeof(Preface) - 1;
+
+        const std::size_t FrameHeaderSize = 9;
+        const std::size_t DefaultMaxFrameSize = 16384;
+        const std::int64_t DefaultWindowSize = 65535;
+        const std::int64_t MaxWindowSize = 0x7FFFFFFF;
+
+        // the server settings
+        const std::uint32_t MaxConcurrentStreams = 100;
+        const std::size_t MaxHeaderBlockSize = 16384;
+
+        enum class FrameType : std::uint8_t
+        {
+            Data = 0,
+            Headers = 1,
+            Priority = 2,
+            RstStream = 3,
+            Settings = 4,
+            PushPromise = 5,
+            Ping = 6,
+            GoAway = 7,
+            WindowUpdate = 8,
+            Continuation = 9,
+        };
+
+        // frame flags
+        const std::uint8_t EndStream = 0x1;
+        const std::uint8_t Ack = 0x1;
+        const std::uint8_t EndHeaders = 0x4;
+        const std::uint8_t Padded = 0x8;
+        const std::uint8_t PriorityFlag = 0x20;
+
+        enum class Setting : std::uint16_t
+        {
+            HeaderTableSize = 1,
+            EnablePush = 2,
+            MaxConcurrentStreams = 3,
+            InitialWindowSize = 4,
+            MaxFrameSize = 5,
+            MaxHeaderListSize = 6,
+            EnableConnectProtocol = 8, // RFC 8441
+        };
+
+        enum class ErrorCode : std::uint32_t
+        {
+            NoError = 0,
+            ProtocolError = 1,
+            InternalError = 2,
+            FlowControlError = 3,
+            StreamClosed = 5,
+            FrameSizeError = 6,
+            RefusedStream = 7,
+            Cancel = 8,
+            CompressionError = 9,
+        };
+
+        struct FrameHeader
+        {
+            std::uint32_t length;
+            FrameType type;
+            std::uint8_t flags;
+            std::uint32_t streamId;
+        };
+
+        inline std::uint32_t readUint32(const std::uint8_t* p)
+        {
+            return (std::uint32_t(p[0]) << 24) | (std::uint32_t(p[1]) << 16) | (std::uint32_t(p[2]) << 8) | p[3];
+        }
+
+        inline void appendUint32(std::string& out, std::uint32_t value)
+        {
+            for (auto shift = 24; shift >= 0; shift -= 8)
+                out.push_back(static_cast<char>((value >> shift) & 0xFF));
+        }
+
+        inline FrameHeader parseFrameHeader(const std::uint8_t* p)
+        {
+            FrameHeader header;
+            header.length = (std::uint32_t(p[0]) << 16) | (std::uint32_t(p[1]) << 8) | p[2];
+            header.type = static_cast<FrameType>(p[3]);
+            header.flags = p[4];
+            header.streamId = readUint32(p + 5) & 0x7FFFFFFF;
+            return header;
+        }
+
+        inline void appendFrame(std::string& out, FrameType type, std::uint8_t flags, std::uint32_t streamId, const char* payload, std::size_t size)
+        {
+            out.push_back(static_cast<char>((size >> 16) & 0xFF));
+            out.push_back(static_cast<char>((size >> 8) & 0xFF));
+            out.push_back(static_cast<char>(size & 0xFF));
+            out.push_back(static_cast<char>(type));
+            out.push_back(static_cast<char>(flags));
+            appendUint32(out, streamId);
+            out.append(payload, size);
+        }
+
+        inline void appendFrame(std::string& out, FrameType type, std::uint8_t flags, std::uint32_t streamId, const std::string& payload = {})
+        {
+            appendFrame(out, type, flags, streamId, payload.data(), payload.size());
+        }
+
+        inline void appendSetting(std::string& payload, Setting setting, std::uint32_t value)
+        {
+            payload.push_back(static_cast<char>(static_cast<std::uint16_t>(setting) >> 8));
+            payload.push_back(static_cast<char>(static_cast<std::uint16_t>(setting) & 0xFF));
+            appendUint32(payload, value);
+        }
+
+        // the part of a HEADERS or DATA payload without the padding and the priority fields;
+        // false - the padding is longer than the frame
+        inline bool framePayload(const FrameHeader& header, const std::uint8_t*& data, std::size_t& size)
+        {
+            size = header.length;
+            std::size_t padding = 0;
+            if (header.flags & Padded)
+            {
+                if (size < 1)
+                    return false;
+
+                padding = data[0];
+                ++data;
+                --size;
+            }
+
+            if (header.type == FrameType::Headers && (header.flags & PriorityFlag))
+            {
+                if (size < 5)
+                    return false;
+
+                data += 5;
+                size -= 5;
+            }
+
+            if (padding > size)
+                return false;
+
+            size -= padding;
+            return true;
+        }
+
+        // extended CONNECT of a WebSocket stream, RFC 8441 section 4
+        inline http::Status validateConnect(const std::vector<HeaderField>& headers)
+        {
+            std::string method, protocol, scheme, path, authority, version;
+            for (auto&& header : headers)
+            {
+                if (header.name == ":method")
+                    method = header.value;
+                else if (header.name == ":protocol")
+                    protocol = header.value;
+                else if (header.name == ":scheme")
+                    scheme = header.value;
+                else if (header.name == ":path")
+                    path = header.value;
+                else if (header.name == ":authority")
+                    authority = header.value;
+                else if (header.name == "sec-websocket-version")
+                    version = header.value;
+            }
+
+            if (method != "CONNECT")
+                return http::Status::MethodNotAllowed;
+
+            if (protocol != "websocket" || scheme.empty() || authority.empty())
+                return http::Status::BadRequest;
+
+            if (path != "/")
+                return http::Status::NotFound;
+
+            if (version != "13")
+                return http::Status::NotImplemented;
+
+            return http::Status::OK;
+        }
+    }
+}}
@@ -133,6 +133,8 @@ namespace http { namespace parser
     {
         request.upgrade.clear();
         request.connection.clear();
+        request.sessionToken.clear();
+        request.lastSeq = 0;
 
         std::string headerLine;
         while (std::getline(stream, headerLine))
@@ -180,6 +182,17 @@ namespace http { namespace parser
                 if (!parseBase64Raw(iter, request.secWebSocketKey))
                     return false;
             }
+            else if (fieldName("x-websocket-session:")) // token
+            {
+                eatWhitespace(iter);
+                if (!parseToken(iter, request.sessionToken))
+                    return false;
+            }
+            else if (fieldName("x-websocket-last-seq:")) // 1*DIGIT
+            {
+                eatWhitespace(iter);
+                request.lastSeq = strtoull(iter, (char**)&iter, 10);
+            }
             else
             {
                 iter = "";
@@ -0,0 +1,211 @@
+// Websocket Server implementation
+// Belongs to the public domain
+
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+#if defined __SSE2__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP >= 2)
+#define WEBSOCKET_JSON_SSE2
+#include <emmintrin.h>
+#if defined _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+namespace websocket { namespace details
+{
+    // prefix scanning of JSON messages for ServerOptions::routeKey, SSE2 where the target has it
+    namespace json
+    {
+#if defined WEBSOCKET_JSON_SSE2
+        inline unsigned firstBit(unsigned mask)
+        {
+#if defined _MSC_VER
+            unsigned long index;
+            _BitScanForward(&index, mask);
+            return index;
+#else
+            return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+        }
+#endif
+
+        // the first '"' or '\' from `p`, `end` - none
+        inline const char* findQuoteOrEscape(const char* p, const char* end)
+        {
+#if defined WEBSOCKET_JSON_SSE2
+            auto quote = _mm_set1_epi8('"');
+            auto escape = _mm_set1_epi8('\\');
+            for (; end - p >= 16; p += 16)
+            {
+                auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+                auto mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, escape)));
+                if (mask)
+                    return p + firstBit(static_cast<unsigned>(mask));
+            }
+#endif
+            for (; p != end; ++p)
+            {
+                if (*p == '"' || *p == '\\')
+                    return p;
+            }
+
+            return end;
+        }
+
+        // the first quote or bracket from `p`, `end` - none
+        inline const char* findStructural(const char* p, const char* end)
+        {
+#if defined WEBSOCKET_JSON_SSE2
+            auto quote = _mm_set1_epi8('"');
+            auto bracketMask = _mm_set1_epi8(~0x20); // '{' 0x7B and '[' 0x5B differ in one bit
+            auto open = _mm_set1_epi8('['), close = _mm_set1_epi8(']');
+            for (; end - p >= 16; p += 16)
+            {
+                auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+                auto folded = _mm_and_si128(chunk, bracketMask);
+                auto hits = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                    _mm_or_si128(_mm_cmpeq_epi8(folded, open), _mm_cmpeq_epi8(folded, close)));
+                auto mask = _mm_movemask_epi8(hits);
+                if (mask)
+                    return p + firstBit(static_cast<unsigned>(mask));
+            }
+#endif
+            for (; p != end; ++p)
+            {
+                if (*p == '"' || *p == '{' || *p == '}' || *p == '[' || *p == ']')
+                    return p;
+            }
+
+            return end;
+        }
+
+        // `p` is after the opening quote, the result is the closing quote or nullptr
+        inline const char* skipString(const char* p, const char* end)
+        {
+            for (;;)
+            {
+                p = findQuoteOrEscape(p, end);
+                if (p == end)
+                    return nullptr;
+
+                if (*p == '"')
+                    return p;
+
+                if (end - p < 2)
+                    return nullptr;
+
+                p += 2; // an escaped character
+            }
+        }
+
+        // `p` is at '{' or '[', the result is after the matching bracket or nullptr
+        inline const char* skipNested(const char* p, const char* end)
+        {
+            std::size_t depth = 0;
+            for (;;)
+            {
+                p = findStructural(p, end);
+                if (p == end)
+                    return nullptr;
+
+                if (*p == '"')
+                {
+                    p = skipString(p + 1, end);
+                    if (!p)
+                        return nullptr;
+                }
+                else if (*p == '{' || *p == '[')
+                {
+                    ++depth;
+                }
+                else if (--depth == 0)
+                {
+                    return p + 1;
+                }
+
+                ++p;
+            }
+        }
+
+        inline const char* skipSpace(const char* p, const char* end)
+        {
+            while (p != end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+                ++p;
+
+            return p;
+        }
+
+        // Finds a top-level string member of a JSON object without parsing the document: the
+        // members before it are skipped over, the strings and the nested values are scanned 16
+        // bytes at a time for the few characters that matter. The key is compared as written,
+        // escapes are not decoded; `value` points to the raw string between the quotes.
+        // false - no such member, the value isn't a string or the document is broken before it
+        inline bool findStringMember(const char* data, std::size_t size, const std::string& key, const char*& value, std::size_t& valueSize)
+        {
+            auto end = data + size;
+            auto p = skipSpace(data, end);
+            if (p == end || *p != '{')
+                return false;
+
+            for (;;)
+            {
+                p = skipSpace(p + 1, end);
+                if (p == end || *p != '"')
+                    return false; // '}' of an empty object too
+
+                auto name = p + 1;
+                auto nameEnd = skipString(name, end);
+                if (!nameEnd)
+                    return false;
+
+                p = skipSpace(nameEnd + 1, end);
+                if (p == end || *p != ':')
+                    return false;
+
+                p = skipSpace(p + 1, end);
+                if (p == end)
+                    return false;
+
+                auto isKey = static_cast<std::size_t>(nameEnd - name) == key.size() && std::memcmp(name, key.data(), key.size()) == 0;
+                if (*p == '"')
+                {
+                    auto valueEnd = skipString(p + 1, end);
+                    if (!valueEnd)
+                        return false;
+
+                    if (isKey)
+                    {
+                        value = p + 1;
+                        valueSize = static_cast<std::size_t>(valueEnd - value);
+                        return true;
+                    }
+
+                    p = valueEnd + 1;
+                }
+                else if (isKey)
+                {
+                    return false;
+                }
+                else if (*p == '{' || *p == '[')
+                {
+                    p = skipNested(p, end);
+                    if (!p)
+                        return false;
+                }
+                else // a number, true, false or null
+                {
+                    while (p != end && *p != ',' && *p != '}')
+                        ++p;
+                }
+
+                p = skipSpace(p, end);
+                if (p == end || *p != ',')
+                    return false; // the end of the object
+            }
+        }
+    }
+}}
@@ -0,0 +1,80 @@
+// Websocket Server implementation
+// Belongs to the public domain
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+#include "Histogram.hpp"
+
+namespace websocket { namespace details
+{
+    // what the server knows about itself at one moment, for the metrics endpoint
+    struct ServerStats
+    {
+        std::size_t connections{0};      // WebSocket connections, HTTP/2 streams included
+        std::size_t http2Connections{0};
+        std::size_t queuedBytes{0};
+        double loopLagSeconds{0};
+        std::uint64_t rejected{0};        // turned away by admission control or overload shedding
+        std::uint64_t handshakeErrors{0};
+        Histogram rtt;                    // microseconds
+    };
+
+    // a complete HTTP/1.1 reply, the connection is closed after it
+    inline std::string makePlainReply(const std::string& contentType, const std::string& body)
+    {
+        return
+            "HTTP/1.1 200 OK\r\n"
+            "Content-Type: " + contentType + "\r\n"
+            "Content-Length: " + std::to_string(body.size()) + "\r\n"
+            "Connection: close\r\n"
+            "\r\n" + body;
+    }
+
+    // Prometheus text exposition format 0.0.4
+    inline std::string renderPrometheus(const ServerStats& stats)
+    {
+        std::ostringstream out;
+        out.precision(9);
+        out <<
+            "# HELP websocket_connections Open WebSocket connections.\n"
+            "# TYPE websocket_connections gauge\n"
+            "websocket_connections " << stats.connections << "\n"
+            "# HELP websocket_http2_connections Open HTTP/2 connections.\n"
+            "# TYPE websocket_http2_connections gauge\n"
+            "websocket_http2_connections " << stats.http2Connections << "\n"
+            "# HELP websocket_queued_bytes Bytes waiting in the send queues.\n"
+            "# TYPE websocket_queued_bytes gauge\n"
+            "websocket_queued_bytes " << stats.queuedBytes << "\n"
+            "# HELP websocket_loop_lag_seconds How late the last I/O loop tick fired.\n"
+            "# TYPE websocket_loop_lag_seconds gauge\n"
+            "websocket_loop_lag_seconds " << stats.loopLagSeconds << "\n"
+            "# HELP websocket_rejected_total Connections turned away before the handshake.\n"
+            "# TYPE websocket_rejected_total counter\n"
+            "websocket_rejected_total " << stats.rejected << "\n"
+            "# HELP websocket_handshake_errors_total Failed handshakes.\n"
+            "# TYPE websocket_handshake_errors_total counter\n"
+            "websocket_handshake_errors_total " << stats.handshakeErrors << "\n"
+            "# HELP websocket_rtt_seconds Round trip time of the keepalive pings.\n"
+            "# TYPE websocket_rtt_seconds histogram\n";
+
+        // the buckets are cumulative, the last one is +Inf
+        std::uint64_t count = 0;
+        for (std::size_t i = 0; i + 1 < Histogram::BucketCount; ++i)
+        {
+            count += stats.rtt.bucket(i);
+            out << "websocket_rtt_seconds_bucket{le=\"" << Histogram::upperBound(i) / 1e6 << "\"} " << count << "\n";
+        }
+
+        out <<
+            "websocket_rtt_seconds_bucket{le=\"+Inf\"} " << stats.rtt.count() << "\n"
+            "websocket_rtt_seconds_sum " << stats.rtt.sum() / 1e6 << "\n"
+            "websocket_rtt_seconds_count " << stats.rtt.count() << "\n";
+
+        return out.str();
+    }
+}}
@@ -0,0 +1,239 @@
+// Websocket Server implementation
+// Belongs to the public domain
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <boost/asio/ip/tcp.hpp>
+
+namespace websocket { namespace details
+{
+    // PROXY protocol header sent by L4 load balancers before the client data,
+    // see http://www.haproxy.org/download/1.8/doc/proxy-protocol.txt
+
+    enum class ProxyParseResult { Complete, NeedMore, Invalid };
+
+    struct ProxyHeader
+    {
+        std::size_t length{0}; // bytes taken by the header, the request starts right after it
+        bool isLocal{true};    // no client address (health check, unknown family), keep the socket one
+        boost::asio::ip::tcp::endpoint source;
+        boost::asio::ip::tcp::endpoint destination;
+    };
+
+    namespace proxy
+    {
+        const char V1Prefix[] = "PROXY ";
+        const std::size_t V1PrefixLen = 6;
+        const std::size_t V1MaxLen = 107; // including CRLF
+
+        const char V2Signature[] = "\r\n\r\n\0\r\nQUIT\n";
+        const std::size_t V2SignatureLen = 12;
+        const std::size_t V2HeaderLen = 16;
+
+        // true if the available bytes can still turn into the given prefix
+        inline bool startsWith(const char* data, std::size_t size, const char* prefix, std::size_t prefixLen)
+        {
+            return std::memcmp(data, prefix, size < prefixLen ? size : prefixLen) == 0;
+        }
+
+        inline std::uint16_t readU16(const char* p)
+        {
+            auto u = reinterpret_cast<const std::uint8_t*>(p);
+            return static_cast<std::uint16_t>((u[0] << 8) | u[1]);
+        }
+
+        inline std::uint32_t readU32(const char* p)
+        {
+            return (std::uint32_t(readU16(p)) << 16) | readU16(p + 2);
+        }
+
+        // space separated token from [iter, end), advances `iter` past the separator
+        inline bool nextToken(const char*& iter, const char* end, const char*& tokenBegin, const char*& tokenEnd)
+        {
+            if (iter >= end)
+                return false;
+
+            auto space = static_cast<const char*>(std::memchr(iter, ' ', end - iter));
+            tokenBegin = iter;
+            tokenEnd = space ? space : end;
+            iter = tokenEnd + 1;
+            return tokenBegin != tokenEnd;
+        }
+
+        inline bool parsePort(const char* begin, const char* end, unsigned short& port)
+        {
+            if (begin == end || end - begin > 5)
+                return false;
+
+            unsigned value = 0;
+            for (; begin != end; ++begin)
+            {
+                if (*begin < '0' || *begin > '9')
+                    return false;
+
+                value = value * 10 + (*begin - '0');
+            }
+
+            if (value > 0xFFFF)
+                return false;
+
+            port = static_cast<unsigned short>(value);
+            return true;
+        }
+
+        inline bool parseAddress(const char* begin, const char* end, bool isV6, boost::asio::ip::address& address)
+        {
+            char text[46]; // INET6_ADDRSTRLEN
+            auto len = static_cast<std::size_t>(end - begin);
+            if (len >= sizeof(text))
+                return false;
+
+            std::memcpy(text, begin, len);
+            text[len] = '\0';
+
+            boost::system::error_code ec;
+            address = boost::asio::ip::address::from_string(text, ec);
+            return !ec && address.is_v6() == isV6;
+        }
+
+        // "PROXY TCP4 255.255.255.255 255.255.255.255 65535 65535\r\n"
+        inline ProxyParseResult parseV1(const char* data, std::size_t size, ProxyHeader& header)
+        {
+            auto searchLen = size < V1MaxLen ? size : V1MaxLen;
+            auto lf = static_cast<const char*>(std::memchr(data, '\n', searchLen));
+            if (!lf)
+                return size < V1MaxLen ? ProxyParseResult::NeedMore : ProxyParseResult::Invalid;
+
+            if (lf[-1] != '\r')
+                return ProxyParseResult::Invalid;
+
+            header.length = lf + 1 - data;
+
+            auto iter = data + V1PrefixLen;
+            auto end = lf - 1;
+            const char* tokenBegin;
+            const char* tokenEnd;
+
+            if (!nextToken(iter, end, tokenBegin, tokenEnd))
+                return ProxyParseResult::Invalid;
+
+            auto protocol = [&](const char* name)
+            {
+                auto len = std::strlen(name);
+                return std::size_t(tokenEnd - tokenBegin) == len && std::memcmp(tokenBegin, name, len) == 0;
+            };
+
+            if (protocol("UNKNOWN")) // the rest of the line is ignored
+            {
+                header.isLocal = true;
+                return ProxyParseResult::Complete;
+            }
+
+            bool isV6;
+            if (protocol("TCP4"))
+                isV6 = false;
+            else if (protocol("TCP6"))
+                isV6 = true;
+            else
+                return ProxyParseResult::Invalid;
+
+            boost::asio::ip::address srcAddr, dstAddr;
+            unsigned short srcPort, dstPort;
+
+            if (!nextToken(iter, end, tokenBegin, tokenEnd) || !parseAddress(tokenBegin, tokenEnd, isV6, srcAddr))
+                return ProxyParseResult::Invalid;
+
+            if (!nextToken(iter, end, tokenBegin, tokenEnd) || !parseAddress(tokenBegin, tokenEnd, isV6, dstAddr))
+                return ProxyParseResult::Invalid;
+
+            if (!nextToken(iter, end, tokenBegin, tokenEnd) || !parsePort(tokenBegin, tokenEnd, srcPort))
+                return ProxyParseResult::Invalid;
+
+            if (!nextToken(iter, end, tokenBegin, tokenEnd) || !parsePort(tokenBegin, tokenEnd, dstPort) || tokenEnd != end)
+                return ProxyParseResult::Invalid;
+
+            header.isLocal = false;
+            header.source = {srcAddr, srcPort};
+            header.destination = {dstAddr, dstPort};
+            return ProxyParseResult::Complete;
+        }
+
+        // 12 bytes signature, version/command, family/transport, 16-bit length, addresses, TLVs
+        inline ProxyParseResult parseV2(const char* data, std::size_t size, ProxyHeader& header)
+        {
+            if (size < V2HeaderLen)
+                return ProxyParseResult::NeedMore;
+
+            auto versionCommand = static_cast<std::uint8_t>(data[12]);
+            auto family = static_cast<std::uint8_t>(data[13]);
+            std::size_t addressLen = readU16(data + 14);
+
+            if ((versionCommand & 0xF0) != 0x20)
+                return ProxyParseResult::Invalid;
+
+            auto command = versionCommand & 0x0F;
+            if (command > 1)
+                return ProxyParseResult::Invalid;
+
+            if (size < V2HeaderLen + addressLen)
+                return ProxyParseResult::NeedMore;
+
+            header.length = V2HeaderLen + addressLen;
+            header.isLocal = true;
+
+            if (command == 0) // LOCAL
+                return ProxyParseResult::Complete;
+
+            auto addr = data + V2HeaderLen;
+
+            if (family == 0x11) // TCP over IPv4
+            {
+                if (addressLen < 4 + 4 + 2 + 2)
+                    return ProxyParseResult::Invalid;
+
+                header.source = {boost::asio::ip::address_v4{readU32(addr)}, readU16(addr + 8)};
+                header.destination = {boost::asio::ip::address_v4{readU32(addr + 4)}, readU16(addr + 10)};
+                header.isLocal = false;
+            }
+            else if (family == 0x21) // TCP over IPv6
+            {
+                if (addressLen < 16 + 16 + 2 + 2)
+                    return ProxyParseResult::Invalid;
+
+                boost::asio::ip::address_v6::bytes_type srcBytes, dstBytes;
+                std::memcpy(srcBytes.data(), addr, 16);
+                std::memcpy(dstBytes.data(), addr + 16, 16);
+
+                header.source = {boost::asio::ip::address_v6{srcBytes}, readU16(addr + 32)};
+                header.destination = {boost::asio::ip::address_v6{dstBytes}, readU16(addr + 34)};
+                header.isLocal = false;
+            }
+            // UDP and unix sockets: the receiver must fall back to the real connection endpoints
+
+            return ProxyParseResult::Complete;
+        }
+    }
+
+    // Parses the header in place, nothing is copied out of the receive buffer.
+    // NeedMore means that all available bytes are a valid header prefix.
+    inline ProxyParseResult parseProxyHeader(const char* data, std::size_t size, ProxyHeader& header)
+    {
+        if (size == 0)
+            return ProxyParseResult::NeedMore;
+
+        if (proxy::startsWith(data, size, proxy::V2Signature, proxy::V2SignatureLen))
+        {
+            return size < proxy::V2SignatureLen ? ProxyParseResult::NeedMore : proxy::parseV2(data, size, header);
+        }
+
+        if (proxy::startsWith(data, size, proxy::V1Prefix, proxy::V1PrefixLen))
+        {
+            return size < proxy::V1PrefixLen ? ProxyParseResult::NeedMore : proxy::parseV1(data, size, header);
+        }
+
+        return ProxyParseResult::Invalid;
+    }
+}}
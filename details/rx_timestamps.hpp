@@ -0,0 +1,69 @@
+// Websocket Server implementation
+// Belongs to the public domain
+
+#pragma once
+
+#if defined __linux__
+
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+namespace websocket { namespace details
+{
+    // SO_TIMESTAMPING with the software receive timestamps, the kernel stamps every
+    // incoming packet and recvmsg() gets the stamp of the data it returns
+    inline bool enableRxTimestamps(int fd)
+    {
+        int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+        return ::setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == 0;
+    }
+
+    // the kernel stamps are CLOCK_REALTIME, the events use the steady clock
+    inline std::chrono::steady_clock::time_point fromRealtime(const timespec& ts)
+    {
+        auto stamp = std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+        auto age = std::chrono::system_clock::now().time_since_epoch() - stamp;
+        return std::chrono::steady_clock::now() - std::chrono::duration_cast<std::chrono::steady_clock::duration>(age);
+    }
+
+    // non-blocking recv; `receivedAt` is set when the data came with a timestamp
+    inline ssize_t recvTimestamped(int fd, void* data, std::size_t size, std::chrono::steady_clock::time_point& receivedAt)
+    {
+        union
+        {
+            cmsghdr align;
+            char buffer[CMSG_SPACE(sizeof(scm_timestamping))];
+        } control;
+
+        iovec iov{data, size};
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buffer;
+        msg.msg_controllen = sizeof(control.buffer);
+
+        auto n = ::recvmsg(fd, &msg, MSG_DONTWAIT);
+        if (n <= 0)
+            return n;
+
+        for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SO_TIMESTAMPING)
+                continue;
+
+            scm_timestamping stamps;
+            std::memcpy(&stamps, CMSG_DATA(cmsg), sizeof(stamps));
+            if (stamps.ts[0].tv_sec != 0 || stamps.ts[0].tv_nsec != 0) // [0] - software
+                receivedAt = fromRealtime(stamps.ts[0]);
+        }
+
+        return n;
+    }
+}}
+
+#endif
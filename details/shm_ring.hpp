@@ -0,0 +1,381 @@
+// Websocket Server implementation
+// Belongs to the public domain
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <string>
+
+#include "EventRecord.hpp"
+#include "server_fwd.hpp"
+
+#if !defined _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace websocket { namespace details
+{
+    // Shared memory channel between the server and an application process:
+    //
+    //     [SegmentHeader][RingHeader][event ring data][RingHeader][command ring data]
+    //
+    // Each ring is single producer, single consumer. Records are written back to back into the
+    // ring data, a record that doesn't fit before the end is preceded by a Padding record that
+    // covers the rest. Positions only grow, the offset is `position & (ringSize - 1)`.
+    // The consumer reads the payload in place and moves the head after it is done with it.
+
+    enum class RecordType : std::uint8_t
+    {
+        Padding = 0,
+
+        // server -> application
+        NewConnection = 1,
+        Message = 2,
+        Disconnect = 3,
+
+        // application -> server
+        SendText = 4,
+        SendBinary = 5,
+        Drop = 6,
+
+        // server -> application
+        Drained = 7,
+    };
+
+    inline RecordType eventRecordType(Event event)
+    {
+        return event == Event::Drained
+            ? RecordType::Drained
+            : static_cast<RecordType>(static_cast<int>(event) + static_cast<int>(RecordType::NewConnection));
+    }
+
+    inline Event recordEvent(RecordType type)
+    {
+        return type == RecordType::Drained
+            ? Event::Drained
+            : static_cast<Event>(static_cast<int>(type) - static_cast<int>(RecordType::NewConnection));
+    }
+
+    struct RecordHeader
+    {
+        std::uint32_t size; // payload bytes, the record takes 16 + size rounded up to 16
+        RecordType type;
+        std::uint8_t reserved[3];
+        std::uint64_t connId;
+    };
+
+    static_assert(sizeof(RecordHeader) == 16, "shared memory layout");
+
+    struct RingHeader
+    {
+        alignas(64) std::atomic<std::uint64_t> head; // written by the consumer
+        alignas(64) std::atomic<std::uint64_t> tail; // written by the producer
+    };
+
+    static_assert(sizeof(RingHeader) == 128, "shared memory layout");
+
+    struct SegmentHeader
+    {
+        static const std::uint64_t Magic = 0x3176726573737777; // "wwsserv1"
+
+        alignas(64) std::uint64_t magic;
+        std::uint64_t ringSize;
+    };
+
+    inline std::size_t recordLength(std::size_t payloadSize)
+    {
+        return (sizeof(RecordHeader) + payloadSize + 15) & ~std::size_t(15);
+    }
+
+    inline std::size_t segmentSize(std::size_t ringSize)
+    {
+        return sizeof(SegmentHeader) + 2 * (sizeof(RingHeader) + ringSize);
+    }
+
+    // one side of a ring, the producer and the consumer each use their own object
+    class SharedRing
+    {
+    public:
+        SharedRing(RingHeader* header, char* data, std::size_t size)
+            : m_header{header}
+            , m_data{data}
+            , m_size{size}
+        {}
+
+        // producer; false if the ring is full. A record that doesn't fit before the end publishes
+        // its Padding first, so once the consumer has skipped it the record needs room only
+        // from the start: any record up to the ring size fits in an empty ring.
+        bool push(RecordType type, std::uint64_t connId, const char* payload, std::size_t size)
+        {
+            auto length = recordLength(size);
+            if (length > m_size)
+                throw std::length_error("websocket message is too long for the shared ring");
+
+            auto tail = m_header->tail.load(std::memory_order_relaxed);
+            auto offset = tail & (m_size - 1);
+            if (m_size - offset < length)
+            {
+                auto padding = m_size - offset;
+                if (!hasRoom(tail, padding))
+                    return false;
+
+                writeHeader(offset, RecordType::Padding, 0, padding - sizeof(RecordHeader));
+                tail += padding;
+                offset = 0;
+                m_header->tail.store(tail, std::memory_order_release);
+            }
+
+            if (!hasRoom(tail, length))
+                return false;
+
+            writeHeader(offset, type, connId, size);
+            std::memcpy(m_data + offset + sizeof(RecordHeader), payload, size);
+
+            m_header->tail.store(tail + length, std::memory_order_release);
+            return true;
+        }
+
+        // consumer; the record stays valid until pop()
+        bool front(RecordHeader& header, const char*& payload)
+        {
+            for (;;)
+            {
+                auto head = m_header->head.load(std::memory_order_relaxed);
+                if (head >= m_cachedTail)
+                {
+                    m_cachedTail = m_header->tail.load(std::memory_order_acquire);
+                    if (head == m_cachedTail)
+                        return false;
+                }
+
+                auto offset = head & (m_size - 1);
+                std::memcpy(&header, m_data + offset, sizeof(header));
+                if (header.type != RecordType::Padding)
+                {
+                    payload = m_data + offset + sizeof(RecordHeader);
+                    return true;
+                }
+
+                m_header->head.store(head + recordLength(header.size), std::memory_order_release);
+            }
+        }
+
+        void pop(const RecordHeader& header)
+        {
+            auto head = m_header->head.load(std::memory_order_relaxed);
+            m_header->head.store(head + recordLength(header.size), std::memory_order_release);
+        }
+
+    private:
+        bool hasRoom(std::uint64_t tail, std::size_t length)
+        {
+            if (tail + length - m_cachedHead <= m_size)
+                return true;
+
+            m_cachedHead = m_header->head.load(std::memory_order_acquire);
+            return tail + length - m_cachedHead <= m_size;
+        }
+
+        // records are 16-aligned, so the space left before the end always fits a Padding header
+        void writeHeader(std::size_t offset, RecordType type, std::uint64_t connId, std::size_t size)
+        {
+            RecordHeader header{static_cast<std::uint32_t>(size), type, {}, connId};
+            std::memcpy(m_data + offset, &header, sizeof(header));
+        }
+
+        RingHeader* m_header;
+        char* m_data;
+        std::size_t m_size;
+        std::uint64_t m_cachedHead{0};
+        std::uint64_t m_cachedTail{0};
+    };
+
+    // the mapped segment, the server creates it and the application opens it
+    class SharedSegment
+    {
+    public:
+        // `ringSize` - power of two, used only by the creator
+        SharedSegment(const std::string& name, bool create, std::size_t ringSize = 0)
+            : m_name{name}
+            , m_isOwner{create}
+        {
+#if defined _WIN32
+            (void)ringSize;
+            throw std::runtime_error("shared memory channel is not supported on Windows");
+#else
+            if (create && (ringSize < 64 || (ringSize & (ringSize - 1)) != 0))
+                throw std::invalid_argument("shared memory ring size must be a power of two");
+
+            int fd = create ? ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600) : ::shm_open(name.c_str(), O_RDWR, 0);
+            if (fd < 0 && create && errno == EEXIST)
+            {
+                // left over by a previous run
+                ::shm_unlink(name.c_str());
+                fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+            }
+            if (fd < 0)
+                throwErrno("shm_open");
+
+            if (create)
+            {
+                m_size = segmentSize(ringSize);
+                if (::ftruncate(fd, m_size) != 0)
+                {
+                    ::close(fd);
+                    throwErrno("ftruncate");
+                }
+            }
+            else
+            {
+                SegmentHeader header;
+                if (::pread(fd, &header, sizeof(header), 0) != sizeof(header) || header.magic != SegmentHeader::Magic)
+                {
+                    ::close(fd);
+                    throw std::runtime_error("shared memory segment is not ready");
+                }
+                ringSize = static_cast<std::size_t>(header.ringSize);
+                m_size = segmentSize(ringSize);
+            }
+
+            auto memory = ::mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (memory == MAP_FAILED)
+                throwErrno("mmap");
+
+            m_memory = static_cast<char*>(memory);
+            m_ringSize = ringSize;
+
+            if (create)
+            {
+                // a fresh mapping is zero filled, the atomics start at 0; the magic goes last
+                auto header = reinterpret_cast<SegmentHeader*>(m_memory);
+                header->ringSize = ringSize;
+                std::atomic_thread_fence(std::memory_order_release);
+                header->magic = SegmentHeader::Magic;
+            }
+#endif
+        }
+
+        ~SharedSegment()
+        {
+#if !defined _WIN32
+            ::munmap(m_memory, m_size);
+            if (m_isOwner)
+                ::shm_unlink(m_name.c_str());
+#endif
+        }
+
+        SharedSegment(const SharedSegment&) = delete;
+        SharedSegment& operator=(const SharedSegment&) = delete;
+
+        SharedRing eventRing() { return ring(0); }
+        SharedRing commandRing() { return ring(1); }
+
+    private:
+        SharedRing ring(std::size_t index)
+        {
+            auto p = m_memory + sizeof(SegmentHeader) + index * (sizeof(RingHeader) + m_ringSize);
+            return{reinterpret_cast<RingHeader*>(p), p + sizeof(RingHeader), m_ringSize};
+        }
+
+        static void throwErrno(const char* what)
+        {
+            throw std::runtime_error(std::string(what) + ": " + std::strerror(errno));
+        }
+
+        std::string m_name;
+        bool m_isOwner;
+        char* m_memory{nullptr};
+        std::size_t m_size{0};
+        std::size_t m_ringSize{0};
+    };
+
+    // server side: the I/O thread produces events and consumes commands
+    class SharedChannel
+    {
+    public:
+        // `maxOverflow` - payload bytes of the events that wait for room in the ring
+        SharedChannel(const std::string& name, std::size_t ringSize, std::size_t maxOverflow)
+            : m_segment{name, true, ringSize}
+            , m_events{m_segment.eventRing()}
+            , m_commands{m_segment.commandRing()}
+            , m_maxPayload{ringSize - sizeof(RecordHeader)}
+            , m_maxOverflow{maxOverflow}
+        {}
+
+        // the largest message a record takes
+        std::size_t maxPayload() const { return m_maxPayload; }
+
+        // Events that don't fit wait here, in order, until the application catches up.
+        // false - the event is dropped: the waiting ones are over the limit or it never fits.
+        // Connection and disconnect events are always kept, there is one of each per connection.
+        bool publish(EventRecord record)
+        {
+            if (record.size() > m_maxPayload)
+                return false;
+
+            if (m_overflow.empty() && push(record))
+                return true;
+
+            auto isLifecycle = record.event() == Event::NewConnection || record.event() == Event::Disconnect;
+            if (!isLifecycle && m_overflowBytes + record.size() > m_maxOverflow)
+                return false;
+
+            m_overflowBytes += record.size();
+            m_overflow.push_back(std::move(record));
+            return true;
+        }
+
+        void flush()
+        {
+            while (!m_overflow.empty())
+            {
+                if (!push(m_overflow.front()))
+                    return;
+
+                m_overflowBytes -= m_overflow.front().size();
+                m_overflow.pop_front();
+            }
+        }
+
+        std::size_t overflowBytes() const { return m_overflowBytes; }
+
+        // calls `f(type, connId, data, size)` for at most `maxCount` commands, returns their number
+        template<typename F>
+        std::size_t receiveCommands(F&& f, std::size_t maxCount)
+        {
+            std::size_t n = 0;
+            RecordHeader header;
+            const char* payload;
+            while (n != maxCount && m_commands.front(header, payload))
+            {
+                f(header.type, static_cast<ConnectionId>(header.connId), payload, header.size);
+                m_commands.pop(header);
+                ++n;
+            }
+
+            return n;
+        }
+
+    private:
+        bool push(const EventRecord& record)
+        {
+            return m_events.push(eventRecordType(record.event()), record.connId(), record.data(), record.size());
+        }
+
+        SharedSegment m_segment;
+        SharedRing m_events;
+        SharedRing m_commands;
+        std::size_t m_maxPayload;
+        std::size_t m_maxOverflow;
+        std::deque<EventRecord> m_overflow;
+        std::size_t m_overflowBytes{0};
+    };
+}}
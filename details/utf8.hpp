@@ -0,0 +1,51 @@
+// Websocket Server implementation
+// Belongs to the public domain
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace websocket { namespace details
+{
+    // RFC 3629: no overlong forms, no surrogates, nothing above U+10FFFF
+    inline bool isValidUtf8(const char* data, std::size_t size)
+    {
+        auto p = reinterpret_cast<const std::uint8_t*>(data);
+        auto end = p + size;
+
+        while (p != end)
+        {
+            auto c = *p++;
+            if (c < 0x80)
+                continue;
+
+            std::size_t tail;
+            std::uint8_t low = 0x80, high = 0xBF; // range of the second byte
+            if (c >= 0xC2 && c <= 0xDF) tail = 1;
+            else if (c == 0xE0) { tail = 2; low = 0xA0; }
+            else if (c == 0xED) { tail = 2; high = 0x9F; }
+            else if (c >= 0xE1 && c <= 0xEF) tail = 2;
+            else if (c == 0xF0) { tail = 3; low = 0x90; }
+            else if (c == 0xF4) { tail = 3; high = 0x8F; }
+            else if (c >= 0xF1 && c <= 0xF3) tail = 3;
+            else return false;
+
+            if (static_cast<std::size_t>(end - p) < tail)
+                return false;
+
+            if (*p < low || *p > high)
+                return false;
+
+            for (std::size_t i = 1; i != tail; ++i)
+            {
+                if ((p[i] & 0xC0) != 0x80)
+                    return false;
+            }
+
+            p += tail;
+        }
+
+        return true;
+    }
+}}
@@ -0,0 +1,310 @@
+// Websocket Server implementation
+// Belongs to the public domain
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "server_fwd.hpp"
+
+#if !defined _WIN32
+#include <cerrno>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace websocket { namespace details
+{
+    // Pre-fork mode: every worker process runs its own loop and owns the connections it accepted.
+    // The worker number lives in the top bits of the connection id, so any worker knows the owner.
+    // Next to it is the generation of the worker process, bumped on every restart: a restarted
+    // worker doesn't hand the ids of the crashed one's connections to new clients.
+
+    const unsigned MaxWorkers = 256;
+    const unsigned WorkerIdShift = 56;
+    const unsigned GenerationShift = 40;
+    const unsigned GenerationMask = 0xFFFF;
+
+    inline ConnectionId firstConnectionId(unsigned workerId, unsigned generation = 0)
+    {
+        return ConnectionId(workerId) << WorkerIdShift | ConnectionId(generation & GenerationMask) << GenerationShift;
+    }
+
+    inline unsigned workerOf(ConnectionId connId)
+    {
+        return static_cast<unsigned>(connId >> WorkerIdShift);
+    }
+
+    // the broadcasts come from the application threads of this process only, a routed message
+    // with one of them is invalid
+    enum class RoutedCommand : std::uint8_t
+    {
+        SendText = 1, SendBinary = 2, Drop = 3, PauseReading = 4, ResumeReading = 5, SetSendClass = 6,
+        Subscribe = 7, BroadcastText = 8, BroadcastBinary = 9
+    };
+
+    // [u8 command][u64 connection id][message]
+    // A message larger than a datagram goes in fragments, the command byte has the Fragment flag
+    // and a u64 tag of the message follows the header: [u8 command | flags][u64 connection id][u64 tag][part]
+    struct RoutedMessage
+    {
+        static const std::size_t HeaderSize = 1 + 8;
+        static const std::size_t TagSize = 8;
+        static const std::size_t MaxSize = 1 << 20; // of a datagram
+        static const std::uint8_t Fragment = 0x80;
+        static const std::uint8_t LastFragment = 0x40;
+
+        static std::string make(RoutedCommand command, ConnectionId connId, const std::string& message)
+        {
+            std::string data(HeaderSize, '\0');
+            data[0] = static_cast<char>(command);
+            std::uint64_t id = connId;
+            std::memcpy(&data[1], &id, sizeof(id));
+            return data += message;
+        }
+
+        static std::string makeFragment(RoutedCommand command, ConnectionId connId, std::uint64_t tag, bool isLast, const char* part, std::size_t size)
+        {
+            std::string data(HeaderSize + TagSize, '\0');
+            data[0] = static_cast<char>(static_cast<std::uint8_t>(command) | Fragment | (isLast ? LastFragment : 0));
+            std::uint64_t id = connId;
+            std::memcpy(&data[1], &id, sizeof(id));
+            std::memcpy(&data[HeaderSize], &tag, sizeof(tag));
+            return data.append(part, size);
+        }
+
+        static bool isFragment(const char* data, std::size_t size)
+        {
+            return size != 0 && (static_cast<std::uint8_t>(data[0]) & Fragment) != 0;
+        }
+
+        static bool parse(const char* data, std::size_t size, RoutedCommand& command, ConnectionId& connId, std::string& message)
+        {
+            if (size < HeaderSize || data[0] < char(RoutedCommand::SendText) || data[0] > char(RoutedCommand::Subscribe))
+                return false;
+
+            command = static_cast<RoutedCommand>(data[0]);
+            std::uint64_t id;
+            std::memcpy(&id, data + 1, sizeof(id));
+            connId = id;
+            message.assign(data + HeaderSize, size - HeaderSize);
+            return true;
+        }
+    };
+
+    // Puts the fragmented messages back together. The fragments of one message come in order, but
+    // between them there can be datagrams of other senders.
+    class RoutedAssembler
+    {
+    public:
+        // a sender that died in the middle of a message leaves a part, the oldest ones are dropped
+        static const std::size_t MaxPartial = 64;
+
+        // false - an invalid datagram, true with `isComplete` false - a part of a message is kept
+        bool receive(const char* data, std::size_t size, RoutedCommand& command, ConnectionId& connId, std::string& message, bool& isComplete)
+        {
+            isComplete = true;
+            if (!RoutedMessage::isFragment(data, size))
+                return RoutedMessage::parse(data, size, command, connId, message);
+
+            if (size < RoutedMessage::HeaderSize + RoutedMessage::TagSize)
+                return false;
+
+            auto flags = static_cast<std::uint8_t>(data[0]);
+            auto rawCommand = static_cast<char>(flags & ~(RoutedMessage::Fragment | RoutedMessage::LastFragment));
+            if (rawCommand != char(RoutedCommand::SendText) && rawCommand != char(RoutedCommand::SendBinary))
+                return false;
+
+            std::uint64_t tag;
+            std::memcpy(&tag, data + RoutedMessage::HeaderSize, sizeof(tag));
+            auto&& partial = m_partial[tag];
+            if (partial.data.empty())
+            {
+                partial.order = ++m_counter;
+                dropOldest();
+            }
+
+            auto partSize = RoutedMessage::HeaderSize + RoutedMessage::TagSize;
+            partial.data.append(data + partSize, size - partSize);
+            if ((flags & RoutedMessage::LastFragment) == 0)
+            {
+                isComplete = false;
+                return true;
+            }
+
+            command = static_cast<RoutedCommand>(rawCommand);
+            std::uint64_t id;
+            std::memcpy(&id, data + 1, sizeof(id));
+            connId = id;
+            message = std::move(partial.data);
+            m_partial.erase(tag);
+            return true;
+        }
+
+        std::size_t partialCount() const { return m_partial.size(); }
+
+    private:
+        struct Partial
+        {
+            std::string data;
+            std::uint64_t order;
+        };
+
+        void dropOldest()
+        {
+            if (m_partial.size() <= MaxPartial)
+                return;
+
+            auto oldest = std::min_element(begin(m_partial), end(m_partial), [](const std::pair<const std::uint64_t, Partial>& a, const std::pair<const std::uint64_t, Partial>& b)
+            {
+                return a.second.order < b.second.order;
+            });
+            m_partial.erase(oldest);
+        }
+
+        std::unordered_map<std::uint64_t, Partial> m_partial; // by the tag
+        std::uint64_t m_counter{0};
+    };
+
+#if !defined _WIN32
+    // One datagram socket pair per worker, created by the supervisor before forking, so a restarted
+    // worker inherits the channel of the crashed one. Every worker writes into the channel of the
+    // connection owner, datagrams are never interleaved.
+    class WorkerChannels
+    {
+    public:
+        explicit WorkerChannels(unsigned workerCount)
+        {
+            if (workerCount == 0 || workerCount > MaxWorkers)
+                throw std::invalid_argument("invalid number of workers");
+
+            for (unsigned i = 0; i != workerCount; ++i)
+            {
+                int fds[2];
+                if (::socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, fds) != 0)
+                {
+                    closeAll();
+                    throw std::runtime_error(std::string("socketpair: ") + std::strerror(errno));
+                }
+
+                // the kernel caps the sizes at net.core.wmem_max / rmem_max
+                int bufferSize = RoutedMessage::MaxSize;
+                ::setsockopt(fds[1], SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(bufferSize));
+                ::setsockopt(fds[0], SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+
+                // Linux reports twice the size it has set, the other half is for its bookkeeping
+                socklen_t optionSize = sizeof(bufferSize);
+                if (::getsockopt(fds[1], SOL_SOCKET, SO_SNDBUF, &bufferSize, &optionSize) == 0)
+                    m_maxDatagram = std::min(m_maxDatagram, std::max(static_cast<std::size_t>(bufferSize / 2), std::size_t{MinDatagram}));
+
+                m_channels.push_back({fds[0], fds[1]});
+            }
+        }
+
+        ~WorkerChannels() { closeAll(); }
+
+        WorkerChannels(const WorkerChannels&) = delete;
+        WorkerChannels& operator=(const WorkerChannels&) = delete;
+
+        unsigned workerCount() const { return static_cast<unsigned>(m_channels.size()); }
+        unsigned workerId() const { return m_workerId; }
+        unsigned generation() const { return m_generation; }
+
+        // in the worker process, the channels of the others are only written
+        void setWorker(unsigned workerId, unsigned generation)
+        {
+            m_workerId = workerId;
+            m_generation = generation;
+            for (unsigned i = 0; i != m_channels.size(); ++i)
+            {
+                if (i != workerId)
+                {
+                    ::close(m_channels[i].readFd);
+                    m_channels[i].readFd = -1;
+                }
+            }
+        }
+
+        int readHandle() const { return m_channels[m_workerId].readFd; }
+
+        // the largest datagram the channels take
+        std::size_t maxDatagram() const { return m_maxDatagram; }
+
+        // blocks while the owner's channel is full, a message to a worker that doesn't exist is dropped;
+        // a message larger than a datagram is sent in fragments
+        void route(RoutedCommand command, ConnectionId connId, const std::string& message)
+        {
+            auto owner = workerOf(connId);
+            if (owner >= m_channels.size())
+                return;
+
+            if (RoutedMessage::HeaderSize + message.size() <= m_maxDatagram)
+                return send(owner, RoutedMessage::make(command, connId, message));
+
+            // unique among the senders: the process and a message counter
+            auto tag = static_cast<std::uint64_t>(::getpid()) << 32 | (m_nextTag++ & 0xFFFFFFFF);
+            auto partSize = m_maxDatagram - RoutedMessage::HeaderSize - RoutedMessage::TagSize;
+            for (std::size_t offset = 0; offset < message.size(); offset += partSize)
+            {
+                auto size = std::min(partSize, message.size() - offset);
+                auto isLast = offset + size == message.size();
+                send(owner, RoutedMessage::makeFragment(command, connId, tag, isLast, message.data() + offset, size));
+            }
+        }
+
+    private:
+        static const std::size_t MinDatagram = 4096;
+
+        struct Channel
+        {
+            int readFd;
+            int writeFd;
+        };
+
+        void send(unsigned owner, const std::string& data)
+        {
+            ssize_t n;
+            do n = ::send(m_channels[owner].writeFd, data.data(), data.size(), MSG_NOSIGNAL); while (n < 0 && errno == EINTR);
+            if (n < 0)
+                throw std::runtime_error(std::string("route to worker: ") + std::strerror(errno));
+        }
+
+        void closeAll()
+        {
+            for (auto&& channel : m_channels)
+            {
+                if (channel.readFd >= 0)
+                    ::close(channel.readFd);
+
+                ::close(channel.writeFd);
+            }
+            m_channels.clear();
+        }
+
+        std::vector<Channel> m_channels;
+        unsigned m_workerId{0};
+        unsigned m_generation{0};
+        std::size_t m_maxDatagram{RoutedMessage::MaxSize};
+        std::atomic<std::uint32_t> m_nextTag{0}; // any application thread routes
+    };
+#else
+    class WorkerChannels
+    {
+    public:
+        explicit WorkerChannels(unsigned) { throw std::runtime_error("pre-fork mode is not supported on Windows"); }
+
+        unsigned workerCount() const { return 0; }
+        unsigned workerId() const { return 0; }
+        unsigned generation() const { return 0; }
+        void setWorker(unsigned, unsigned) {}
+        void route(RoutedCommand, ConnectionId, const std::string&) {}
+    };
+#endif
+}}
@@ -7,8 +7,9 @@
 
 namespace websocket
 {
-    using ConnectionId = std::uint32_t;
-    // 1.36 years at 100 new connections per second
+    using ConnectionId = std::uint64_t;
+    // the top 8 bits are the worker number in the pre-fork mode, 0 otherwise
 
-    enum class Event { NewConnection, Message, Disconnect };
+    // Drained - the send queue of the connection is down to ServerOptions::sendLowWaterMark
+    enum class Event { NewConnection, Message, Disconnect, Drained };
 }
@@ -5,26 +5,82 @@
 
 #include "Server.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <functional>
+#include <future>
 #include <memory>
 #include <mutex>
+#include <string>
 #include <thread>
-#include <tuple>
 #include <ostream>
 #include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#if !defined _WIN32
+#include <csignal>
+#include <sys/wait.h>
+#endif
 
 #include "details/Acceptor.hpp"
+#include "details/handoff.hpp"
+#include "details/shm_ring.hpp"
+#include "details/SubmitRing.hpp"
+#include "details/workers.hpp"
 #include "details/ServerLogic.hpp"
 
 namespace websocket
 {
-    class Server::Impl
+    template<typename Traits>
+    class BasicServer<Traits>::Impl
     {
+        using logic_t = details::ServerLogic<Traits>;
+
     public:
+        // `channels` - pre-fork mode, this process is one of the workers
         template<typename Callback>
-        Impl(boost::asio::ip::tcp::endpoint endpoint, std::ostream& log, Callback&& callback)
-            : m_logic{log, std::forward<Callback>(callback)}
-            , m_acceptor{m_ioService, endpoint, m_logic}
+        Impl(boost::asio::ip::tcp::endpoint endpoint, std::ostream& log, const ServerOptions& options, Callback&& callback,
+            std::unique_ptr<details::WorkerChannels> channels = nullptr)
+            : m_shared{makeShared(options, channels.get())}
+            , m_logic{log, workerOptions(options, channels.get()), eventSink(std::forward<Callback>(callback))}
+            , m_acceptor{m_ioService, endpoint, m_logic, channels != nullptr}
+            , m_submitRing{makeSubmitRing(options)}
+            , m_channels{std::move(channels)}
         {
+            if (m_channels)
+            {
+                m_logic.setLastConnId(details::firstConnectionId(m_channels->workerId(), m_channels->generation()));
+                startRouted();
+            }
+
+            if (m_shared)
+                pollShared(options.sharedMemoryPollInterval);
+
+            scheduleTick(std::chrono::steady_clock::now() + logic_t::TickInterval());
+            m_workerThread.reset(new std::thread{[this]{ workerThread(); }});
+        }
+
+        // resumes the listening socket and the connections of the previous process
+        template<typename Callback>
+        Impl(details::HandoffState state, std::ostream& log, const ServerOptions& options, Callback&& callback)
+            : m_shared{makeShared(options, nullptr)}
+            , m_logic{log, options, eventSink(std::forward<Callback>(callback))}
+            , m_acceptor{m_ioService, state.listenerEndpoint, state.listenerFd, m_logic}
+            , m_submitRing{makeSubmitRing(options)}
+        {
+            for (auto&& conn : state.connections)
+            {
+                boost::asio::ip::tcp::socket socket{m_ioService};
+                socket.assign(state.listenerEndpoint.protocol(), conn.fd);
+                m_logic.resume(std::move(socket), conn);
+            }
+            m_logic.setLastConnId(state.lastConnId);
+
+            if (m_shared)
+                pollShared(options.sharedMemoryPollInterval);
+
+            scheduleTick(std::chrono::steady_clock::now() + logic_t::TickInterval());
             m_workerThread.reset(new std::thread{[this]{ workerThread(); }});
         }
 
@@ -34,12 +90,61 @@ namespace websocket
                 stop();
         }
 
+        // stops accepting and parks the connections, called from the application thread
+        details::HandoffState handoff(bool withConnections)
+        {
+            std::promise<details::HandoffState> promise;
+            boost::asio::spawn(m_ioService, [&](boost::asio::yield_context yield)
+            {
+                boost::asio::steady_timer timer{m_ioService};
+                auto&& waitWhile = [&](std::function<bool()> condition)
+                {
+                    while (condition())
+                    {
+                        timer.expires_from_now(std::chrono::milliseconds(1));
+                        timer.async_wait(yield);
+                    }
+                };
+
+                m_acceptor.pause();
+                waitWhile([this] { return m_acceptor.isRunning(); });
+
+                details::HandoffState state;
+                state.listenerFd = m_acceptor.nativeHandle();
+                state.listenerEndpoint = m_acceptor.localEndpoint();
+
+                if (withConnections)
+                {
+                    m_logic.parkAll();
+                    waitWhile([this] { return !m_logic.isParked(); });
+                    m_logic.exportState(state);
+                }
+
+                promise.set_value(std::move(state));
+            });
+
+            return promise.get_future().get();
+        }
+
+        // after the handoff the sockets are closed here without a shutdown
+        void stopAfterHandoff()
+        {
+            enqueue([this] { m_logic.detachExported(); });
+            stop();
+        }
+
         void stop()
         {
+            if (m_isStopped) // already stopped by a handoff
+                return;
+
             enqueue([this]
             {
                 m_isStopped = true;
+                m_tickTimer.cancel();
+                m_sharedTimer.cancel();
                 m_acceptor.stop();
+                closeRouted();
                 m_logic.stop();
             });
 
@@ -48,23 +153,50 @@ namespace websocket
 
         void send(ConnectionId connId, std::string message, bool isBinary)
         {
-            enqueue([=]
+            if (isRemote(connId))
             {
-                if (auto conn = m_logic.find(connId))
-                {
-                    auto op = isBinary ? details::Opcode::Binary : details::Opcode::Text;
-                    conn->sendFrame(op, message);
-                }
-            });
+                auto command = isBinary ? details::RoutedCommand::SendBinary : details::RoutedCommand::SendText;
+                return route(command, connId, message);
+            }
+
+            submit(isBinary ? details::RoutedCommand::SendBinary : details::RoutedCommand::SendText, connId, std::move(message));
+        }
+
+        void broadcast(std::string message, bool isBinary)
+        {
+            submit(isBinary ? details::RoutedCommand::BroadcastBinary : details::RoutedCommand::BroadcastText, 0, std::move(message));
+        }
+
+        void subscribe(ConnectionId connId, std::uint64_t fromOffset)
+        {
+            if (isRemote(connId))
+                return route(details::RoutedCommand::Subscribe, connId, std::to_string(fromOffset));
+
+            submit(details::RoutedCommand::Subscribe, connId, std::to_string(fromOffset));
         }
 
         void drop(ConnectionId connId)
         {
-            enqueue([=]
-            {
-                if (auto conn = m_logic.find(connId))
-                    m_logic.drop(*conn);
-            });
+            if (isRemote(connId))
+                return route(details::RoutedCommand::Drop, connId, {});
+
+            submit(details::RoutedCommand::Drop, connId, {});
+        }
+
+        void setReadingPaused(ConnectionId connId, bool isPaused)
+        {
+            if (isRemote(connId))
+                return route(isPaused ? details::RoutedCommand::PauseReading : details::RoutedCommand::ResumeReading, connId, {});
+
+            submit(isPaused ? details::RoutedCommand::PauseReading : details::RoutedCommand::ResumeReading, connId, {});
+        }
+
+        void setSendClass(ConnectionId connId, unsigned sendClass)
+        {
+            if (isRemote(connId))
+                return route(details::RoutedCommand::SetSendClass, connId, std::to_string(sendClass));
+
+            submit(details::RoutedCommand::SetSendClass, connId, std::to_string(sendClass));
         }
 
     private:
@@ -84,57 +216,453 @@ namespace websocket
             }
         }
 
+        // in the pre-fork mode the shared memory segment and the journal of every worker are
+        // its own, "<name>-<worker>"
+        static std::string workerName(const std::string& name, const details::WorkerChannels* channels)
+        {
+            return channels ? name + "-" + std::to_string(channels->workerId()) : name;
+        }
+
+        static ServerOptions workerOptions(const ServerOptions& options, const details::WorkerChannels* channels)
+        {
+            auto result = options;
+            if (!result.journalPath.empty())
+                result.journalPath = workerName(result.journalPath, channels);
+
+            return result;
+        }
+
+        static std::unique_ptr<details::SharedChannel> makeShared(const ServerOptions& options, const details::WorkerChannels* channels)
+        {
+            if (options.sharedMemory.empty())
+                return nullptr;
+
+            return std::make_unique<details::SharedChannel>(workerName(options.sharedMemory, channels), options.sharedMemoryRingSize, options.sharedMemoryMaxOverflow);
+        }
+
+        // with the shared memory channel the events bypass the poll() queue
+        template<typename Callback>
+        std::function<void(EventRecord)> eventSink(Callback&& callback)
+        {
+            if (!m_shared)
+                return std::forward<Callback>(callback);
+
+            // an application that far behind loses the connection, not the server its memory
+            return [this](EventRecord record)
+            {
+                auto connId = record.connId();
+                if (!m_shared->publish(std::move(record)))
+                {
+                    m_logic.log("#", connId, ": the shared memory application is behind, dropping the connection");
+                    enqueue([this, connId] { m_logic.close(connId); });
+                }
+            };
+        }
+
+        // runs the commands of the application process; while they keep coming the loop
+        // comes back right after the other handlers, otherwise after the poll interval
+        void pollShared(std::chrono::microseconds interval)
+        {
+            const std::size_t maxCommands = 64;
+
+            m_shared->flush();
+            auto n = m_shared->receiveCommands([this](details::RecordType type, ConnectionId connId, const char* data, std::size_t size)
+            {
+                if (type == details::RecordType::Drop)
+                    m_logic.close(connId);
+                else if (type == details::RecordType::SendText)
+                    m_logic.send(connId, details::Opcode::Text, std::string(data, size));
+                else if (type == details::RecordType::SendBinary)
+                    m_logic.send(connId, details::Opcode::Binary, std::string(data, size));
+            }, maxCommands);
+
+            if (n != 0)
+            {
+                enqueue([this, interval]
+                {
+                    if (!m_isStopped)
+                        pollShared(interval);
+                });
+                return;
+            }
+
+            m_sharedTimer.expires_from_now(interval);
+            m_sharedTimer.async_wait([this, interval](const boost::system::error_code& ec)
+            {
+                if (!ec && !m_isStopped)
+                    pollShared(interval);
+            });
+        }
+
+        // the commands for our connections from the application threads and the other workers
+        void runCommand(details::RoutedCommand command, ConnectionId connId, std::string message)
+        {
+            if (command == details::RoutedCommand::Drop)
+                m_logic.close(connId);
+            else if (command == details::RoutedCommand::PauseReading)
+                m_logic.pauseReading(connId);
+            else if (command == details::RoutedCommand::ResumeReading)
+                m_logic.resumeReading(connId);
+            else if (command == details::RoutedCommand::SetSendClass)
+                m_logic.setSendClass(connId, static_cast<unsigned>(std::strtoul(message.c_str(), nullptr, 10)));
+            else if (command == details::RoutedCommand::BroadcastText || command == details::RoutedCommand::BroadcastBinary)
+                m_logic.broadcast(command == details::RoutedCommand::BroadcastBinary ? details::Opcode::Binary : details::Opcode::Text, std::move(message));
+            else if (command == details::RoutedCommand::Subscribe)
+                m_logic.subscribe(connId, std::strtoull(message.c_str(), nullptr, 10));
+            else
+                m_logic.send(connId, command == details::RoutedCommand::SendBinary ? details::Opcode::Binary : details::Opcode::Text, std::move(message));
+        }
+
+        struct Submission
+        {
+            details::RoutedCommand command;
+            ConnectionId connId;
+            std::string message;
+        };
+
+        static std::unique_ptr<details::SubmitRing<Submission>> makeSubmitRing(const ServerOptions& options)
+        {
+            if (options.submitRingSize == 0)
+                return nullptr;
+
+            return std::make_unique<details::SubmitRing<Submission>>(options.submitRingSize);
+        }
+
+        // The commands of the application threads go through the submission ring in their order,
+        // the I/O loop gets one handler for a batch of them instead of one per command.
+        void submit(details::RoutedCommand command, ConnectionId connId, std::string message)
+        {
+            if (!m_submitRing)
+            {
+                auto&& run = [this](details::RoutedCommand command, ConnectionId connId, std::string& message)
+                {
+                    runCommand(command, connId, std::move(message));
+                };
+                enqueue(std::bind(run, command, connId, std::move(message)));
+                return;
+            }
+
+            // after stop() nothing drains the ring, the commands are dropped like the ones in it
+            if (!m_submitRing->push(Submission{command, connId, std::move(message)}, m_isStopped))
+                return;
+
+            if (!m_isDrainScheduled.exchange(true))
+                enqueue([this] { drainSubmitted(); });
+        }
+
+        // a long batch gives way to the other handlers
+        void drainSubmitted()
+        {
+            const std::size_t maxCommands = 64;
+
+            // reads the flag the producers set after their pushes, so their commands are visible
+            m_isDrainScheduled.exchange(false, std::memory_order_acq_rel);
+
+            Submission submission;
+            for (std::size_t n = 0; n != maxCommands; ++n)
+            {
+                if (!m_submitRing->tryPop(submission))
+                    return;
+
+                if (!m_isStopped)
+                    runCommand(submission.command, submission.connId, std::move(submission.message));
+            }
+
+            if (!m_isDrainScheduled.exchange(true))
+                enqueue([this] { drainSubmitted(); });
+        }
+
+        bool isRemote(ConnectionId connId) const
+        {
+            return m_channels && details::workerOf(connId) != m_channels->workerId();
+        }
+
+        void route(details::RoutedCommand command, ConnectionId connId, const std::string& message)
+        {
+            m_channels->route(command, connId, message);
+        }
+
+#if defined _WIN32
+        void startRouted() {}
+        void closeRouted() {}
+#else
+        void startRouted()
+        {
+            m_routedSocket.assign(boost::asio::local::datagram_protocol{}, ::dup(m_channels->readHandle()));
+            m_routedBuffer.resize(details::RoutedMessage::MaxSize);
+            receiveRouted();
+        }
+
+        // send and drop for our connections from the other workers
+        void receiveRouted()
+        {
+            m_routedSocket.async_receive(boost::asio::buffer(m_routedBuffer),
+                [this](const boost::system::error_code& ec, std::size_t bytesTransferred)
+                {
+                    if (ec == boost::asio::error::operation_aborted || m_isStopped)
+                        return;
+
+                    details::RoutedCommand command;
+                    ConnectionId connId;
+                    std::string message;
+                    bool isComplete;
+                    if (ec)
+                        m_logic.log("routed message error: ", ec);
+                    else if (!m_routedAssembler.receive(m_routedBuffer.data(), bytesTransferred, command, connId, message, isComplete))
+                        m_logic.log("invalid routed message");
+                    else if (isComplete)
+                        runCommand(command, connId, std::move(message));
+
+                    receiveRouted();
+                });
+        }
+
+        void closeRouted()
+        {
+            boost::system::error_code ignoreError;
+            m_routedSocket.close(ignoreError);
+        }
+#endif
+
+        // the tick drives the housekeeping and measures how late the loop runs the handlers
+        void scheduleTick(std::chrono::steady_clock::time_point deadline)
+        {
+            m_tickTimer.expires_at(deadline);
+            m_tickTimer.async_wait([this, deadline](const boost::system::error_code& ec)
+            {
+                if (ec || m_isStopped)
+                    return;
+
+                auto now = std::chrono::steady_clock::now();
+                m_logic.onTick(now - deadline);
+                scheduleTick(now + logic_t::TickInterval());
+            });
+        }
+
         template<typename F>
         void enqueue(F&& f)
         {
             m_ioService.post(std::forward<F>(f));
         }
 
-        bool m_isStopped{false};
+        std::atomic<bool> m_isStopped{false}; // the application threads read it too
 
         boost::asio::io_service m_ioService;
+        boost::asio::steady_timer m_tickTimer{m_ioService};
         std::unique_ptr<std::thread> m_workerThread;
 
-        details::ServerLogic m_logic;
-        details::Acceptor<details::ServerLogic> m_acceptor;
+        std::unique_ptr<details::SharedChannel> m_shared;
+        boost::asio::steady_timer m_sharedTimer{m_ioService};
+
+        logic_t m_logic;
+        details::Acceptor<logic_t> m_acceptor;
+
+        std::unique_ptr<details::SubmitRing<Submission>> m_submitRing;
+        std::atomic<bool> m_isDrainScheduled{false};
+
+        std::unique_ptr<details::WorkerChannels> m_channels;
+#if !defined _WIN32
+        boost::asio::local::datagram_protocol::socket m_routedSocket{m_ioService};
+        std::vector<char> m_routedBuffer;
+        details::RoutedAssembler m_routedAssembler;
+#endif
     };
 
-    Server::Server() {}
-    Server::~Server() {}
-    void Server::start(const std::string& ip, unsigned short port, std::ostream& log)
+    template<typename Traits> BasicServer<Traits>::BasicServer() {}
+    template<typename Traits> BasicServer<Traits>::~BasicServer() {}
+
+    template<typename Traits>
+    void BasicServer<Traits>::start(const std::string& ip, unsigned short port, std::ostream& log, const ServerOptions& options)
     {
         assert(!m_impl);
 
-        auto&& callback = [this](Event event, ConnectionId connId, std::string message)
+        boost::asio::ip::tcp::endpoint endpoint{boost::asio::ip::address_v4::from_string(ip), port};
+        m_impl = std::make_unique<Impl>(endpoint, log, options, [this](EventRecord record)
         {
-            decltype(m_queue) tmpList;
-            tmpList.emplace_back(event, connId, std::move(message));
+            pushEvent(std::move(record));
+        });
+    }
 
-            std::lock_guard<std::mutex> lock{m_mutex};
-            m_queue.splice(end(m_queue), tmpList);
-        };
+    template<typename Traits>
+    void BasicServer<Traits>::pushEvent(EventRecord record)
+    {
+        std::lock_guard<std::mutex> lock{m_mutex};
+        m_queue.push_back(std::move(record));
+    }
 
-        boost::asio::ip::tcp::endpoint endpoint{boost::asio::ip::address_v4::from_string(ip), port};
-        m_impl = std::make_unique<Impl>(endpoint, log, callback);
+#if defined _WIN32
+    template<typename Traits>
+    int BasicServer<Traits>::startWorkers(const std::string&, unsigned short, std::ostream&, unsigned, const ServerOptions&)
+    {
+        throw std::runtime_error("pre-fork mode is not supported on Windows");
     }
-    void Server::stop() { m_impl->stop(); }
-    void Server::sendText(ConnectionId connId, std::string message) { m_impl->send(connId, std::move(message), false); }
-    void Server::sendBinary(ConnectionId connId, std::string message) { m_impl->send(connId, std::move(message), true); }
-    void Server::drop(ConnectionId connId) { m_impl->drop(connId); }
 
-    bool Server::poll(Event& event, ConnectionId& connId, std::string& message)
+    template<typename Traits>
+    void BasicServer<Traits>::handoff(const std::string&, bool)
     {
-        decltype(m_queue) tmpList;
+        throw std::runtime_error("handoff is not supported on Windows");
+    }
 
+    template<typename Traits>
+    void BasicServer<Traits>::resume(const std::string&, std::ostream&, const ServerOptions&)
+    {
+        throw std::runtime_error("handoff is not supported on Windows");
+    }
+#else
+    template<typename Traits>
+    int BasicServer<Traits>::startWorkers(const std::string& ip, unsigned short port, std::ostream& log, unsigned workerCount, const ServerOptions& options)
+    {
+        assert(!m_impl);
+
+        // created before forking, the workers and their replacements inherit them
+        auto channels = std::make_unique<details::WorkerChannels>(workerCount);
+        std::vector<pid_t> workers(workerCount, 0);
+        std::vector<unsigned> generations(workerCount, 0); // restarts of each worker
+
+        // returns true in the new worker
+        auto&& spawnWorker = [&](unsigned workerId)
         {
-            std::lock_guard<std::mutex> lock{m_mutex};
-            if (m_queue.empty())
+            auto pid = ::fork();
+            if (pid < 0)
+                throw std::runtime_error(std::string("fork: ") + std::strerror(errno));
+
+            if (pid != 0)
+            {
+                workers[workerId] = pid;
                 return false;
+            }
+
+            channels->setWorker(workerId, generations[workerId]);
+            boost::asio::ip::tcp::endpoint endpoint{boost::asio::ip::address_v4::from_string(ip), port};
+            m_impl = std::make_unique<Impl>(endpoint, log, options, [this](EventRecord record)
+            {
+                pushEvent(std::move(record));
+            }, std::move(channels));
+            return true;
+        };
+
+        for (unsigned i = 0; i != workerCount; ++i)
+        {
+            if (spawnWorker(i))
+                return i;
+        }
+
+        // supervisor: a worker that exits with 0 or is terminated is done, any other exit is a crash
+        for (auto running = workerCount; running != 0;)
+        {
+            int status;
+            auto pid = ::waitpid(-1, &status, 0);
+            if (pid < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                throw std::runtime_error(std::string("waitpid: ") + std::strerror(errno));
+            }
+
+            auto iter = std::find(begin(workers), end(workers), pid);
+            if (iter == end(workers))
+                continue;
+
+            auto workerId = static_cast<unsigned>(iter - begin(workers));
+            auto isDone = WIFEXITED(status)
+                ? WEXITSTATUS(status) == 0
+                : WTERMSIG(status) == SIGTERM || WTERMSIG(status) == SIGINT;
+
+            if (isDone)
+            {
+                *iter = 0;
+                --running;
+                continue;
+            }
+
+            log << "worker " << workerId << " crashed, restarting" << std::endl;
+            std::this_thread::sleep_for(std::chrono::milliseconds(100)); // no fork storm if it crashes on start
+            ++generations[workerId];
+            if (spawnWorker(workerId))
+                return workerId;
+        }
+
+        return -1;
+    }
 
-            tmpList.splice(begin(tmpList), m_queue, begin(m_queue));
+    template<typename Traits>
+    void BasicServer<Traits>::handoff(const std::string& socketPath, bool withConnections)
+    {
+        auto peer = details::handoff::acceptPeer(socketPath);
+        try
+        {
+            auto state = m_impl->handoff(withConnections);
+            details::handoff::sendState(peer, state);
+        }
+        catch (...)
+        {
+            ::close(peer);
+            throw;
         }
-        
-        std::tie(event, connId, message) = std::move(tmpList.front());
+        ::close(peer);
+
+        if (withConnections)
+            m_impl->stopAfterHandoff();
+    }
+
+    template<typename Traits>
+    void BasicServer<Traits>::resume(const std::string& socketPath, std::ostream& log, const ServerOptions& options)
+    {
+        assert(!m_impl);
+
+        details::HandoffState state;
+        auto peer = details::handoff::connectPeer(socketPath);
+        try
+        {
+            state = details::handoff::recvState(peer);
+        }
+        catch (...)
+        {
+            ::close(peer);
+            throw;
+        }
+        ::close(peer); // lets the old process go
+
+        m_impl = std::make_unique<Impl>(std::move(state), log, options, [this](EventRecord record)
+        {
+            pushEvent(std::move(record));
+        });
+    }
+#endif
+    template<typename Traits> void BasicServer<Traits>::stop() { m_impl->stop(); }
+    template<typename Traits> void BasicServer<Traits>::sendText(ConnectionId connId, std::string message) { m_impl->send(connId, std::move(message), false); }
+    template<typename Traits> void BasicServer<Traits>::sendBinary(ConnectionId connId, std::string message) { m_impl->send(connId, std::move(message), true); }
+    template<typename Traits> void BasicServer<Traits>::drop(ConnectionId connId) { m_impl->drop(connId); }
+    template<typename Traits> void BasicServer<Traits>::pauseReading(ConnectionId connId) { m_impl->setReadingPaused(connId, true); }
+    template<typename Traits> void BasicServer<Traits>::resumeReading(ConnectionId connId) { m_impl->setReadingPaused(connId, false); }
+    template<typename Traits> void BasicServer<Traits>::setSendClass(ConnectionId connId, unsigned sendClass) { m_impl->setSendClass(connId, sendClass); }
+    template<typename Traits> void BasicServer<Traits>::broadcastText(std::string message) { m_impl->broadcast(std::move(message), false); }
+    template<typename Traits> void BasicServer<Traits>::broadcastBinary(std::string message) { m_impl->broadcast(std::move(message), true); }
+    template<typename Traits> void BasicServer<Traits>::subscribe(ConnectionId connId, std::uint64_t fromOffset) { m_impl->subscribe(connId, fromOffset); }
+
+    template<typename Traits>
+    bool BasicServer<Traits>::poll(EventRecord& record)
+    {
+        std::lock_guard<std::mutex> lock{m_mutex};
+        if (m_queue.empty())
+            return false;
+
+        record = std::move(m_queue.front());
+        m_queue.pop_front();
+        return true;
+    }
+
+    template<typename Traits>
+    bool BasicServer<Traits>::poll(Event& event, ConnectionId& connId, std::string& message)
+    {
+        EventRecord record;
+        if (!poll(record))
+            return false;
+
+        event = record.event();
+        connId = record.connId();
+        message = record.takeMessage();
         return true;
     }
 }
\ No newline at end of file
@@ -0,0 +1,140 @@
+#include "details/AdmissionControl.hpp"
+
+#include "catch_wrap.hpp"
+
+namespace ws_details = websocket::details;
+
+namespace
+{
+    using steady_clock_t = ws_details::AdmissionControl::clock_t;
+
+    boost::asio::ip::address ip(const char* s)
+    {
+        return boost::asio::ip::address::from_string(s);
+    }
+}
+
+TEST_CASE("Admission: unlimited by default", "[websocket]")
+{
+    websocket::ServerOptions options;
+    ws_details::AdmissionControl admission{options};
+    auto now = steady_clock_t::now();
+
+    for (auto i = 0; i != 100; ++i)
+    {
+        REQUIRE(admission.admitGlobal(i, now));
+        REQUIRE(admission.admit(ip("10.0.0.1"), now));
+    }
+}
+
+TEST_CASE("Admission: global limits", "[websocket]")
+{
+    websocket::ServerOptions options;
+    options.maxConnections = 2;
+    options.acceptRate = {10, 3};
+    ws_details::AdmissionControl admission{options};
+    auto now = steady_clock_t::now();
+
+    REQUIRE_FALSE(admission.admitGlobal(2, now));
+    REQUIRE(admission.admitGlobal(0, now));
+    REQUIRE(admission.admitGlobal(0, now));
+    REQUIRE(admission.admitGlobal(0, now));
+    REQUIRE_FALSE(admission.admitGlobal(0, now));
+
+    now += std::chrono::milliseconds(100); // one token
+    REQUIRE(admission.admitGlobal(0, now));
+    REQUIRE_FALSE(admission.admitGlobal(0, now));
+}
+
+TEST_CASE("Admission: connections per IP", "[websocket]")
+{
+    websocket::ServerOptions options;
+    options.maxConnectionsPerIp = 2;
+    ws_details::AdmissionControl admission{options};
+    auto now = steady_clock_t::now();
+
+    REQUIRE(admission.admit(ip("10.0.0.1"), now));
+    REQUIRE(admission.admit(ip("10.0.0.1"), now));
+    REQUIRE_FALSE(admission.admit(ip("10.0.0.1"), now));
+
+    REQUIRE(admission.admit(ip("10.0.0.2"), now));
+    REQUIRE(admission.admit(ip("::ffff:10.0.0.3"), now));
+    REQUIRE(admission.admit(ip("10.0.0.3"), now));
+    REQUIRE_FALSE(admission.admit(ip("10.0.0.3"), now));
+
+    admission.release(ip("10.0.0.1"));
+    REQUIRE(admission.admit(ip("10.0.0.1"), now));
+    REQUIRE_FALSE(admission.admit(ip("10.0.0.1"), now));
+}
+
+TEST_CASE("Admission: rate per IP", "[websocket]")
+{
+    websocket::ServerOptions options;
+    options.acceptRatePerIp = {1, 2};
+    ws_details::AdmissionControl admission{options};
+    auto now = steady_clock_t::now();
+
+    REQUIRE(admission.admit(ip("10.0.0.1"), now));
+    REQUIRE(admission.admit(ip("10.0.0.1"), now));
+    REQUIRE_FALSE(admission.admit(ip("10.0.0.1"), now));
+    REQUIRE(admission.admit(ip("fe80::1"), now));
+
+    now += std::chrono::seconds(1);
+    REQUIRE(admission.admit(ip("10.0.0.1"), now));
+    REQUIRE_FALSE(admission.admit(ip("10.0.0.1"), now));
+}
+
+TEST_CASE("Admission: full table", "[websocket]")
+{
+    websocket::ServerOptions options;
+    options.maxConnectionsPerIp = 1;
+    options.ipTableSize = 8;
+    ws_details::AdmissionControl admission{options};
+    auto now = steady_clock_t::now();
+
+    // every slot is taken by an address with a live connection
+    for (auto i = 1; i <= 8; ++i)
+        REQUIRE(admission.admit(ip(("10.0.1." + std::to_string(i)).c_str()), now));
+
+    // more live addresses than the table holds are turned away, not left unlimited
+    for (auto i = 1; i <= 8; ++i)
+        REQUIRE_FALSE(admission.admit(ip(("10.0.2." + std::to_string(i)).c_str()), now));
+
+    // a released address is evicted first, even before the idle timeout
+    admission.release(ip("10.0.1.1"));
+    now += std::chrono::seconds(1);
+    REQUIRE(admission.admit(ip("10.0.2.1"), now));
+    REQUIRE_FALSE(admission.admit(ip("10.0.2.1"), now));
+    REQUIRE_FALSE(admission.admit(ip("10.0.2.2"), now));
+
+    // and so is an idle one
+    admission.release(ip("10.0.1.2"));
+    now += options.ipIdleTimeout + std::chrono::seconds(1);
+    REQUIRE(admission.admit(ip("10.0.2.2"), now));
+    REQUIRE_FALSE(admission.admit(ip("10.0.2.2"), now));
+}
+
+TEST_CASE("Token bucket: wait time", "[websocket]")
+{
+    websocket::RateLimit limit{10, 2};
+    ws_details::TokenBucket bucket;
+    auto now = steady_clock_t::now();
+    bucket.reset(limit, now);
+
+    REQUIRE(bucket.waitTime(limit, now, 2) == steady_clock_t::duration::zero());
+    bucket.take(limit, 2);
+    REQUIRE(bucket.waitTime(limit, now) == std::chrono::milliseconds(100));
+
+    // more than the bucket holds waits for a full bucket
+    now += std::chrono::milliseconds(100);
+    REQUIRE(bucket.waitTime(limit, now, 100) == std::chrono::milliseconds(100));
+
+    now += std::chrono::milliseconds(100);
+    REQUIRE(bucket.waitTime(limit, now, 100) == steady_clock_t::duration::zero());
+
+    // but it is charged in full, the debt of 98 tokens is paid off before the next one
+    bucket.take(limit, 100);
+    REQUIRE(bucket.waitTime(limit, now) == std::chrono::milliseconds(9900));
+    now += std::chrono::milliseconds(9800);
+    REQUIRE(bucket.waitTime(limit, now) == std::chrono::milliseconds(100));
+}
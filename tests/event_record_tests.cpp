@@ -0,0 +1,105 @@
+#include "EventRecord.hpp"
+#include "details/RingQueue.hpp"
+
+#include "catch_wrap.hpp"
+
+namespace ws_details = websocket::details;
+
+TEST_CASE("Event record inline payload", "[websocket]")
+{
+    auto now = std::chrono::steady_clock::now();
+    websocket::EventRecord record{websocket::Event::Message, 7, "hello", true, now};
+
+    REQUIRE(record.event() == websocket::Event::Message);
+    REQUIRE(record.connId() == 7);
+    REQUIRE(record.isBinary());
+    REQUIRE(record.receivedAt() == now);
+    REQUIRE(record.message() == "hello");
+
+    auto copy = record;
+    REQUIRE(copy.message() == "hello");
+    REQUIRE(copy.data() != record.data());
+
+    websocket::EventRecord empty;
+    REQUIRE(empty.size() == 0);
+    REQUIRE(empty.message().empty());
+}
+
+TEST_CASE("Event record decoded payload", "[websocket]")
+{
+    auto record = websocket::EventRecord::fromDecoded(3, std::make_shared<int>(42), false);
+    REQUIRE(record.event() == websocket::Event::Message);
+    REQUIRE(record.connId() == 3);
+    REQUIRE(record.isDecoded());
+    REQUIRE(*record.decoded<int>() == 42);
+    REQUIRE(record.size() == 0);
+
+    // copies share the object
+    auto copy = record;
+    REQUIRE(copy.decoded<int>() == record.decoded<int>());
+
+    auto moved = std::move(copy);
+    REQUIRE_FALSE(copy.isDecoded());
+    REQUIRE(moved.decoded<int>() == record.decoded<int>());
+
+    REQUIRE(moved.takeMessage().empty());
+    REQUIRE_FALSE(moved.isDecoded());
+    REQUIRE(moved.decoded<int>() == nullptr);
+
+    websocket::EventRecord text{websocket::Event::Message, 3, "42", false, std::chrono::steady_clock::now(), 5};
+    REQUIRE(text.route() == 5);
+    REQUIRE(websocket::EventRecord{text}.route() == 5);
+    REQUIRE_FALSE(text.isDecoded());
+    REQUIRE(text.decoded<int>() == nullptr);
+}
+
+TEST_CASE("Event record large payload", "[websocket]")
+{
+    std::string payload(websocket::EventRecord::InlineSize + 1, 'x');
+    websocket::EventRecord record{websocket::Event::Message, 1, payload};
+    REQUIRE_FALSE(record.isBinary());
+    REQUIRE(record.message() == payload);
+
+    // copies share the buffer
+    auto copy = record;
+    REQUIRE(copy.data() == record.data());
+    REQUIRE(copy.takeMessage() == payload);
+    REQUIRE(copy.size() == 0);
+    REQUIRE(record.message() == payload);
+
+    copy = record;
+
+    auto moved = std::move(copy);
+    REQUIRE(copy.size() == 0);
+    REQUIRE(moved.data() == record.data());
+
+    record = websocket::EventRecord{};
+    REQUIRE(moved.takeMessage() == payload);
+    REQUIRE(moved.size() == 0);
+}
+
+TEST_CASE("Ring queue", "[websocket]")
+{
+    ws_details::RingQueue<int> queue;
+    REQUIRE(queue.empty());
+
+    // wraps around, then grows while wrapped
+    for (auto i = 0; i != 10; ++i)
+        queue.push_back(i);
+    for (auto i = 0; i != 10; ++i)
+    {
+        REQUIRE(queue.front() == i);
+        queue.pop_front();
+    }
+
+    for (auto i = 0; i != 40; ++i)
+        queue.push_back(i);
+    REQUIRE(queue.size() == 40);
+
+    for (auto i = 0; i != 40; ++i)
+    {
+        REQUIRE(queue.front() == i);
+        queue.pop_front();
+    }
+    REQUIRE(queue.empty());
+}
@@ -6,9 +6,23 @@ namespace ws_details = websocket::details;
 
 namespace
 {
-    struct FrameReceiverFixture
+    template<std::size_t N>
+    std::string str(const char(&s)[N])
     {
-        ws_details::FrameReceiver receiver;
+        return{s, s + N - 1};
+    }
+
+    struct LargeFrameTraits : websocket::DefaultServerTraits
+    {
+        static const std::size_t MaxPayloadLen = 0x10000;
+        static const std::size_t BufferSize = 1 + 1 + 8 + 4 + MaxPayloadLen;
+        static const bool Fragmentation = true;
+    };
+
+    template<typename Traits>
+    struct BasicFrameReceiverFixture
+    {
+        ws_details::BasicFrameReceiver<Traits> receiver;
 
         template<std::size_t N>
         std::size_t write(const char(&data)[N])
@@ -25,6 +39,9 @@ namespace
             return receiver.needReceiveMore(dataSize);
         };
     };
+
+    using FrameReceiverFixture = BasicFrameReceiverFixture<websocket::DefaultServerTraits>;
+    using LargeFrameReceiverFixture = BasicFrameReceiverFixture<LargeFrameTraits>;
 }
 
 TEST_CASE_METHOD(FrameReceiverFixture, "is frame complete", "[websocket]")
@@ -78,6 +95,41 @@ TEST_CASE_METHOD(FrameReceiverFixture, "unmask", "[websocket]")
     REQUIRE(receiver.message() == "01234");
 }
 
+TEST_CASE_METHOD(LargeFrameReceiverFixture, "16-bit length", "[websocket]")
+{
+    REQUIRE(write_n_check_more("\x82\xfe") == 2);
+    REQUIRE(write_n_check_more("\x82\xfe\x01\x00") == 4 + 256);
+    REQUIRE(receiver.isValidFrame(4));
+
+    receiver.addBytes(write("\x82\xfe\x01\x00KKKK"));
+    REQUIRE(receiver.payloadLen() == 256);
+    REQUIRE(receiver.needReceiveMore(0) == 256);
+}
+
+TEST_CASE_METHOD(LargeFrameReceiverFixture, "64-bit length", "[websocket]")
+{
+    REQUIRE(write_n_check_more("\x82\xff\x00\x00\x00\x00\x00\x01\x00\x00") == 4 + 0x10000);
+
+    REQUIRE(write_n_check_more("\x82\xff\x00\x00\x00\x00\x00\x01\x00\x01") == 0);
+    REQUIRE_FALSE(receiver.isValidFrame(10));
+
+    REQUIRE(write_n_check_more("\x82\xff\x80\x00\x00\x00\x00\x00\x00\x00") == 0);
+    REQUIRE_FALSE(receiver.isValidFrame(10));
+}
+
+TEST_CASE_METHOD(LargeFrameReceiverFixture, "fragments", "[websocket]")
+{
+    REQUIRE(write_n_check_more("\x01\x81KKKKD") == 0);
+    REQUIRE(receiver.isValidFrame(7));
+
+    // control frames are neither fragmented nor long
+    REQUIRE(write_n_check_more("\x09\x80KKKK") == 0);
+    REQUIRE_FALSE(receiver.isValidFrame(6));
+
+    REQUIRE(write_n_check_more("\x89\xfe\x00\x80") == 0);
+    REQUIRE_FALSE(receiver.isValidFrame(4));
+}
+
 TEST_CASE("ServerFrame construction", "[websocket]")
 {
     auto&& test = [](unsigned dataLen, unsigned expectedHeaderLen, const char* expectedHeader)
@@ -99,3 +151,25 @@ TEST_CASE("ServerFrame construction", "[websocket]")
     test(0x10000, 10, "\x81\x7f\x00\x00\x00\x00\x00\x01\x00\x00");
     test(0x100ff, 10, "\x81\x7f\x00\x00\x00\x00\x00\x01\x00\xff");
 }
+
+TEST_CASE("Close frame payload", "[websocket]")
+{
+    std::uint16_t code;
+
+    REQUIRE(ws_details::parseClosePayload("", code));
+    REQUIRE(code == 0);
+
+    REQUIRE(ws_details::parseClosePayload(str("\x03\xE9"), code));
+    REQUIRE(code == 1001);
+
+    REQUIRE(ws_details::parseClosePayload(str("\x0F\xA0" "bye"), code));
+    REQUIRE(code == 4000);
+
+    REQUIRE_FALSE(ws_details::parseClosePayload("\x03", code));
+    REQUIRE_FALSE(ws_details::parseClosePayload(str("\x03\xED"), code)); // 1005
+    REQUIRE_FALSE(ws_details::parseClosePayload(str("\x00\x01"), code));
+    REQUIRE_FALSE(ws_details::parseClosePayload(str("\x13\x88"), code)); // 5000
+
+    REQUIRE(ws_details::makeClosePayload(ws_details::CloseCode::PolicyViolation, "slow down") == str("\x03\xF0" "slow down"));
+    REQUIRE(ws_details::makeClosePayload(0).empty());
+}
@@ -0,0 +1,62 @@
+#include "HandlerPool.hpp"
+
+#include "catch_wrap.hpp"
+
+#include <map>
+#include <set>
+
+TEST_CASE("Handler pool keeps the order of a connection", "[websocket]")
+{
+    const websocket::ConnectionId connCount = 8;
+    const int messageCount = 50;
+
+    std::mutex mutex;
+    std::map<websocket::ConnectionId, std::vector<std::string>> handled;
+    std::set<std::thread::id> threads;
+    std::atomic<int> running{0};
+    bool isOverlapped = false;
+
+    {
+        websocket::HandlerPool pool{4, [&](websocket::EventRecord& record)
+        {
+            auto active = ++running;
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+
+            std::lock_guard<std::mutex> lock{mutex};
+            handled[record.connId()].push_back(record.message());
+            threads.insert(std::this_thread::get_id());
+            isOverlapped = isOverlapped || active > 1;
+            --running;
+        }};
+
+        for (int i = 0; i != messageCount; ++i)
+        {
+            for (websocket::ConnectionId connId = 1; connId <= connCount; ++connId)
+                pool.dispatch(websocket::EventRecord{websocket::Event::Message, connId, std::to_string(i)});
+        }
+
+        pool.waitIdle();
+        REQUIRE(handled.size() == connCount);
+
+        // the pool still works after a connection is gone
+        pool.dispatch(websocket::EventRecord{websocket::Event::Disconnect, 1});
+        pool.dispatch(websocket::EventRecord{websocket::Event::Message, 2, "last"});
+    }
+
+    for (auto&& pair : handled)
+    {
+        auto&& messages = pair.second;
+        if (pair.first == 1 || pair.first == 2)
+        {
+            REQUIRE(messages.back() == (pair.first == 1 ? "" : "last")); // Disconnect has no message
+            messages.pop_back();
+        }
+
+        REQUIRE(messages.size() == messageCount);
+        for (int i = 0; i != messageCount; ++i)
+            REQUIRE(messages[i] == std::to_string(i));
+    }
+
+    REQUIRE(threads.size() > 1);
+    REQUIRE(isOverlapped);
+}
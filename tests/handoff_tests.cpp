@@ -0,0 +1,47 @@
+#include "details/handoff.hpp"
+
+#include "catch_wrap.hpp"
+
+#if defined __linux__
+#include <dirent.h>
+
+namespace ws_details = websocket::details;
+
+namespace
+{
+    std::size_t openFdCount()
+    {
+        std::size_t count = 0;
+        auto dir = ::opendir("/proc/self/fd");
+        while (::readdir(dir))
+            ++count;
+
+        ::closedir(dir);
+        return count;
+    }
+}
+
+TEST_CASE("failed handoff closes the received descriptors", "[websocket]")
+{
+    int peers[2];
+    REQUIRE(::socketpair(AF_UNIX, SOCK_STREAM, 0, peers) == 0);
+    int pipeFds[2];
+    REQUIRE(::pipe(pipeFds) == 0);
+
+    ws_details::handoff::Writer listener{ws_details::handoff::RecordType::Listener};
+    listener.putEndpoint({boost::asio::ip::address_v4::loopback(), 8080});
+    ws_details::handoff::sendRecord(peers[0], listener.data(), pipeFds[0]);
+
+    // a connection record cut short, with its socket
+    ws_details::handoff::Writer connection{ws_details::handoff::RecordType::Connection};
+    connection.put<std::uint64_t>(1);
+    ws_details::handoff::sendRecord(peers[0], connection.data(), pipeFds[1]);
+
+    auto fdCount = openFdCount();
+    REQUIRE_THROWS(ws_details::handoff::recvState(peers[1]));
+    REQUIRE(openFdCount() == fdCount);
+
+    for (auto fd : {peers[0], peers[1], pipeFds[0], pipeFds[1]})
+        ::close(fd);
+}
+#endif
@@ -0,0 +1,29 @@
+#include "details/Histogram.hpp"
+
+#include "catch_wrap.hpp"
+
+namespace ws_details = websocket::details;
+
+TEST_CASE("Histogram buckets", "[websocket]")
+{
+    ws_details::Histogram histogram;
+    histogram.record(0);
+    histogram.record(1);
+    histogram.record(2);
+    histogram.record(3);
+    histogram.record(1000);
+    histogram.record(UINT64_MAX);
+
+    REQUIRE(histogram.count() == 6);
+    REQUIRE(histogram.bucket(0) == 2);
+    REQUIRE(histogram.bucket(1) == 2);
+    REQUIRE(histogram.bucket(9) == 1); // 512..1023
+    REQUIRE(histogram.bucket(ws_details::Histogram::BucketCount - 1) == 1);
+    REQUIRE(ws_details::Histogram::upperBound(9) == 1024);
+
+    ws_details::Histogram other;
+    other.record(1000);
+    histogram.merge(other);
+    REQUIRE(histogram.count() == 7);
+    REQUIRE(histogram.bucket(9) == 2);
+}
@@ -0,0 +1,95 @@
+#include "details/hpack.hpp"
+
+#include "catch_wrap.hpp"
+
+namespace ws_details = websocket::details;
+
+namespace
+{
+    using headers_t = std::vector<std::pair<std::string, std::string>>;
+
+    std::string fromHex(const std::string& hex)
+    {
+        std::string bytes;
+        for (std::size_t i = 0; i + 1 < hex.size(); i += 2)
+            bytes.push_back(static_cast<char>(std::stoi(hex.substr(i, 2), nullptr, 16)));
+
+        return bytes;
+    }
+
+    bool decode(ws_details::HpackDecoder& decoder, const std::string& hex, headers_t& headers)
+    {
+        auto bytes = fromHex(hex);
+        std::vector<ws_details::HeaderField> fields;
+        if (!decoder.decode(reinterpret_cast<const std::uint8_t*>(bytes.data()), bytes.size(), fields))
+            return false;
+
+        headers.clear();
+        for (auto&& field : fields)
+            headers.emplace_back(field.name, field.value);
+
+        return true;
+    }
+}
+
+TEST_CASE("HPACK: requests without Huffman", "[websocket]")
+{
+    // RFC 7541 C.3, the dynamic table carries over between the requests
+    ws_details::HpackDecoder decoder;
+    headers_t headers;
+
+    REQUIRE(decode(decoder, "828684410f7777772e6578616d706c652e636f6d", headers));
+    REQUIRE(headers == headers_t{{":method", "GET"}, {":scheme", "http"}, {":path", "/"}, {":authority", "www.example.com"}});
+
+    REQUIRE(decode(decoder, "828684be58086e6f2d6361636865", headers));
+    REQUIRE(headers == headers_t{{":method", "GET"}, {":scheme", "http"}, {":path", "/"}, {":authority", "www.example.com"},
+        {"cache-control", "no-cache"}});
+
+    REQUIRE(decode(decoder, "828785bf400a637573746f6d2d6b65790c637573746f6d2d76616c7565", headers));
+    REQUIRE(headers == headers_t{{":method", "GET"}, {":scheme", "https"}, {":path", "/index.html"}, {":authority", "www.example.com"},
+        {"custom-key", "custom-value"}});
+}
+
+TEST_CASE("HPACK: requests with Huffman", "[websocket]")
+{
+    // RFC 7541 C.4
+    ws_details::HpackDecoder decoder;
+    headers_t headers;
+
+    REQUIRE(decode(decoder, "828684418cf1e3c2e5f23a6ba0ab90f4ff", headers));
+    REQUIRE(headers == headers_t{{":method", "GET"}, {":scheme", "http"}, {":path", "/"}, {":authority", "www.example.com"}});
+
+    REQUIRE(decode(decoder, "828684be5886a8eb10649cbf", headers));
+    REQUIRE(headers.back() == std::make_pair(std::string{"cache-control"}, std::string{"no-cache"}));
+
+    REQUIRE(decode(decoder, "828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf", headers));
+    REQUIRE(headers.back() == std::make_pair(std::string{"custom-key"}, std::string{"custom-value"}));
+
+    // the name of a static entry that has a value
+    REQUIRE(decode(decoder, "4287bdab4e9c17b7ff", headers));
+    REQUIRE(headers == headers_t{{":method", "CONNECT"}});
+
+    // the longest codes
+    REQUIRE(decode(decoder, "4081f38fffc7fff1ffffe3ffd53fff8ffffbbf", headers));
+    REQUIRE(headers == headers_t{{"x", std::string{"\x00\xc3\xbf~ \xc3\xa9", 7}}});
+}
+
+TEST_CASE("HPACK: invalid blocks", "[websocket]")
+{
+    ws_details::HpackDecoder decoder;
+    headers_t headers;
+
+    REQUIRE_FALSE(decode(decoder, "80", headers));          // index 0
+    REQUIRE_FALSE(decode(decoder, "be", headers));          // empty dynamic table
+    REQUIRE_FALSE(decode(decoder, "400a637573", headers));  // truncated string
+    REQUIRE_FALSE(decode(decoder, "3fe21f", headers));      // table size over the limit
+    REQUIRE_FALSE(decode(decoder, "0081f081f3", headers));  // Huffman padding of zeros
+    REQUIRE_FALSE(decode(decoder, "00017884ffffffff", headers)); // EOS
+}
+
+TEST_CASE("HPACK: status", "[websocket]")
+{
+    REQUIRE(ws_details::encodeStatus(200) == "\x88");
+    REQUIRE(ws_details::encodeStatus(404) == "\x8d");
+    REQUIRE(ws_details::encodeStatus(405) == std::string{"\x08\x03" "405"});
+}
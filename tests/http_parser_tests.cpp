@@ -48,4 +48,18 @@ TEST_CASE("headers", "[http][parser]")
 
     stream.peek();
     REQUIRE(stream.eof());
-}
\ No newline at end of file
+}
+
+TEST_CASE("session headers", "[http][parser]")
+{
+    http::Request rq;
+
+    std::stringstream stream(
+        "X-WebSocket-Session: 0123456789abcdef\r\n"
+        "X-WebSocket-Last-Seq: 42\r\n"
+        "\r\n");
+
+    REQUIRE(http::parser::parseRequestHeaders(stream, rq));
+    REQUIRE(rq.sessionToken == "0123456789abcdef");
+    REQUIRE(rq.lastSeq == 42);
+}
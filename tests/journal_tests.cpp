@@ -0,0 +1,122 @@
+#include "details/Journal.hpp"
+
+#include "catch_wrap.hpp"
+
+#include <cstdio>
+#include <vector>
+
+#if defined __linux__
+#include <sys/stat.h>
+#endif
+
+namespace ws_details = websocket::details;
+
+namespace
+{
+    struct JournalFixture
+    {
+        const std::string path = "websocket-journal-test";
+
+        JournalFixture() { removeSegments(); }
+        ~JournalFixture() { removeSegments(); }
+
+        void removeSegments()
+        {
+            for (auto i = 0; i != 10; ++i)
+            {
+                char suffix[32];
+                std::snprintf(suffix, sizeof(suffix), ".%06d.log", i);
+                std::remove((path + suffix).c_str());
+            }
+        }
+
+        static std::string message(int i)
+        {
+            return std::string(40 + i, char('a' + i));
+        }
+
+        static std::string framed(int i)
+        {
+            ws_details::ServerFrame frame{ws_details::Opcode::Text, message(i)};
+            return std::string(reinterpret_cast<const char*>(frame.m_header), frame.m_headerLen) + frame.m_data;
+        }
+
+        static std::string read(const ws_details::Journal& journal, std::uint64_t offset)
+        {
+            std::string bytes;
+            journal.read(offset, [&](std::shared_ptr<const ws_details::Journal::Segment>, const char* data, std::size_t size)
+            {
+                bytes.append(data, size);
+            });
+            return bytes;
+        }
+    };
+}
+
+TEST_CASE_METHOD(JournalFixture, "journal appends frames", "[websocket]")
+{
+    ws_details::Journal journal{path, 256};
+    REQUIRE(journal.endOffset() == 0);
+    REQUIRE(read(journal, 0).empty());
+
+    // 3 frames a segment
+    for (auto i = 0; i != 8; ++i)
+    {
+        auto appended = journal.append(ws_details::ServerFrame{ws_details::Opcode::Text, message(i)});
+        REQUIRE(std::string(appended.bytes, framed(i).size()) == framed(i));
+    }
+    REQUIRE(journal.endOffset() == 8);
+
+    std::string all;
+    for (auto i = 0; i != 8; ++i)
+        all += framed(i);
+
+    REQUIRE(read(journal, 0) == all);
+    REQUIRE(read(journal, 4) == all.substr(framed(0).size() + framed(1).size() + framed(2).size() + framed(3).size()));
+    REQUIRE(read(journal, 7) == framed(7));
+    REQUIRE(read(journal, 8).empty());
+
+    REQUIRE_THROWS_AS(journal.append(ws_details::ServerFrame{ws_details::Opcode::Text, std::string(300, 'x')}), std::length_error);
+}
+
+TEST_CASE_METHOD(JournalFixture, "journal is recovered", "[websocket]")
+{
+    {
+        ws_details::Journal journal{path, 256};
+        for (auto i = 0; i != 5; ++i)
+            journal.append(ws_details::ServerFrame{ws_details::Opcode::Text, message(i)});
+    }
+
+    ws_details::Journal journal{path, 256};
+    REQUIRE(journal.endOffset() == 5);
+    REQUIRE(read(journal, 4) == framed(4));
+
+    journal.append(ws_details::ServerFrame{ws_details::Opcode::Text, message(5)});
+    REQUIRE(read(journal, 4) == framed(4) + framed(5));
+}
+
+TEST_CASE_METHOD(JournalFixture, "journal segments are allocated up front", "[websocket]")
+{
+    ws_details::Journal journal{path, 65536};
+    journal.append(ws_details::ServerFrame{ws_details::Opcode::Text, message(0)});
+
+#if defined __linux__
+    // not sparse, a full disk fails here instead of in a write to the mapping
+    struct stat st;
+    REQUIRE(::stat((path + ".000000.log").c_str(), &st) == 0);
+    REQUIRE(static_cast<std::size_t>(st.st_blocks) * 512 >= 65536);
+#endif
+
+    ws_details::Journal missing{"websocket-journal-no-such-dir/journal", 65536};
+    REQUIRE_THROWS_AS(missing.append(ws_details::ServerFrame{ws_details::Opcode::Text, message(0)}), std::runtime_error);
+}
+
+TEST_CASE("journal frame length", "[websocket]")
+{
+    REQUIRE(ws_details::Journal::frameLength("\x81\x02hi", 4) == 4);
+    REQUIRE(ws_details::Journal::frameLength("\x81\x02h", 3) == 0);
+    REQUIRE(ws_details::Journal::frameLength("\0\0\0\0", 4) == 0);
+
+    std::string longFrame = std::string("\x82\x7E\x01\x00", 4) + std::string(256, 'x');
+    REQUIRE(ws_details::Journal::frameLength(longFrame.data(), longFrame.size()) == 260);
+}
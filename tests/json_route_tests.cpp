@@ -0,0 +1,57 @@
+#include "details/json_route.hpp"
+
+#include "catch_wrap.hpp"
+
+namespace ws_details = websocket::details;
+
+namespace
+{
+    // the raw value, "-" - not found
+    std::string find(const std::string& json, const std::string& key = "type")
+    {
+        const char* value;
+        std::size_t size;
+        if (!ws_details::json::findStringMember(json.data(), json.size(), key, value, size))
+            return "-";
+
+        return{value, size};
+    }
+}
+
+TEST_CASE("JSON route: top-level member", "[websocket]")
+{
+    REQUIRE(find(R"({"type":"sub","channel":"news"})") == "sub");
+    REQUIRE(find(R"( { "channel" : "news" , "type" : "sub" } )") == "sub");
+    REQUIRE(find("{\n\t\"id\": 12,\r\n\t\"ok\": true, \"x\": null, \"type\": \"\"}") == "");
+    REQUIRE(find(R"({"type":"a\"b"})") == R"(a\"b)");
+
+    // the first one wins
+    REQUIRE(find(R"({"type":"a","type":"b"})") == "a");
+}
+
+TEST_CASE("JSON route: skipped values", "[websocket]")
+{
+    // nested members with the same key, brackets and quotes in strings
+    REQUIRE(find(R"({"data":{"type":"inner","list":[1,{"type":"x"},"]}"]},"type":"outer"})") == "outer");
+    REQUIRE(find(R"({"s":"{[\"\\","type":"t"})") == "t");
+
+    // longer than the 16-byte chunks, an escape at a chunk boundary
+    std::string longString(40, 'x');
+    REQUIRE(find(R"({"text":")" + longString + R"(","type":"t"})") == "t");
+    REQUIRE(find(R"({"text":"0123456\")" + longString + R"(\\","type":"t"})") == "t");
+    REQUIRE(find(R"({"data":[)" + longString + "," + longString + R"(],"type":"t"})") == "t");
+}
+
+TEST_CASE("JSON route: not found", "[websocket]")
+{
+    REQUIRE(find("") == "-");
+    REQUIRE(find("{}") == "-");
+    REQUIRE(find("[\"type\",\"sub\"]") == "-");
+    REQUIRE(find(R"({"channel":"news"})") == "-");
+    REQUIRE(find(R"({"data":{"type":"inner"}})") == "-");
+    REQUIRE(find(R"({"type":1})") == "-");
+    REQUIRE(find(R"({"type":"sub)") == "-");
+    REQUIRE(find(R"({"text":"abc\)") == "-");
+    REQUIRE(find(R"({"data":{"a":[1,2})") == "-");
+    REQUIRE(find(R"({"types":"sub"})") == "-");
+}
@@ -0,0 +1,48 @@
+#include "details/metrics.hpp"
+
+#include "catch_wrap.hpp"
+
+namespace ws_details = websocket::details;
+
+namespace
+{
+    bool hasLine(const std::string& text, const std::string& line)
+    {
+        return text.find("\n" + line + "\n") != std::string::npos;
+    }
+}
+
+TEST_CASE("Prometheus metrics", "[websocket]")
+{
+    ws_details::ServerStats stats;
+    stats.connections = 3;
+    stats.queuedBytes = 100;
+    stats.rejected = 2;
+    stats.rtt.record(3);    // bucket 1, up to 4 us
+    stats.rtt.record(1000); // bucket 9, up to 1024 us
+
+    auto text = ws_details::renderPrometheus(stats);
+    REQUIRE(hasLine(text, "websocket_connections 3"));
+    REQUIRE(hasLine(text, "websocket_queued_bytes 100"));
+    REQUIRE(hasLine(text, "websocket_rejected_total 2"));
+    REQUIRE(hasLine(text, "# TYPE websocket_rtt_seconds histogram"));
+
+    // cumulative buckets
+    REQUIRE(hasLine(text, "websocket_rtt_seconds_bucket{le=\"2e-06\"} 0"));
+    REQUIRE(hasLine(text, "websocket_rtt_seconds_bucket{le=\"4e-06\"} 1"));
+    REQUIRE(hasLine(text, "websocket_rtt_seconds_bucket{le=\"0.001024\"} 2"));
+    REQUIRE(hasLine(text, "websocket_rtt_seconds_bucket{le=\"+Inf\"} 2"));
+    REQUIRE(hasLine(text, "websocket_rtt_seconds_sum 0.001003"));
+    REQUIRE(hasLine(text, "websocket_rtt_seconds_count 2"));
+}
+
+TEST_CASE("Plain reply", "[websocket]")
+{
+    REQUIRE(ws_details::makePlainReply("text/plain", "OK\n") ==
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/plain\r\n"
+        "Content-Length: 3\r\n"
+        "Connection: close\r\n"
+        "\r\n"
+        "OK\n");
+}
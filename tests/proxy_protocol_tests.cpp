@@ -0,0 +1,127 @@
+#include "details/proxy_protocol.hpp"
+
+#include "catch_wrap.hpp"
+
+namespace ws_details = websocket::details;
+
+namespace
+{
+    template<std::size_t N>
+    ws_details::ProxyParseResult parse(const char(&data)[N], ws_details::ProxyHeader& header)
+    {
+        return ws_details::parseProxyHeader(data, N - 1, header);
+    }
+
+    boost::asio::ip::tcp::endpoint endpoint(const char* ip, unsigned short port)
+    {
+        return{boost::asio::ip::address::from_string(ip), port};
+    }
+}
+
+TEST_CASE("PROXY v1", "[websocket]")
+{
+    ws_details::ProxyHeader header;
+
+    SECTION("TCP4")
+    {
+        REQUIRE(parse("PROXY TCP4 192.168.0.1 192.168.0.11 56324 443\r\nGET /", header) == ws_details::ProxyParseResult::Complete);
+        REQUIRE(header.length == 47);
+        REQUIRE_FALSE(header.isLocal);
+        REQUIRE(header.source == endpoint("192.168.0.1", 56324));
+        REQUIRE(header.destination == endpoint("192.168.0.11", 443));
+    }
+
+    SECTION("TCP6")
+    {
+        REQUIRE(parse("PROXY TCP6 ::1 fe80::1 1 2\r\n", header) == ws_details::ProxyParseResult::Complete);
+        REQUIRE(header.source == endpoint("::1", 1));
+        REQUIRE(header.destination == endpoint("fe80::1", 2));
+    }
+
+    SECTION("UNKNOWN")
+    {
+        REQUIRE(parse("PROXY UNKNOWN ffff::1 ffff::2 1 2\r\n", header) == ws_details::ProxyParseResult::Complete);
+        REQUIRE(header.isLocal);
+        REQUIRE(header.length == 35);
+    }
+
+    SECTION("incomplete")
+    {
+        REQUIRE(parse("PRO", header) == ws_details::ProxyParseResult::NeedMore);
+        REQUIRE(parse("PROXY TCP4 192.168.0.1 ", header) == ws_details::ProxyParseResult::NeedMore);
+    }
+
+    SECTION("invalid")
+    {
+        REQUIRE(parse("GET / HTTP/1.1\r\n", header) == ws_details::ProxyParseResult::Invalid);
+        REQUIRE(parse("PROXY TCP4 192.168.0.1 192.168.0.11 56324\r\n", header) == ws_details::ProxyParseResult::Invalid);
+        REQUIRE(parse("PROXY TCP4 192.168.0.1 192.168.0.11 56324 443 \r\n", header) == ws_details::ProxyParseResult::Invalid);
+        REQUIRE(parse("PROXY TCP4 ::1 192.168.0.11 56324 443\r\n", header) == ws_details::ProxyParseResult::Invalid);
+        REQUIRE(parse("PROXY TCP4 192.168.0.1 192.168.0.11 65536 443\r\n", header) == ws_details::ProxyParseResult::Invalid);
+        REQUIRE(parse("PROXY TCP5 192.168.0.1 192.168.0.11 1 443\r\n", header) == ws_details::ProxyParseResult::Invalid);
+        REQUIRE(parse("PROXY TCP4 192.168.0.1 192.168.0.11 1 443\n", header) == ws_details::ProxyParseResult::Invalid);
+    }
+
+    SECTION("too long")
+    {
+        std::string line = "PROXY TCP4 " + std::string(200, '1');
+        REQUIRE(ws_details::parseProxyHeader(line.data(), line.size(), header) == ws_details::ProxyParseResult::Invalid);
+    }
+}
+
+TEST_CASE("PROXY v2", "[websocket]")
+{
+    ws_details::ProxyHeader header;
+
+    SECTION("TCP4")
+    {
+        REQUIRE(parse(
+            "\r\n\r\n\0\r\nQUIT\n" "\x21\x11\x00\x0C"
+            "\xC0\xA8\x00\x01" "\xC0\xA8\x00\x0B" "\xDC\x04" "\x01\xBB"
+            "GET /", header) == ws_details::ProxyParseResult::Complete);
+        REQUIRE(header.length == 28);
+        REQUIRE_FALSE(header.isLocal);
+        REQUIRE(header.source == endpoint("192.168.0.1", 56324));
+        REQUIRE(header.destination == endpoint("192.168.0.11", 443));
+    }
+
+    SECTION("TCP6 with TLV")
+    {
+        REQUIRE(parse(
+            "\r\n\r\n\0\r\nQUIT\n" "\x21\x21\x00\x27"
+            "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\x01" "\xFE\x80\0\0\0\0\0\0\0\0\0\0\0\0\0\x01" "\x00\x01" "\x00\x02"
+            "\x04\x00\x00", header) == ws_details::ProxyParseResult::Complete);
+        REQUIRE(header.length == 16 + 39);
+        REQUIRE(header.source == endpoint("::1", 1));
+        REQUIRE(header.destination == endpoint("fe80::1", 2));
+    }
+
+    SECTION("LOCAL")
+    {
+        REQUIRE(parse("\r\n\r\n\0\r\nQUIT\n" "\x20\x00\x00\x00", header) == ws_details::ProxyParseResult::Complete);
+        REQUIRE(header.length == 16);
+        REQUIRE(header.isLocal);
+    }
+
+    SECTION("unix socket")
+    {
+        REQUIRE(parse("\r\n\r\n\0\r\nQUIT\n" "\x21\x31\x00\x02" "ab", header) == ws_details::ProxyParseResult::Complete);
+        REQUIRE(header.length == 18);
+        REQUIRE(header.isLocal);
+    }
+
+    SECTION("incomplete")
+    {
+        REQUIRE(parse("\r\n\r\n\0\r", header) == ws_details::ProxyParseResult::NeedMore);
+        REQUIRE(parse("\r\n\r\n\0\r\nQUIT\n" "\x21\x11", header) == ws_details::ProxyParseResult::NeedMore);
+        REQUIRE(parse("\r\n\r\n\0\r\nQUIT\n" "\x21\x11\x00\x0C" "\xC0\xA8", header) == ws_details::ProxyParseResult::NeedMore);
+    }
+
+    SECTION("invalid")
+    {
+        REQUIRE(parse("\r\n\r\nGET", header) == ws_details::ProxyParseResult::Invalid);
+        REQUIRE(parse("\r\n\r\n\0\r\nQUIT\n" "\x11\x11\x00\x00", header) == ws_details::ProxyParseResult::Invalid);
+        REQUIRE(parse("\r\n\r\n\0\r\nQUIT\n" "\x22\x11\x00\x00", header) == ws_details::ProxyParseResult::Invalid);
+        REQUIRE(parse("\r\n\r\n\0\r\nQUIT\n" "\x21\x11\x00\x04" "abcd", header) == ws_details::ProxyParseResult::Invalid);
+    }
+}
@@ -1,9 +1,12 @@
-#include "Server.hpp"
+#include "server_src.hpp"
+#include "SharedMemoryClient.hpp"
 
 #include "catch_wrap.hpp"
 
+#include <atomic>
 #include <thread>
 #include <tuple>
+#include <vector>
 #include <boost/asio.hpp>
 
 namespace
@@ -20,6 +23,61 @@ namespace
     using event_t = std::tuple<websocket::Event, websocket::ConnectionId, std::string>;
 }
 
+// the traits are in a named namespace: BasicServer instantiated with a type of the anonymous
+// one has internal linkage, and every member the tests don't call is an unused function
+namespace regression_tests
+{
+    std::atomic<std::size_t> allocatedCount{0};
+
+    template<typename T>
+    struct CountingAllocator : std::allocator<T>
+    {
+        template<typename U>
+        struct rebind { using other = CountingAllocator<U>; };
+
+        CountingAllocator() {}
+        template<typename U>
+        CountingAllocator(const CountingAllocator<U>&) {}
+
+        T* allocate(std::size_t n)
+        {
+            ++allocatedCount;
+            return std::allocator<T>::allocate(n);
+        }
+    };
+
+    struct TestTraits : websocket::DefaultServerTraits
+    {
+        static const bool ValidateUtf8 = true;
+        static const bool Fragmentation = true;
+        static const std::size_t MaxMessageLen = 8;
+
+        template<typename T>
+        using Allocator = CountingAllocator<T>;
+    };
+
+    // a number in a text message
+    struct NumberDecoder
+    {
+        using Type = long;
+
+        static bool decode(std::string& message, bool isBinary, long& number)
+        {
+            char* end;
+            number = std::strtol(message.c_str(), &end, 10);
+            return !isBinary && !message.empty() && *end == 0;
+        }
+    };
+
+    struct DecoderTraits : websocket::DefaultServerTraits
+    {
+        using Decoder = NumberDecoder;
+    };
+}
+
+template class websocket::BasicServer<regression_tests::TestTraits>;
+template class websocket::BasicServer<regression_tests::DecoderTraits>;
+
 namespace std
 {
     ostream& operator<<(ostream& o, const event_t& e)
@@ -30,6 +88,7 @@ namespace std
         case websocket::Event::NewConnection: o << "connected"; break;
         case websocket::Event::Message: o << "says"; break;
         case websocket::Event::Disconnect: o << "disconnected"; break;
+        case websocket::Event::Drained: o << "drained"; break;
         default: o << "???"; break;
         }
         o << " '" << std::get<2>(e) << '\'';
@@ -44,7 +103,8 @@ namespace
         boost::asio::io_service m_ioService;
         boost::asio::ip::tcp::socket m_socket{ m_ioService };
 
-        Client()
+        // `withSession` - the reply has a session token, it goes to m_sessionToken
+        explicit Client(const std::string& extraHeaders = {}, bool withSession = false)
         {
             boost::asio::ip::tcp::endpoint serverEndpoint{ boost::asio::ip::address_v4::from_string(ServerIp), ServerPort };
             m_socket.connect(serverEndpoint);
@@ -55,7 +115,8 @@ namespace
                 "Upgrade: websocket" "\r\n"
                 "Connection: Upgrade" "\r\n"
                 "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==" "\r\n"
-                "Sec-WebSocket-Version: 13" "\r\n"
+                "Sec-WebSocket-Version: 13" "\r\n" +
+                extraHeaders +
                 "\r\n";
             boost::asio::write(m_socket, boost::asio::buffer(request));
 
@@ -65,6 +126,21 @@ namespace
             replyStream << &replyBuf;
             auto replyStr = replyStream.str();
 
+            // the first frames may come with the reply
+            auto replyEnd = replyStr.find("\r\n\r\n") + 4;
+            m_received = replyStr.substr(replyEnd);
+            replyStr.erase(replyEnd);
+
+            if (withSession)
+            {
+                const std::string header = "X-WebSocket-Session: ";
+                auto start = replyStr.find(header);
+                REQUIRE(start != std::string::npos);
+                auto end = replyStr.find("\r\n", start);
+                m_sessionToken = replyStr.substr(start + header.size(), end - start - header.size());
+                replyStr.erase(start, end + 2 - start);
+            }
+
             std::string expectedReply =
                 "HTTP/1.1 101 Switching Protocols\r\n"
                 "Upgrade: websocket\r\n"
@@ -86,7 +162,11 @@ namespace
         {
             const unsigned bufSize = 0x20000;
             static unsigned char buf[bufSize];
-            auto n = boost::asio::read(m_socket, boost::asio::buffer(buf), boost::asio::transfer_at_least(1));
+            std::size_t n = m_received.size();
+            std::memcpy(buf, m_received.data(), n);
+            m_received.clear();
+            if (n < 2)
+                n += boost::asio::read(m_socket, boost::asio::buffer(buf + n, bufSize - n), boost::asio::transfer_at_least(2 - n));
 
             if (buf[1] == 126)
             {
@@ -109,24 +189,49 @@ namespace
             return {s, s + n};
         }
 
+        std::string recvBytes(std::size_t n)
+        {
+            auto s = m_received.substr(0, n);
+            m_received.erase(0, s.size());
+            if (s.size() < n)
+            {
+                auto received = s.size();
+                s.resize(n);
+                boost::asio::read(m_socket, boost::asio::buffer(&s[received], n - received));
+            }
+            return s;
+        }
+
+        bool isEof()
+        {
+            char buf[16];
+            boost::system::error_code ec;
+            boost::asio::read(m_socket, boost::asio::buffer(buf), ec);
+            return ec == boost::asio::error::eof;
+        }
+
         ~Client()
         {
             m_socket.close();
         }
+
+        std::string m_sessionToken;
+        std::string m_received; // read with the handshake reply
     };
 
-    struct WebsocketTestsFixture
+    template<typename Traits>
+    struct BasicTestsFixture
     {
-        websocket::Server server;
+        websocket::BasicServer<Traits> server;
 
-        WebsocketTestsFixture()
+        BasicTestsFixture(const websocket::ServerOptions& options = {})
         {
-            server.start(ServerIp, ServerPort, std::cout);
+            server.start(ServerIp, ServerPort, std::cout, options);
         }
 
-        event_t waitServerEvent()
+        event_t waitServerEvent(int timeoutMs = 10)
         {
-            for (auto n = 0; n < 10; ++n)
+            for (auto n = 0; n < timeoutMs; ++n)
             {
                 websocket::Event event;
                 websocket::ConnectionId connId;
@@ -147,11 +252,324 @@ namespace
             REQUIRE(std::get<0>(e) == expectedEvent);
         }
 
-        ~WebsocketTestsFixture()
+        // the whole record, for what the tuple doesn't carry
+        websocket::EventRecord waitMessage()
+        {
+            websocket::EventRecord record;
+            for (auto n = 0; n < 100 && !server.poll(record); ++n)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+            REQUIRE(record.event() == websocket::Event::Message);
+            return record;
+        }
+
+        void requireNoEvents()
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+            websocket::Event event;
+            websocket::ConnectionId connId;
+            std::string message;
+            REQUIRE_FALSE(server.poll(event, connId, message));
+        }
+
+        ~BasicTestsFixture()
+        {
+            server.stop();
+        }
+    };
+
+    using WebsocketTestsFixture = BasicTestsFixture<websocket::DefaultServerTraits>;
+    using TraitsFixture = BasicTestsFixture<regression_tests::TestTraits>;
+
+    // a server started with the options `MakeOptions` returns
+    template<websocket::ServerOptions(*MakeOptions)()>
+    struct OptionsFixture : WebsocketTestsFixture
+    {
+        OptionsFixture() : WebsocketTestsFixture{MakeOptions()} {}
+    };
+
+    websocket::ServerOptions singleConnectionOptions()
+    {
+        websocket::ServerOptions options;
+        options.maxConnections = 1;
+        return options;
+    }
+
+    websocket::ServerOptions keepaliveOptions()
+    {
+        websocket::ServerOptions options;
+        options.pingInterval = std::chrono::milliseconds(100);
+        options.maxMissedPongs = 2;
+        return options;
+    }
+
+    websocket::ServerOptions timestampOptions()
+    {
+        websocket::ServerOptions options;
+        options.receiveTimestamps = true;
+        return options;
+    }
+
+    websocket::ServerOptions drainOptions()
+    {
+        websocket::ServerOptions options;
+        options.sendHighWaterMark = 8;
+        options.sendLowWaterMark = 0;
+        return options;
+    }
+
+    websocket::ServerOptions budgetOptions()
+    {
+        websocket::ServerOptions options;
+        options.frameBudget = 1;
+        return options;
+    }
+
+    websocket::ServerOptions smallRingOptions()
+    {
+        websocket::ServerOptions options;
+        options.submitRingSize = 2;
+        return options;
+    }
+
+    websocket::ServerOptions noBudgetOptions()
+    {
+        websocket::ServerOptions options;
+        options.frameBudget = 0;
+        return options;
+    }
+
+    websocket::ServerOptions throttleOptions()
+    {
+        websocket::ServerOptions options;
+        options.messageRate = {10, 1};
+        return options;
+    }
+
+    websocket::ServerOptions rateCloseOptions()
+    {
+        websocket::ServerOptions options;
+        options.byteRate = {10, 10};
+        options.rateLimitAction = websocket::RateLimitAction::Close;
+        return options;
+    }
+
+    websocket::ServerOptions shapingOptions()
+    {
+        websocket::ServerOptions options;
+        options.sendRates = {{10, 10}}; // bytes per second
+        return options;
+    }
+
+    using DecoderFixture = BasicTestsFixture<regression_tests::DecoderTraits>;
+
+    websocket::ServerOptions shapingBurstOptions()
+    {
+        websocket::ServerOptions options;
+        options.sendRates = {{1000, 10}}; // bytes per second, a 10 byte bucket
+        return options;
+    }
+
+    websocket::ServerOptions routeOptions()
+    {
+        websocket::ServerOptions options;
+        options.routeKey = "type";
+        options.routeValues = {"sub", "pub"};
+        return options;
+    }
+
+    websocket::ServerOptions plainOptions()
+    {
+        websocket::ServerOptions options;
+        options.healthPath = "/healthz";
+        options.metricsPath = "/metrics";
+        return options;
+    }
+
+    websocket::ServerOptions plainLimitOptions()
+    {
+        auto options = plainOptions();
+        options.acceptRatePerIp = {1, 1};
+        return options;
+    }
+
+    // the whole reply, the server closes the connection after it
+    std::string plainGet(const std::string& path)
+    {
+        boost::asio::io_service ioService;
+        boost::asio::ip::tcp::socket socket{ ioService };
+        socket.connect({ boost::asio::ip::address_v4::from_string(ServerIp), ServerPort });
+
+        std::string request = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+        boost::asio::write(socket, boost::asio::buffer(request));
+
+        boost::asio::streambuf replyBuf;
+        boost::system::error_code ec;
+        boost::asio::read(socket, replyBuf, ec);
+        REQUIRE(ec == boost::asio::error::eof);
+
+        std::stringstream replyStream;
+        replyStream << &replyBuf;
+        return replyStream.str();
+    }
+
+    websocket::ServerOptions http2Options()
+    {
+        websocket::ServerOptions options;
+        options.http2 = true;
+        return options;
+    }
+
+    websocket::ServerOptions http2DrainOptions()
+    {
+        websocket::ServerOptions options;
+        options.http2 = true;
+        options.sendHighWaterMark = 1000;
+        options.sendLowWaterMark = 0;
+        return options;
+    }
+
+    // HTTP/2 client with prior knowledge, the frames are built by hand
+    struct Http2Client
+    {
+        struct Frame
+        {
+            std::uint8_t type;
+            std::uint8_t flags;
+            std::uint32_t streamId;
+            std::string payload;
+        };
+
+        boost::asio::io_service m_ioService;
+        boost::asio::ip::tcp::socket m_socket{ m_ioService };
+
+        Http2Client()
+        {
+            boost::asio::ip::tcp::endpoint serverEndpoint{ boost::asio::ip::address_v4::from_string(ServerIp), ServerPort };
+            m_socket.connect(serverEndpoint);
+            m_socket.set_option(boost::asio::ip::tcp::no_delay{true}); // small frames back to back
+
+            boost::asio::write(m_socket, boost::asio::buffer(std::string{"PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"}));
+            sendFrame(4, 0, 0, {});
+
+            // the server SETTINGS: 100 streams, extended CONNECT
+            auto settings = recvFrame();
+            REQUIRE(settings.type == 4);
+            REQUIRE(settings.payload == str("\x00\x03\x00\x00\x00\x64" "\x00\x08\x00\x00\x00\x01"));
+            sendFrame(4, 1, 0, {});
+        }
+
+        void sendFrame(std::uint8_t type, std::uint8_t flags, std::uint32_t streamId, const std::string& payload)
+        {
+            std::string frame;
+            frame.push_back(static_cast<char>(payload.size() >> 16));
+            frame.push_back(static_cast<char>(payload.size() >> 8));
+            frame.push_back(static_cast<char>(payload.size()));
+            frame.push_back(static_cast<char>(type));
+            frame.push_back(static_cast<char>(flags));
+            for (auto shift = 24; shift >= 0; shift -= 8)
+                frame.push_back(static_cast<char>(streamId >> shift));
+
+            boost::asio::write(m_socket, boost::asio::buffer(frame + payload));
+        }
+
+        // extended CONNECT, the header block has no Huffman strings and no indexing
+        void connect(std::uint32_t streamId, const std::string& path = "/")
+        {
+            auto literal = [](const std::string& s) { return std::string(1, static_cast<char>(s.size())) + s; };
+            auto block =
+                "\x02" + literal("CONNECT") +
+                str("\x00") + literal(":protocol") + literal("websocket") +
+                "\x86" +
+                "\x04" + literal(path) +
+                "\x01" + literal("localhost") +
+                str("\x00") + literal("sec-websocket-version") + literal("13");
+            sendFrame(1, 4, streamId, block);
+        }
+
+        // the SETTINGS ACK and the WINDOW_UPDATEs are skipped
+        Frame recvFrame()
+        {
+            for (;;)
+            {
+                std::uint8_t header[9];
+                boost::asio::read(m_socket, boost::asio::buffer(header));
+
+                Frame frame;
+                frame.type = header[3];
+                frame.flags = header[4];
+                frame.streamId = (header[5] << 24) | (header[6] << 16) | (header[7] << 8) | header[8];
+                frame.payload.resize((header[0] << 16) | (header[1] << 8) | header[2]);
+                if (!frame.payload.empty())
+                    boost::asio::read(m_socket, boost::asio::buffer(&frame.payload[0], frame.payload.size()));
+
+                if (frame.type == 8 || (frame.type == 4 && (frame.flags & 1)))
+                    continue;
+
+                return frame;
+            }
+        }
+
+        ~Http2Client()
+        {
+            m_socket.close();
+        }
+    };
+
+    websocket::ServerOptions sessionOptions()
+    {
+        websocket::ServerOptions options;
+        options.sessionReplaySize = 4;
+        options.sessionTimeout = std::chrono::seconds(1);
+        return options;
+    }
+
+    websocket::ServerOptions journalOptions()
+    {
+        std::remove("websocket-journal-regression.000000.log");
+
+        websocket::ServerOptions options;
+        options.journalPath = "websocket-journal-regression";
+        options.journalSegmentSize = 4096;
+        return options;
+    }
+
+    struct JournalFixture : OptionsFixture<&journalOptions>
+    {
+
+        ~JournalFixture()
         {
             server.stop();
+            std::remove("websocket-journal-regression.000000.log");
         }
     };
+
+    websocket::ServerOptions sharedMemoryOptions()
+    {
+        websocket::ServerOptions options;
+        options.sharedMemory = "/websocket-cpp-test";
+        options.sharedMemoryRingSize = 64;
+        return options;
+    }
+
+    event_t waitSharedEvent(websocket::SharedMemoryClient& app)
+    {
+        for (auto n = 0; n < 10; ++n)
+        {
+            websocket::Event event;
+            websocket::ConnectionId connId;
+            const char* data;
+            std::size_t size;
+            if (app.poll(event, connId, data, size))
+                return event_t(event, connId, std::string(data, size));
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        FAIL("timeout");
+        return{}; // suppress warning
+    }
 }
 
 TEST_CASE_METHOD(WebsocketTestsFixture, "New connection", "[websocket][slow]")
@@ -169,6 +587,86 @@ TEST_CASE_METHOD(WebsocketTestsFixture, "Client message", "[websocket][slow]")
     REQUIRE(waitServerEvent() == event_t(websocket::Event::Message, 1, "test"));
 }
 
+TEST_CASE_METHOD(WebsocketTestsFixture, "Client binary message", "[websocket][slow]")
+{
+    Client client;
+    waitServerEvent(websocket::Event::NewConnection);
+
+    auto sent = std::chrono::steady_clock::now();
+    client.sendFrame("\x82\x82" "\x00\x00\x00\x00" "\x00\xFF");
+
+    websocket::EventRecord record;
+    for (auto n = 0; n < 10 && !server.poll(record); ++n)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    REQUIRE(record.event() == websocket::Event::Message);
+    REQUIRE(record.isBinary());
+    REQUIRE(record.message() == str("\x00\xFF"));
+    REQUIRE(record.receivedAt() >= sent);
+}
+
+#if defined __linux__
+TEST_CASE_METHOD(OptionsFixture<&timestampOptions>, "Receive timestamps", "[websocket][slow]")
+{
+    Client client;
+    waitServerEvent(websocket::Event::NewConnection);
+
+    // the second half of the frame comes later, the message has its arrival time
+    client.sendFrame("\x81\x84" "\x14\x7b\x35\x0f" "\x60\x1e");
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    auto sent = std::chrono::steady_clock::now();
+    client.sendFrame("\x46\x7b");
+
+    websocket::EventRecord record;
+    for (auto n = 0; n < 100 && !server.poll(record); ++n)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    REQUIRE(record.message() == "test");
+    REQUIRE(record.receivedAt() >= sent - std::chrono::milliseconds(1));
+    REQUIRE(record.receivedAt() <= std::chrono::steady_clock::now());
+
+    client.sendFrame("\x81\x84" "\x14\x7b\x35\x0f" "\x60\x1e\x46\x7b");
+    REQUIRE(waitServerEvent(100) == event_t(websocket::Event::Message, 1, "test"));
+
+    // frames that come together are read together and share the stamp
+    client.sendFrame("\x81\x84" "\x14\x7b\x35\x0f" "\x60\x1e\x46\x7b" "\x81\x82" "\x00\x00\x00\x00" "ok");
+    auto first = waitMessage();
+    auto second = waitMessage();
+    REQUIRE(first.message() == "test");
+    REQUIRE(second.message() == "ok");
+    REQUIRE(first.receivedAt() == second.receivedAt());
+}
+#endif
+
+TEST_CASE_METHOD(WebsocketTestsFixture, "Pause reading", "[websocket][slow]")
+{
+    Client client;
+    waitServerEvent(websocket::Event::NewConnection);
+
+    server.pauseReading(1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    // the pending read still gets one frame
+    client.sendFrame("\x81\x81" "\x00\x00\x00\x00" "1");
+    REQUIRE(waitServerEvent(100) == event_t(websocket::Event::Message, 1, "1"));
+
+    client.sendFrame("\x81\x81" "\x00\x00\x00\x00" "2");
+    requireNoEvents();
+
+    server.resumeReading(1);
+    REQUIRE(waitServerEvent(100) == event_t(websocket::Event::Message, 1, "2"));
+
+    // a paused connection still completes the close handshake
+    server.pauseReading(1);
+    client.sendFrame("\x81\x81" "\x00\x00\x00\x00" "3");
+    REQUIRE(waitServerEvent(100) == event_t(websocket::Event::Message, 1, "3"));
+    server.drop(1);
+    REQUIRE(waitServerEvent() == event_t(websocket::Event::Disconnect, 1, ""));
+    REQUIRE(client.recvFrame() == str("\x88\x02\x03\xE8"));
+    client.sendFrame("\x88\x80" "\x00\x00\x00\x00");
+    REQUIRE(client.isEof());
+}
+
 TEST_CASE_METHOD(WebsocketTestsFixture, "Server message", "[websocket][slow]")
 {
     Client client;
@@ -178,6 +676,293 @@ TEST_CASE_METHOD(WebsocketTestsFixture, "Server message", "[websocket][slow]")
     REQUIRE(client.recvFrame() == "\x81\x04test");
 }
 
+TEST_CASE_METHOD(OptionsFixture<&drainOptions>, "Drained", "[websocket][slow]")
+{
+    Client client;
+    waitServerEvent(websocket::Event::NewConnection);
+
+    // under the high-water mark
+    server.sendText(1, "test");
+    REQUIRE(client.recvFrame() == "\x81\x04test");
+    requireNoEvents();
+
+    server.sendText(1, "test test");
+    REQUIRE(client.recvFrame() == "\x81\x09test test");
+    REQUIRE(waitServerEvent(100) == event_t(websocket::Event::Drained, 1, ""));
+}
+
+TEST_CASE_METHOD(OptionsFixture<&smallRingOptions>, "Commands after stop", "[websocket][slow]")
+{
+    Client client;
+    waitServerEvent(websocket::Event::NewConnection);
+    server.stop();
+
+    // the ring fills up and nothing drains it, the calls return anyway
+    for (int i = 0; i != 10; ++i)
+    {
+        server.sendText(1, "test");
+        server.broadcastText("test");
+    }
+}
+
+TEST_CASE_METHOD(OptionsFixture<&budgetOptions>, "Frame budget", "[websocket][slow]")
+{
+    Client client;
+    waitServerEvent(websocket::Event::NewConnection);
+
+    // three frames in one segment are parsed one per turn of the I/O loop
+    client.sendFrame(
+        "\x81\x84" "\x14\x7b\x35\x0f" "\x60\x1e\x46\x7b"
+        "\x81\x84" "\x14\x7b\x35\x0f" "\x60\x1e\x46\x7b"
+        "\x81\x84" "\x14\x7b\x35\x0f" "\x60\x1e\x46\x7b");
+    for (auto n = 0; n < 3; ++n)
+        REQUIRE(waitServerEvent() == event_t(websocket::Event::Message, 1, "test"));
+
+    // the next frame is read after the batch, Nagle holds it for the delayed ACK
+    client.sendFrame("\x81\x84" "\x14\x7b\x35\x0f" "\x60\x1e\x46\x7b");
+    REQUIRE(waitServerEvent(100) == event_t(websocket::Event::Message, 1, "test"));
+}
+
+TEST_CASE_METHOD(OptionsFixture<&noBudgetOptions>, "No frame budget", "[websocket][slow]")
+{
+    Client client;
+    waitServerEvent(websocket::Event::NewConnection);
+
+    client.sendFrame(
+        "\x81\x84" "\x14\x7b\x35\x0f" "\x60\x1e\x46\x7b"
+        "\x81\x84" "\x14\x7b\x35\x0f" "\x60\x1e\x46\x7b");
+    for (auto n = 0; n < 2; ++n)
+        REQUIRE(waitServerEvent() == event_t(websocket::Event::Message, 1, "test"));
+}
+
+TEST_CASE_METHOD(OptionsFixture<&throttleOptions>, "Rate limit throttle", "[websocket][slow]")
+{
+    Client client;
+    waitServerEvent(websocket::Event::NewConnection);
+
+    client.sendFrame(
+        "\x81\x84" "\x14\x7b\x35\x0f" "\x60\x1e\x46\x7b"
+        "\x81\x84" "\x14\x7b\x35\x0f" "\x60\x1e\x46\x7b");
+    REQUIRE(waitServerEvent() == event_t(websocket::Event::Message, 1, "test"));
+
+    // the second one waits for the next token
+    requireNoEvents();
+    REQUIRE(waitServerEvent(300) == event_t(websocket::Event::Message, 1, "test"));
+}
+
+TEST_CASE_METHOD(OptionsFixture<&rateCloseOptions>, "Rate limit close", "[websocket][slow]")
+{
+    Client client;
+    waitServerEvent(websocket::Event::NewConnection);
+
+    client.sendFrame(
+        "\x81\x84" "\x14\x7b\x35\x0f" "\x60\x1e\x46\x7b"
+        "\x81\x84" "\x14\x7b\x35\x0f" "\x60\x1e\x46\x7b");
+    REQUIRE(waitServerEvent() == event_t(websocket::Event::Message, 1, "test"));
+    REQUIRE(waitServerEvent() == event_t(websocket::Event::Disconnect, 1, ""));
+    REQUIRE(client.recvFrame() == str("\x88\x02\x03\xf0"));
+}
+
+TEST_CASE_METHOD(OptionsFixture<&shapingOptions>, "Send rate", "[websocket][slow]")
+{
+    Client client;
+    waitServerEvent(websocket::Event::NewConnection);
+
+    // the second frame waits for the tokens
+    auto start = std::chrono::steady_clock::now();
+    server.sendText(1, "test");
+    server.sendText(1, "test");
+    REQUIRE(client.recvBytes(6) == "\x81\x04test");
+    REQUIRE(client.recvBytes(6) == "\x81\x04test");
+    REQUIRE(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(100));
+
+    // class 1 has no limit
+    server.setSendClass(1, 1);
+    start = std::chrono::steady_clock::now();
+    server.sendText(1, "test");
+    server.sendText(1, "test");
+    REQUIRE(client.recvBytes(12) == "\x81\x04test\x81\x04test");
+    REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(100));
+}
+
+TEST_CASE_METHOD(OptionsFixture<&plainLimitOptions>, "Health checks skip the limits", "[websocket][slow]")
+{
+    for (auto n = 0; n < 3; ++n)
+        REQUIRE(plainGet("/healthz").compare(0, 15, "HTTP/1.1 200 OK") == 0);
+
+    // the only token of the address is still there
+    Client client;
+    waitServerEvent(websocket::Event::NewConnection);
+}
+
+TEST_CASE_METHOD(OptionsFixture<&shapingBurstOptions>, "Send rate over the burst", "[websocket][slow]")
+{
+    Client client;
+    waitServerEvent(websocket::Event::NewConnection);
+
+    // 504 bytes go with the full bucket, the next frame waits until the rate has made up for them
+    auto start = std::chrono::steady_clock::now();
+    server.sendText(1, std::string(500, 'x'));
+    server.sendText(1, "test");
+    REQUIRE(client.recvBytes(504) == "\x81\x7E\x01\xF4" + std::string(500, 'x'));
+    REQUIRE(client.recvBytes(6) == "\x81\x04test");
+    REQUIRE(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(400));
+}
+
+TEST_CASE_METHOD(OptionsFixture<&plainOptions>, "Health check and metrics", "[websocket][slow]")
+{
+    REQUIRE(plainGet("/healthz") ==
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/plain\r\n"
+        "Content-Length: 3\r\n"
+        "Connection: close\r\n"
+        "\r\n"
+        "OK\n");
+
+    Client client;
+    waitServerEvent(websocket::Event::NewConnection);
+
+    auto reply = plainGet("/metrics");
+    REQUIRE(reply.find("HTTP/1.1 200 OK\r\n") == 0);
+    REQUIRE(reply.find("\nwebsocket_connections 1\n") != std::string::npos);
+    REQUIRE(reply.find("\nwebsocket_handshake_errors_total 0\n") != std::string::npos);
+
+    // other paths are still handshake errors
+    REQUIRE(plainGet("/other") == "HTTP/1.1 404 :(\r\n\r\n");
+
+    // no connections, no events
+    requireNoEvents();
+}
+
+TEST_CASE_METHOD(OptionsFixture<&http2Options>, "HTTP/2 streams", "[websocket][slow]")
+{
+    Http2Client client;
+
+    client.connect(1);
+    REQUIRE(waitServerEvent() == event_t(websocket::Event::NewConnection, 1, ""));
+    auto reply = client.recvFrame();
+    REQUIRE(reply.type == 1);
+    REQUIRE(reply.flags == 4);
+    REQUIRE(reply.streamId == 1);
+    REQUIRE(reply.payload == "\x88");
+
+    client.connect(3);
+    REQUIRE(waitServerEvent() == event_t(websocket::Event::NewConnection, 2, ""));
+    REQUIRE(client.recvFrame().streamId == 3);
+
+    // not a WebSocket endpoint: 404 and END_STREAM
+    client.connect(5, "/chat");
+    reply = client.recvFrame();
+    REQUIRE(reply.streamId == 5);
+    REQUIRE(reply.flags == 5);
+    REQUIRE(reply.payload == "\x8d");
+
+    client.sendFrame(0, 0, 3, str("\x81\x84" "\x00\x00\x00\x00" "test"));
+    REQUIRE(waitServerEvent() == event_t(websocket::Event::Message, 2, "test"));
+
+    server.sendText(1, "test");
+    reply = client.recvFrame();
+    REQUIRE(reply.type == 0);
+    REQUIRE(reply.streamId == 1);
+    REQUIRE(reply.payload == "\x81\x04test");
+
+    // the close handshake, then END_STREAM both ways
+    server.drop(1);
+    REQUIRE(waitServerEvent() == event_t(websocket::Event::Disconnect, 1, ""));
+    REQUIRE(client.recvFrame().payload == str("\x88\x02\x03\xe8"));
+    client.sendFrame(0, 1, 1, str("\x88\x82" "\x00\x00\x00\x00" "\x03\xe8"));
+    reply = client.recvFrame();
+    REQUIRE(reply.streamId == 1);
+    REQUIRE(reply.flags == 1);
+    REQUIRE(reply.payload.empty());
+
+    // the other stream ends with the TCP connection
+    client.m_socket.close();
+    REQUIRE(waitServerEvent() == event_t(websocket::Event::Disconnect, 2, ""));
+}
+
+TEST_CASE_METHOD(OptionsFixture<&http2DrainOptions>, "HTTP/2 stream waits for the window", "[websocket][slow]")
+{
+    Http2Client client;
+    client.connect(1);
+    REQUIRE(waitServerEvent() == event_t(websocket::Event::NewConnection, 1, ""));
+    REQUIRE(client.recvFrame().type == 1);
+
+    // SETTINGS_INITIAL_WINDOW_SIZE 0, the PING ACK tells it is applied
+    client.sendFrame(4, 0, 0, str("\x00\x04\x00\x00\x00\x00"));
+    client.sendFrame(6, 0, 0, "12345678");
+    REQUIRE(client.recvFrame().type == 6);
+
+    // over the high-water mark, nothing is sent
+    server.sendText(1, std::string(2000, 'x'));
+    requireNoEvents();
+
+    client.sendFrame(8, 0, 1, str("\x00\x00\x10\x00"));
+    auto reply = client.recvFrame();
+    REQUIRE(reply.type == 0);
+    REQUIRE(reply.payload.size() == 2004);
+    REQUIRE(waitServerEvent(100) == event_t(websocket::Event::Drained, 1, ""));
+}
+
+TEST_CASE_METHOD(OptionsFixture<&http2Options>, "HTTP/2 connection error", "[websocket][slow]")
+{
+    Http2Client client;
+    client.connect(1);
+    REQUIRE(waitServerEvent() == event_t(websocket::Event::NewConnection, 1, ""));
+    REQUIRE(client.recvFrame().type == 1);
+
+    // PUSH_PROMISE from a client: GOAWAY with PROTOCOL_ERROR, then FIN
+    client.sendFrame(5, 4, 1, str("\x00\x00\x00\x02"));
+    auto reply = client.recvFrame();
+    REQUIRE(reply.type == 7);
+    REQUIRE(reply.payload == str("\x00\x00\x00\x01" "\x00\x00\x00\x01"));
+    REQUIRE(waitServerEvent() == event_t(websocket::Event::Disconnect, 1, ""));
+
+    // the server still reads, what the client sends now doesn't get a reset
+    client.sendFrame(6, 0, 0, "12345678");
+    char c;
+    boost::system::error_code ec;
+    client.m_socket.read_some(boost::asio::buffer(&c, 1), ec);
+    REQUIRE(ec == boost::asio::error::eof);
+}
+
+TEST_CASE_METHOD(DecoderFixture, "Decoded messages", "[websocket][slow]")
+{
+    Client client;
+    waitServerEvent(websocket::Event::NewConnection);
+
+    client.sendFrame("\x81\x82" "\x00\x00\x00\x00" "42");
+    websocket::EventRecord record;
+    for (auto n = 0; n < 10 && !server.poll(record); ++n)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    REQUIRE(record.event() == websocket::Event::Message);
+    REQUIRE(record.isDecoded());
+    REQUIRE(*record.decoded<long>() == 42);
+    REQUIRE(record.size() == 0);
+
+    // not a number: 1007; the second small write may wait for the delayed ACK
+    client.sendFrame("\x81\x81" "\x00\x00\x00\x00" "x");
+    REQUIRE(waitServerEvent(100) == event_t(websocket::Event::Disconnect, 1, ""));
+    REQUIRE(client.recvFrame() == str("\x88\x02\x03\xef"));
+}
+
+TEST_CASE_METHOD(OptionsFixture<&routeOptions>, "Message routes", "[websocket][slow]")
+{
+    Client client;
+    waitServerEvent(websocket::Event::NewConnection);
+
+    // {"type":"pub"}
+    client.sendFrame("\x81\x8e" "\x00\x00\x00\x00" "{\"type\":\"pub\"}");
+    auto record = waitMessage();
+    REQUIRE(record.route() == 2);
+    REQUIRE(record.message() == "{\"type\":\"pub\"}");
+
+    // {"type":"get"}
+    client.sendFrame("\x81\x8e" "\x00\x00\x00\x00" "{\"type\":\"get\"}");
+    REQUIRE(waitMessage().route() == 0);
+}
+
 TEST_CASE_METHOD(WebsocketTestsFixture, "Client closes socket", "[websocket][slow]")
 {
     {
@@ -198,3 +983,275 @@ TEST_CASE_METHOD(WebsocketTestsFixture, "Client closes connection", "[websocket]
 
     REQUIRE(client.recvFrame() == str("\x88\x00"));
 }
+
+TEST_CASE_METHOD(TraitsFixture, "Fragmented message", "[websocket][slow]")
+{
+    regression_tests::allocatedCount = 0;
+
+    Client client;
+    waitServerEvent(websocket::Event::NewConnection);
+
+    // a ping between the fragments is answered right away
+    client.sendFrame("\x01\x82" "\x00\x00\x00\x00" "te");
+    client.sendFrame("\x89\x80" "\x00\x00\x00\x00");
+    client.sendFrame("\x80\x82" "\x00\x00\x00\x00" "st");
+    REQUIRE(client.recvFrame() == str("\x8A\x00"));
+    REQUIRE(waitServerEvent() == event_t(websocket::Event::Message, 1, "test"));
+
+    server.sendText(1, "test");
+    REQUIRE(client.recvFrame() == "\x81\x04test");
+    REQUIRE(regression_tests::allocatedCount > 0);
+
+    // over MaxMessageLen
+    client.sendFrame("\x01\x85" "\x00\x00\x00\x00" "01234");
+    client.sendFrame("\x80\x85" "\x00\x00\x00\x00" "56789"); // may wait for the delayed ACK
+    REQUIRE(waitServerEvent(100) == event_t(websocket::Event::Disconnect, 1, ""));
+    REQUIRE(client.recvFrame() == str("\x88\x02\x03\xF1"));
+}
+
+TEST_CASE_METHOD(TraitsFixture, "Invalid UTF-8 message", "[websocket][slow]")
+{
+    Client client;
+    waitServerEvent(websocket::Event::NewConnection);
+
+    client.sendFrame("\x81\x82" "\x00\x00\x00\x00" "\xC0\xAF");
+    REQUIRE(waitServerEvent() == event_t(websocket::Event::Disconnect, 1, ""));
+    REQUIRE(client.recvFrame() == str("\x88\x02\x03\xEF"));
+}
+
+TEST_CASE_METHOD(OptionsFixture<&singleConnectionOptions>, "Server is full", "[websocket][slow]")
+{
+    Client client;
+    waitServerEvent(websocket::Event::NewConnection);
+
+    boost::asio::io_service ioService;
+    boost::asio::ip::tcp::socket socket{ioService};
+    socket.connect({boost::asio::ip::address_v4::from_string(ServerIp), ServerPort});
+
+    boost::asio::streambuf replyBuf;
+    boost::system::error_code ec;
+    boost::asio::read(socket, replyBuf, ec);
+    std::stringstream replyStream;
+    replyStream << &replyBuf;
+
+    REQUIRE(replyStream.str() ==
+        "HTTP/1.1 503 Service Unavailable\r\n"
+        "Retry-After: 5\r\n"
+        "Connection: close\r\n"
+        "Content-Length: 0\r\n"
+        "\r\n");
+}
+
+TEST_CASE_METHOD(WebsocketTestsFixture, "Client ping", "[websocket][slow]")
+{
+    Client client;
+    waitServerEvent(websocket::Event::NewConnection);
+
+    client.sendFrame("\x89\x82" "\x00\x00\x00\x00" "hi");
+    REQUIRE(client.recvFrame() == "\x8A\x02hi");
+}
+
+TEST_CASE_METHOD(OptionsFixture<&keepaliveOptions>, "Keepalive timeout", "[websocket][slow]")
+{
+    Client client;
+    waitServerEvent(websocket::Event::NewConnection);
+
+    auto ping = client.recvFrame();
+    REQUIRE(ping.substr(0, 2) == "\x89\x08");
+
+    REQUIRE(waitServerEvent(1000) == event_t(websocket::Event::Disconnect, 1, ""));
+}
+
+TEST_CASE_METHOD(WebsocketTestsFixture, "Client closes connection with status", "[websocket][slow]")
+{
+    Client client;
+    waitServerEvent(websocket::Event::NewConnection);
+
+    client.sendFrame("\x88\x85" "\x00\x00\x00\x00" "\x03\xE9" "bye");
+    REQUIRE(waitServerEvent() == event_t(websocket::Event::Disconnect, 1, ""));
+
+    REQUIRE(client.recvFrame() == str("\x88\x02\x03\xE9"));
+    REQUIRE(client.isEof());
+}
+
+TEST_CASE_METHOD(WebsocketTestsFixture, "Client closes connection with invalid status", "[websocket][slow]")
+{
+    Client client;
+    waitServerEvent(websocket::Event::NewConnection);
+
+    client.sendFrame("\x88\x82" "\x00\x00\x00\x00" "\x03\xED");
+    REQUIRE(waitServerEvent() == event_t(websocket::Event::Disconnect, 1, ""));
+
+    REQUIRE(client.recvFrame() == str("\x88\x02\x03\xEA"));
+}
+
+TEST_CASE_METHOD(WebsocketTestsFixture, "Server closes connection", "[websocket][slow]")
+{
+    Client client;
+    waitServerEvent(websocket::Event::NewConnection);
+
+    server.drop(1);
+    REQUIRE(waitServerEvent() == event_t(websocket::Event::Disconnect, 1, ""));
+    REQUIRE(client.recvFrame() == str("\x88\x02\x03\xE8"));
+
+    // messages after Close are discarded
+    server.sendText(1, "test");
+    client.sendFrame("\x81\x84" "\x14\x7b\x35\x0f" "\x60\x1e\x46\x7b");
+
+    client.sendFrame("\x88\x82" "\x00\x00\x00\x00" "\x03\xE8");
+    REQUIRE(client.isEof());
+
+    websocket::Event event;
+    websocket::ConnectionId connId;
+    std::string message;
+    REQUIRE_FALSE(server.poll(event, connId, message));
+}
+
+TEST_CASE_METHOD(OptionsFixture<&sessionOptions>, "Session resumption", "[websocket][slow]")
+{
+    std::string token;
+    {
+        Client client{{}, true};
+        token = client.m_sessionToken;
+        REQUIRE(token.size() == 32);
+        waitServerEvent(websocket::Event::NewConnection);
+
+        server.sendText(1, "one");
+        REQUIRE(client.recvFrame() == "\x81\x03one");
+    }
+
+    // the application doesn't notice the blip
+    requireNoEvents();
+    server.sendText(1, "two");
+    server.sendText(1, "three");
+
+    Client client{"X-WebSocket-Session: " + token + "\r\nX-WebSocket-Last-Seq: 1\r\n", true};
+    REQUIRE(client.m_sessionToken == token);
+    REQUIRE(client.recvBytes(12) == "\x81\x03two\x81\x05three");
+
+    client.sendFrame("\x81\x84" "\x14\x7b\x35\x0f" "\x60\x1e\x46\x7b");
+    REQUIRE(waitServerEvent() == event_t(websocket::Event::Message, 1, "test"));
+}
+
+TEST_CASE_METHOD(OptionsFixture<&sessionOptions>, "Session is not resumed", "[websocket][slow]")
+{
+    std::string token;
+    {
+        Client client{{}, true};
+        token = client.m_sessionToken;
+        waitServerEvent(websocket::Event::NewConnection);
+
+        for (auto&& message : {"1", "2", "3", "4", "5", "6"})
+            server.sendText(1, message);
+    }
+
+    // the client has missed more messages than the ring keeps
+    requireNoEvents();
+    Client client{"X-WebSocket-Session: " + token + "\r\nX-WebSocket-Last-Seq: 0\r\n", true};
+    REQUIRE(client.m_sessionToken != token);
+    REQUIRE(waitServerEvent() == event_t(websocket::Event::NewConnection, 2, ""));
+
+    // the old session expires
+    REQUIRE(waitServerEvent(2000) == event_t(websocket::Event::Disconnect, 1, ""));
+}
+
+TEST_CASE_METHOD(JournalFixture, "Broadcast replay", "[websocket][slow]")
+{
+    Client first;
+    waitServerEvent(websocket::Event::NewConnection);
+    server.subscribe(1);
+
+    server.broadcastText("one");
+    server.broadcastText("two");
+    REQUIRE(first.recvBytes(10) == "\x81\x03one\x81\x03two");
+
+    // a late subscriber replays from the second message, then gets the new ones
+    Client second;
+    waitServerEvent(websocket::Event::NewConnection);
+    server.subscribe(2, 1);
+    server.broadcastText("three");
+
+    REQUIRE(second.recvBytes(12) == "\x81\x03two\x81\x05three");
+    REQUIRE(first.recvBytes(7) == "\x81\x05three");
+
+    // longer than a segment: sent, not journaled, and the I/O thread goes on
+    server.broadcastText(std::string(5000, 'x'));
+    server.broadcastText("four");
+    REQUIRE(first.recvBytes(4 + 5000) == "\x81\x7E\x13\x88" + std::string(5000, 'x'));
+    REQUIRE(first.recvBytes(6) == "\x81\x04" "four");
+
+    // the sends and the broadcasts of one thread keep their order
+    server.sendText(1, "five");
+    server.broadcastText("six");
+    REQUIRE(first.recvBytes(11) == "\x81\x04" "five" "\x81\x03" "six");
+}
+
+#if !defined _WIN32
+TEST_CASE_METHOD(OptionsFixture<&sharedMemoryOptions>, "Shared memory channel", "[websocket][slow]")
+{
+    websocket::SharedMemoryClient app{"/websocket-cpp-test"};
+
+    Client client;
+    REQUIRE(waitSharedEvent(app) == event_t(websocket::Event::NewConnection, 1, ""));
+
+    client.sendFrame("\x81\x84" "\x14\x7b\x35\x0f" "\x60\x1e\x46\x7b");
+    REQUIRE(waitSharedEvent(app) == event_t(websocket::Event::Message, 1, "test"));
+
+    REQUIRE(app.sendText(1, "test"));
+    REQUIRE(client.recvFrame() == "\x81\x04test");
+
+    // the events don't go to poll()
+    websocket::Event event;
+    websocket::ConnectionId connId;
+    std::string message;
+    REQUIRE_FALSE(server.poll(event, connId, message));
+
+    // larger than a record of the 64 byte ring: refused on arrival, the mask is zero
+    std::string frame = str("\x82\xBC" "\x00\x00\x00\x00") + std::string(60, 'x');
+    boost::asio::write(client.m_socket, boost::asio::buffer(frame));
+    REQUIRE(client.recvFrame() == str("\x88\x02\x03\xF1"));
+    REQUIRE(waitSharedEvent(app) == event_t(websocket::Event::Disconnect, 1, ""));
+}
+
+TEST_CASE_METHOD(WebsocketTestsFixture, "Handoff", "[websocket][slow]")
+{
+    Client client;
+    waitServerEvent(websocket::Event::NewConnection);
+
+    // a half-received frame moves to the new server with the socket
+    client.sendFrame("\x81\x84" "\x14\x7b");
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    const auto socketPath = "/tmp/websocket-handoff-test";
+    std::thread oldServer{[&] { server.handoff(socketPath); }};
+
+    websocket::Server newServer;
+    newServer.resume(socketPath, std::cout);
+    oldServer.join();
+
+    client.sendFrame("\x35\x0f" "\x60\x1e\x46\x7b");
+
+    std::vector<event_t> events;
+    for (auto n = 0; n < 100 && events.size() < 2; ++n)
+    {
+        websocket::Event event;
+        websocket::ConnectionId connId;
+        std::string message;
+        if (newServer.poll(event, connId, message))
+            events.emplace_back(event, connId, message);
+        else
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    REQUIRE(events.size() == 2);
+    REQUIRE(events[0] == event_t(websocket::Event::NewConnection, 1, ""));
+    REQUIRE(events[1] == event_t(websocket::Event::Message, 1, "test"));
+
+    newServer.sendText(1, "test");
+    REQUIRE(client.recvFrame() == "\x81\x04test");
+
+    // the listening socket moved too
+    Client second;
+    newServer.stop();
+}
+#endif
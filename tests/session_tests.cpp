@@ -0,0 +1,55 @@
+#include "details/Session.hpp"
+
+#include "catch_wrap.hpp"
+
+#include <vector>
+
+namespace ws_details = websocket::details;
+
+namespace
+{
+    std::vector<std::string> replay(const ws_details::ReplayRing& ring, std::uint64_t lastSeen)
+    {
+        std::vector<std::string> messages;
+        ring.replay(lastSeen, [&](ws_details::Opcode, const std::string& data) { messages.push_back(data); });
+        return messages;
+    }
+}
+
+TEST_CASE("replay ring keeps the last messages", "[websocket]")
+{
+    ws_details::ReplayRing ring{3};
+    REQUIRE(ring.canReplayFrom(0));
+    REQUIRE(replay(ring, 0).empty());
+
+    REQUIRE(ring.push(ws_details::Opcode::Text, "1") == 1);
+    REQUIRE(ring.push(ws_details::Opcode::Text, "2") == 2);
+    REQUIRE(replay(ring, 0) == (std::vector<std::string>{"1", "2"}));
+    REQUIRE(replay(ring, 1) == (std::vector<std::string>{"2"}));
+    REQUIRE(replay(ring, 2).empty());
+    REQUIRE_FALSE(ring.canReplayFrom(3));
+
+    ring.push(ws_details::Opcode::Text, "3");
+    ring.push(ws_details::Opcode::Binary, "4");
+    REQUIRE(ring.lastSeq() == 4);
+    REQUIRE_FALSE(ring.canReplayFrom(0));
+    REQUIRE(replay(ring, 1) == (std::vector<std::string>{"2", "3", "4"}));
+}
+
+TEST_CASE("session table", "[websocket]")
+{
+    ws_details::SessionTable sessions;
+
+    auto token = ws_details::makeSessionToken();
+    REQUIRE(token.size() == 32);
+    REQUIRE(token != ws_details::makeSessionToken());
+
+    sessions.create(7, token, 4);
+    REQUIRE(sessions.findByToken(token) == sessions.find(7));
+    REQUIRE(sessions.find(7)->token == token);
+    REQUIRE(sessions.findByToken("unknown") == nullptr);
+
+    sessions.erase(7);
+    REQUIRE(sessions.size() == 0);
+    REQUIRE(sessions.findByToken(token) == nullptr);
+}
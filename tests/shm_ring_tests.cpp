@@ -0,0 +1,128 @@
+#include "details/shm_ring.hpp"
+
+#include "catch_wrap.hpp"
+
+#include <vector>
+
+namespace ws_details = websocket::details;
+
+namespace
+{
+    struct SharedRingFixture
+    {
+        ws_details::RingHeader header{};
+        alignas(16) char data[128];
+        ws_details::SharedRing producer{&header, data, sizeof(data)};
+        ws_details::SharedRing consumer{&header, data, sizeof(data)};
+
+        bool push(std::uint64_t connId, const std::string& payload)
+        {
+            return producer.push(ws_details::RecordType::Message, connId, payload.data(), payload.size());
+        }
+
+        std::string pop()
+        {
+            ws_details::RecordHeader record;
+            const char* payload;
+            if (!consumer.front(record, payload))
+                return "<empty>";
+
+            std::string s{payload, record.size};
+            consumer.pop(record);
+            return s;
+        }
+    };
+}
+
+TEST_CASE_METHOD(SharedRingFixture, "shared ring passes records in order", "[websocket]")
+{
+    REQUIRE(pop() == "<empty>");
+
+    REQUIRE(push(1, "first"));
+    REQUIRE(push(2, ""));
+    REQUIRE(pop() == "first");
+    REQUIRE(pop() == "");
+    REQUIRE(pop() == "<empty>");
+}
+
+TEST_CASE_METHOD(SharedRingFixture, "shared ring is bounded", "[websocket]")
+{
+    // 16 byte header + 40 bytes -> 64 bytes a record
+    std::string payload(40, 'x');
+    REQUIRE(push(1, payload));
+    REQUIRE(push(2, payload));
+    REQUIRE_FALSE(push(3, payload));
+
+    REQUIRE(pop() == payload);
+    REQUIRE(push(3, payload));
+}
+
+TEST_CASE_METHOD(SharedRingFixture, "shared ring wraps with padding", "[websocket]")
+{
+    std::string payload(40, 'x');
+    REQUIRE(push(1, payload)); // 0..64
+    REQUIRE(push(2, "a"));     // 64..96
+    REQUIRE(pop() == payload);
+    REQUIRE(pop() == "a");
+
+    // 32 bytes left before the end, the record goes to the start
+    REQUIRE(push(3, payload));
+    REQUIRE(header.tail.load() == 96 + 32 + 64);
+    REQUIRE(pop() == payload);
+    REQUIRE(pop() == "<empty>");
+
+    REQUIRE_THROWS_AS(push(4, std::string(200, 'x')), std::length_error);
+}
+
+TEST_CASE_METHOD(SharedRingFixture, "shared ring wraps a record of the ring size", "[websocket]")
+{
+    REQUIRE(push(1, ""));
+    REQUIRE(pop() == "");
+
+    // the record takes the whole ring: the Padding to the end goes first, the record
+    // follows once the consumer has skipped it
+    std::string payload(112, 'x');
+    REQUIRE_FALSE(push(2, payload));
+    REQUIRE(header.tail.load() == 128);
+    REQUIRE(pop() == "<empty>");
+    REQUIRE(push(2, payload));
+    REQUIRE(pop() == payload);
+}
+
+#if !defined _WIN32
+TEST_CASE("shared channel bounds the waiting events", "[websocket]")
+{
+    // a 128 byte ring takes at most 112 bytes of payload, up to 30 more wait for room
+    ws_details::SharedChannel channel{"/websocket-cpp-channel-test", 128, 30};
+    ws_details::SharedSegment app{"/websocket-cpp-channel-test", false};
+    auto events = app.eventRing();
+
+    REQUIRE(channel.maxPayload() == 112);
+    REQUIRE(channel.publish(websocket::EventRecord{websocket::Event::Message, 1, std::string(100, 'x')}));
+    REQUIRE(channel.publish(websocket::EventRecord{websocket::Event::Message, 1, std::string(10, 'y')}));
+    REQUIRE(channel.overflowBytes() == 10);
+
+    // over the limit a message is refused, a disconnect still waits
+    REQUIRE_FALSE(channel.publish(websocket::EventRecord{websocket::Event::Message, 2, std::string(25, 'z')}));
+    REQUIRE(channel.publish(websocket::EventRecord{websocket::Event::Disconnect, 2}));
+    REQUIRE(channel.overflowBytes() == 10);
+
+    // never fits, refused instead of throwing in the I/O loop
+    REQUIRE_FALSE(channel.publish(websocket::EventRecord{websocket::Event::Message, 3, std::string(113, 'w')}));
+
+    ws_details::RecordHeader header;
+    const char* payload;
+    REQUIRE(events.front(header, payload));
+    REQUIRE(header.size == 100);
+    events.pop(header);
+
+    channel.flush();
+    REQUIRE(channel.overflowBytes() == 0);
+    REQUIRE(events.front(header, payload));
+    REQUIRE(std::string(payload, header.size) == std::string(10, 'y'));
+    events.pop(header);
+    REQUIRE(events.front(header, payload));
+    REQUIRE(header.type == ws_details::RecordType::Disconnect);
+    REQUIRE(header.connId == 2);
+}
+#endif
@@ -0,0 +1,93 @@
+#include "details/SubmitRing.hpp"
+
+#include "catch_wrap.hpp"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ws_details = websocket::details;
+
+TEST_CASE("Submission ring is bounded", "[websocket]")
+{
+    ws_details::SubmitRing<std::string> ring{3}; // 4 slots
+
+    for (int i = 0; i != 4; ++i)
+    {
+        std::string value = std::to_string(i);
+        REQUIRE(ring.tryPush(value));
+    }
+
+    std::string value = "4";
+    REQUIRE_FALSE(ring.tryPush(value));
+    REQUIRE(value == "4"); // not consumed
+
+    std::string popped;
+    REQUIRE(ring.tryPop(popped));
+    REQUIRE(popped == "0");
+    REQUIRE(ring.tryPush(value));
+
+    for (int i = 1; i != 5; ++i)
+    {
+        REQUIRE(ring.tryPop(popped));
+        REQUIRE(popped == std::to_string(i));
+    }
+    REQUIRE_FALSE(ring.tryPop(popped));
+}
+
+TEST_CASE("Full submission ring gives up when stopped", "[websocket]")
+{
+    ws_details::SubmitRing<int> ring{2};
+    std::atomic<bool> isStopped{false};
+    REQUIRE(ring.push(1, isStopped));
+    REQUIRE(ring.push(2, isStopped));
+
+    isStopped = true;
+    REQUIRE_FALSE(ring.push(3, isStopped));
+
+    int popped;
+    REQUIRE(ring.tryPop(popped));
+    REQUIRE(ring.push(3, isStopped)); // there is room again
+}
+
+TEST_CASE("Submission ring keeps the order of each producer", "[websocket]")
+{
+    const int producerCount = 4;
+    const int valueCount = 20000;
+
+    ws_details::SubmitRing<std::pair<int, int>> ring{64};
+    std::atomic<bool> isStopped{false};
+
+    std::vector<std::thread> producers;
+    for (int producer = 0; producer != producerCount; ++producer)
+    {
+        producers.emplace_back([&ring, &isStopped, producer]
+        {
+            for (int i = 0; i != valueCount; ++i)
+                ring.push(std::make_pair(producer, i), isStopped);
+        });
+    }
+
+    std::vector<int> next(producerCount, 0);
+    bool isOrdered = true;
+    for (int received = 0; received != producerCount * valueCount;)
+    {
+        std::pair<int, int> value;
+        if (!ring.tryPop(value))
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        isOrdered = isOrdered && value.second == next[value.first];
+        next[value.first] = value.second + 1;
+        ++received;
+    }
+
+    for (auto&& producer : producers)
+        producer.join();
+
+    REQUIRE(isOrdered);
+    REQUIRE(next == std::vector<int>(producerCount, valueCount));
+}
@@ -0,0 +1,64 @@
+#include "details/TimerWheel.hpp"
+
+#include "catch_wrap.hpp"
+
+namespace ws_details = websocket::details;
+
+namespace
+{
+    struct TimerWheelFixture
+    {
+        ws_details::TimerWheel<int> wheel{4};
+        std::vector<int> expired;
+
+        std::vector<int> advance()
+        {
+            expired.clear();
+            wheel.advance([this](int value) { expired.push_back(value); });
+            return expired;
+        }
+    };
+}
+
+TEST_CASE_METHOD(TimerWheelFixture, "timers fire in order", "[websocket]")
+{
+    wheel.schedule(2, 2);
+    wheel.schedule(1, 1);
+    wheel.schedule(1, 11);
+    wheel.schedule(0, 10); // next tick
+
+    REQUIRE(advance() == (std::vector<int>{1, 11, 10}));
+    REQUIRE(advance() == std::vector<int>{2});
+    REQUIRE(advance().empty());
+    REQUIRE(wheel.size() == 0);
+}
+
+TEST_CASE_METHOD(TimerWheelFixture, "timers longer than a revolution", "[websocket]")
+{
+    wheel.schedule(4, 4);
+    wheel.schedule(5, 5);
+    wheel.schedule(9, 9);
+
+    for (auto tick = 1; tick <= 10; ++tick)
+    {
+        auto fired = advance();
+        if (tick == 4 || tick == 5 || tick == 9)
+            REQUIRE(fired == std::vector<int>{tick});
+        else
+            REQUIRE(fired.empty());
+    }
+}
+
+TEST_CASE_METHOD(TimerWheelFixture, "rescheduling from the callback", "[websocket]")
+{
+    wheel.schedule(1, 0);
+
+    auto fired = 0;
+    for (auto tick = 0; tick != 12; ++tick)
+    {
+        wheel.advance([&](int) { ++fired; wheel.schedule(4, 0); });
+    }
+
+    REQUIRE(fired == 3);
+    REQUIRE(wheel.size() == 1);
+}
@@ -0,0 +1,39 @@
+#include "details/utf8.hpp"
+
+#include "catch_wrap.hpp"
+
+namespace ws_details = websocket::details;
+
+namespace
+{
+    template<std::size_t N>
+    bool isValid(const char(&s)[N])
+    {
+        return ws_details::isValidUtf8(s, N - 1);
+    }
+}
+
+TEST_CASE("Valid UTF-8", "[websocket]")
+{
+    REQUIRE(isValid(""));
+    REQUIRE(isValid("hello"));
+    REQUIRE(isValid("\xC2\xA2"));                // U+00A2
+    REQUIRE(isValid("\xE2\x82\xAC"));            // U+20AC
+    REQUIRE(isValid("\xED\x9F\xBF"));            // U+D7FF
+    REQUIRE(isValid("\xEF\xBF\xBF"));            // U+FFFF
+    REQUIRE(isValid("\xF0\x90\x80\x80"));        // U+10000
+    REQUIRE(isValid("\xF4\x8F\xBF\xBF"));        // U+10FFFF
+    REQUIRE(ws_details::isValidUtf8("a\0b", 3));
+}
+
+TEST_CASE("Invalid UTF-8", "[websocket]")
+{
+    REQUIRE_FALSE(isValid("\x80"));              // continuation byte first
+    REQUIRE_FALSE(isValid("\xC0\xAF"));          // overlong
+    REQUIRE_FALSE(isValid("\xE0\x80\xAF"));      // overlong
+    REQUIRE_FALSE(isValid("\xED\xA0\x80"));      // surrogate
+    REQUIRE_FALSE(isValid("\xF4\x90\x80\x80"));  // above U+10FFFF
+    REQUIRE_FALSE(isValid("\xF5\x80\x80\x80"));
+    REQUIRE_FALSE(isValid("\xE2\x82"));          // truncated
+    REQUIRE_FALSE(isValid("\xE2\x28\xA1"));
+}
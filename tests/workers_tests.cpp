@@ -0,0 +1,165 @@
+#include "details/workers.hpp"
+
+#include "catch_wrap.hpp"
+
+#include <thread>
+
+namespace ws_details = websocket::details;
+
+TEST_CASE("connection id carries the worker", "[websocket]")
+{
+    REQUIRE(ws_details::firstConnectionId(0) == 0);
+    REQUIRE(ws_details::workerOf(ws_details::firstConnectionId(3) + 42) == 3);
+    REQUIRE(ws_details::workerOf(ws_details::firstConnectionId(255) + 1) == 255);
+}
+
+TEST_CASE("restarted worker doesn't reuse connection ids", "[websocket]")
+{
+    auto crashed = ws_details::firstConnectionId(3, 0) + 1;
+    auto restarted = ws_details::firstConnectionId(3, 1) + 1;
+    REQUIRE(restarted != crashed);
+    REQUIRE(ws_details::workerOf(restarted) == 3);
+    REQUIRE(ws_details::workerOf(ws_details::firstConnectionId(255, 0xFFFF) + 1) == 255);
+}
+
+TEST_CASE("routed message", "[websocket]")
+{
+    auto connId = ws_details::firstConnectionId(2) + 7;
+    auto data = ws_details::RoutedMessage::make(ws_details::RoutedCommand::SendBinary, connId, "test");
+
+    ws_details::RoutedCommand command;
+    websocket::ConnectionId parsedId;
+    std::string message;
+    REQUIRE(ws_details::RoutedMessage::parse(data.data(), data.size(), command, parsedId, message));
+    REQUIRE(command == ws_details::RoutedCommand::SendBinary);
+    REQUIRE(parsedId == connId);
+    REQUIRE(message == "test");
+
+    REQUIRE_FALSE(ws_details::RoutedMessage::parse(data.data(), 5, command, parsedId, message));
+    data[0] = 0;
+    REQUIRE_FALSE(ws_details::RoutedMessage::parse(data.data(), data.size(), command, parsedId, message));
+
+    // the broadcasts don't come from other workers, subscriptions do
+    data[0] = static_cast<char>(ws_details::RoutedCommand::BroadcastText);
+    REQUIRE_FALSE(ws_details::RoutedMessage::parse(data.data(), data.size(), command, parsedId, message));
+    data[0] = static_cast<char>(ws_details::RoutedCommand::Subscribe);
+    REQUIRE(ws_details::RoutedMessage::parse(data.data(), data.size(), command, parsedId, message));
+    REQUIRE(command == ws_details::RoutedCommand::Subscribe);
+}
+
+#if !defined _WIN32
+TEST_CASE("messages are routed to the owner", "[websocket]")
+{
+    ws_details::WorkerChannels channels{2};
+    channels.setWorker(1, 0);
+
+    // worker 1 reads only its own channel, the one of worker 0 is just written
+    channels.route(ws_details::RoutedCommand::Drop, ws_details::firstConnectionId(1) + 5, {});
+
+    char buf[64];
+    auto n = ::recv(channels.readHandle(), buf, sizeof(buf), MSG_DONTWAIT);
+    REQUIRE(n == ssize_t(ws_details::RoutedMessage::HeaderSize));
+
+    ws_details::RoutedCommand command;
+    websocket::ConnectionId connId;
+    std::string message;
+    REQUIRE(ws_details::RoutedMessage::parse(buf, n, command, connId, message));
+    REQUIRE(command == ws_details::RoutedCommand::Drop);
+    REQUIRE(connId == ws_details::firstConnectionId(1) + 5);
+
+    channels.route(ws_details::RoutedCommand::Drop, ws_details::firstConnectionId(7), {}); // no such worker
+    REQUIRE(::recv(channels.readHandle(), buf, sizeof(buf), MSG_DONTWAIT) < 0);
+}
+
+TEST_CASE("large routed messages go in fragments", "[websocket]")
+{
+    ws_details::WorkerChannels channels{2};
+    channels.setWorker(1, 0);
+
+    // 512 KiB is more than a datagram with the default net.core.wmem_max (~200 KiB), the other
+    // message is fragmented whatever the limit is
+    std::string large(512 * 1024, '\0');
+    for (std::size_t i = 0; i != large.size(); ++i)
+        large[i] = static_cast<char>(i * 7);
+    std::string larger(2 * channels.maxDatagram() + 1000, 'x');
+
+    // the owner reads while the sender waits for room in the channel
+    std::vector<std::string> received;
+    bool isValid = true;
+    ws_details::RoutedAssembler assembler;
+    std::thread owner{[&]
+    {
+        std::vector<char> buf(ws_details::RoutedMessage::MaxSize);
+        while (isValid && received.size() != 3)
+        {
+            auto n = ::recv(channels.readHandle(), buf.data(), buf.size(), 0);
+            ws_details::RoutedCommand command;
+            websocket::ConnectionId connId;
+            std::string message;
+            bool isComplete;
+            isValid = n > 0 && assembler.receive(buf.data(), n, command, connId, message, isComplete);
+            if (isValid && isComplete)
+            {
+                isValid = command == ws_details::RoutedCommand::SendBinary && connId == ws_details::firstConnectionId(1) + 5;
+                received.push_back(std::move(message));
+            }
+        }
+    }};
+
+    channels.route(ws_details::RoutedCommand::SendBinary, ws_details::firstConnectionId(1) + 5, large);
+    channels.route(ws_details::RoutedCommand::SendBinary, ws_details::firstConnectionId(1) + 5, larger);
+    channels.route(ws_details::RoutedCommand::SendBinary, ws_details::firstConnectionId(1) + 5, "small");
+    owner.join();
+
+    REQUIRE(isValid);
+    REQUIRE(assembler.partialCount() == 0);
+    REQUIRE(received.size() == 3);
+    REQUIRE(received[0] == large);
+    REQUIRE(received[1] == larger);
+    REQUIRE(received[2] == "small");
+}
+
+TEST_CASE("fragments of interleaved messages", "[websocket]")
+{
+    auto connId = ws_details::firstConnectionId(1) + 5;
+    auto a1 = ws_details::RoutedMessage::makeFragment(ws_details::RoutedCommand::SendText, connId, 1, false, "ab", 2);
+    auto b1 = ws_details::RoutedMessage::makeFragment(ws_details::RoutedCommand::SendText, connId, 2, false, "xy", 2);
+    auto a2 = ws_details::RoutedMessage::makeFragment(ws_details::RoutedCommand::SendText, connId, 1, true, "c", 1);
+    auto small = ws_details::RoutedMessage::make(ws_details::RoutedCommand::Drop, connId, {});
+    auto b2 = ws_details::RoutedMessage::makeFragment(ws_details::RoutedCommand::SendText, connId, 2, true, "z", 1);
+
+    ws_details::RoutedAssembler assembler;
+    ws_details::RoutedCommand command;
+    websocket::ConnectionId parsedId;
+    std::string message;
+    bool isComplete;
+
+    REQUIRE(assembler.receive(a1.data(), a1.size(), command, parsedId, message, isComplete));
+    REQUIRE_FALSE(isComplete);
+    REQUIRE(assembler.receive(b1.data(), b1.size(), command, parsedId, message, isComplete));
+    REQUIRE_FALSE(isComplete);
+    REQUIRE(assembler.receive(a2.data(), a2.size(), command, parsedId, message, isComplete));
+    REQUIRE(isComplete);
+    REQUIRE(message == "abc");
+    REQUIRE(assembler.receive(small.data(), small.size(), command, parsedId, message, isComplete));
+    REQUIRE(isComplete);
+    REQUIRE(command == ws_details::RoutedCommand::Drop);
+    REQUIRE(assembler.receive(b2.data(), b2.size(), command, parsedId, message, isComplete));
+    REQUIRE(isComplete);
+    REQUIRE(message == "xyz");
+    REQUIRE(assembler.partialCount() == 0);
+
+    // only messages are fragmented
+    auto drop = ws_details::RoutedMessage::makeFragment(ws_details::RoutedCommand::Drop, connId, 3, true, "", 0);
+    REQUIRE_FALSE(assembler.receive(drop.data(), drop.size(), command, parsedId, message, isComplete));
+
+    // the parts of dead senders don't pile up
+    std::size_t maxPartial = ws_details::RoutedAssembler::MaxPartial;
+    for (std::uint64_t tag = 10; tag != 10 + 2 * maxPartial; ++tag)
+    {
+        auto part = ws_details::RoutedMessage::makeFragment(ws_details::RoutedCommand::SendText, connId, tag, false, "p", 1);
+        REQUIRE(assembler.receive(part.data(), part.size(), command, parsedId, message, isComplete));
+    }
+    REQUIRE(assembler.partialCount() == maxPartial);
+}
+#endif
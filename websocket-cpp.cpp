@@ -2,3 +2,5 @@
 // Belongs to the public domain
 
 #include "server_src.hpp"
+
+template class websocket::BasicServer<websocket::DefaultServerTraits>;